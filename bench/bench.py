@@ -0,0 +1,127 @@
+#!/usr/bin/env python3
+"""Benchmark sweep for nbody.
+
+Generates deterministic inputs with ./generate (cached in the work
+directory), runs ./nbody over every combination of the swept settings and
+appends one JSON object per run to the results file. Each object holds the
+per-phase timings written by nbody -J (slowest and mean rank), the direct-sum
+accuracy check when enabled, and the sweep settings.
+
+Build first with make, then for example:
+
+    ./bench/bench.py --sizes 1e4,1e5 --thetas 0.3,0.5,0.8 --ranks 1,2 --threads 1,4
+    ./bench/bench.py --distributions plummer,disk --sizes 1e6 --extra "-m distributed -g 16"
+    ./bench/bench.py --sizes 1e3,2e3,4e3 --accuracy all --extra "-a auto"
+"""
+
+import argparse
+import itertools
+import json
+import os
+import shlex
+import subprocess
+import sys
+import time
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+DISTRIBUTIONS = ["uniform", "plummer", "clustered", "disk"]
+PHASES = ["read", "build", "force", "exchange", "checkpoint", "write"]
+
+
+def parse_list(text, convert):
+    return [convert(item) for item in text.split(",") if item]
+
+
+def parse_count(text):
+    return int(float(text))
+
+
+def generate_input(args, distribution, count):
+    path = os.path.join(args.workdir, f"{distribution}-{count}-{args.seed}.snap")
+    if not os.path.exists(path):
+        subprocess.run([os.path.join(ROOT, "generate"), distribution, str(count), path, str(args.seed)], check=True)
+    return path
+
+
+def run_case(args, input_path, count, theta, ranks, threads, repeat):
+    report = os.path.join(args.workdir, "report.json")
+    if os.path.exists(report):
+        os.remove(report)
+
+    command = shlex.split(args.mpirun) + ["-n", str(ranks), os.path.join(ROOT, "nbody"),
+        "-i", input_path, "-o", os.path.join(args.workdir, "output.snap"),
+        "-s", str(args.steps), "-t", str(theta), "-d", str(args.dt),
+        "-T", str(threads), "-J", report]
+    if args.accuracy != "0":
+        command += ["-A", args.accuracy]
+    command += shlex.split(args.extra)
+
+    start = time.time()
+    completed = subprocess.run(command, stdout=subprocess.PIPE, stderr=subprocess.PIPE, text=True)
+    wall = time.time() - start
+    if completed.returncode != 0 or not os.path.exists(report):
+        sys.stderr.write(completed.stdout + completed.stderr)
+        raise RuntimeError("run failed: " + " ".join(command))
+
+    with open(report) as file:
+        result = json.load(file)
+    result["repeat"] = repeat
+    result["wall_seconds"] = wall
+    result["command"] = " ".join(command)
+    return result
+
+
+def print_row(result, distribution):
+    phases = result["phases"]
+    accuracy = result.get("accuracy")
+    error = accuracy["quadrupole" if result["quadrupoles"] else "monopole"]["rms_error"] if accuracy else float("nan")
+    step_time = sum(phases[p]["max"] for p in ("build", "force", "exchange")) / max(result["steps"], 1)
+    print(f"{distribution:<10} {result['particles']:>9} {result['theta']:>6.2f} {result['ranks']:>5} "
+          f"{result['threads']:>7} {result['total_seconds']:>9.3f} {step_time:>9.4f} "
+          + " ".join(f"{phases[p]['max']:>9.3f}" for p in PHASES) + f" {error:>10.3e}", flush=True)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--distributions", default="uniform", help="comma separated, from " + ", ".join(DISTRIBUTIONS))
+    parser.add_argument("--sizes", default="1e3,1e4,1e5", help="comma separated particle counts")
+    parser.add_argument("--thetas", default="0.5", help="comma separated MAC thresholds")
+    parser.add_argument("--ranks", default="1", help="comma separated MPI rank counts")
+    parser.add_argument("--threads", default="1", help="comma separated threads per rank")
+    parser.add_argument("--steps", type=int, default=10)
+    parser.add_argument("--dt", type=float, default=0.005)
+    parser.add_argument("--accuracy", default="100",
+                        help="particles checked against a direct sum, all for every particle against the all-pairs sum, 0 to skip")
+    parser.add_argument("--repeats", type=int, default=1)
+    parser.add_argument("--seed", type=int, default=1)
+    parser.add_argument("--extra", default="", help="further nbody options, e.g. \"-m distributed -q\"")
+    parser.add_argument("--mpirun", default="mpirun --oversubscribe", help="launcher command")
+    parser.add_argument("--workdir", default=os.path.join(ROOT, "bench", "work"))
+    parser.add_argument("--output", default=os.path.join(ROOT, "bench", "results.jsonl"))
+    args = parser.parse_args()
+
+    distributions = parse_list(args.distributions, str)
+    for distribution in distributions:
+        if distribution not in DISTRIBUTIONS:
+            parser.error(f"unknown distribution {distribution}")
+    os.makedirs(args.workdir, exist_ok=True)
+
+    print(f"{'dist':<10} {'N':>9} {'theta':>6} {'ranks':>5} {'threads':>7} {'total':>9} {'per step':>9} "
+          + " ".join(f"{p:>9}" for p in PHASES) + f" {'rms error':>10}")
+    with open(args.output, "a") as output:
+        for distribution in distributions:
+            for count in parse_list(args.sizes, parse_count):
+                input_path = generate_input(args, distribution, count)
+                sweep = itertools.product(parse_list(args.thetas, float), parse_list(args.ranks, int),
+                                          parse_list(args.threads, int), range(args.repeats))
+                for theta, ranks, threads, repeat in sweep:
+                    result = run_case(args, input_path, count, theta, ranks, threads, repeat)
+                    result["distribution"] = distribution
+                    result["seed"] = args.seed
+                    output.write(json.dumps(result) + "\n")
+                    output.flush()
+                    print_row(result, distribution)
+
+
+if __name__ == "__main__":
+    main()
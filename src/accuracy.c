@@ -0,0 +1,164 @@
+#include "accuracy.h"
+
+// Compute the tree force on every particle in tree order and print how far the
+// sampled forces are from the reference
+static AccuracyResult measure_forces(const char* label, const Options* opts, FlatTree* tree, GroupSet* groups,
+                                     InteractionList* list, ParticleSoA* soa, const int* samples,
+                                     const double* ref_x, const double* ref_y, int sample_count) {
+    long long interactions = 0;
+
+    if (groups) {
+        for (int g = 0; g < groups->count; g++) {
+            const FlatNode* group = &tree->nodes[groups->nodes[g]];
+            build_interaction_list(tree, groups->nodes[g], opts->theta, list);
+            for (int s = group->first; s < group->first + group->count; s++) {
+                int p = tree->order[s];
+                soa->x_force[p] = 0.0;
+                soa->y_force[p] = 0.0;
+                evaluate_interaction_list(list, soa->x_pos[p], soa->y_pos[p], soa->mass[p],
+                                          &soa->x_force[p], &soa->y_force[p]);
+                interactions += list->count + list->cell_count;
+            }
+        }
+    } else {
+        for (int s = 0; s < tree->particle_count; s++) {
+            int p = tree->order[s];
+            soa->x_force[p] = 0.0;
+            soa->y_force[p] = 0.0;
+            interactions += compute_force_flat(tree, soa, p, opts->theta);
+        }
+    }
+
+    double error = 0.0;
+    for (int k = 0; k < sample_count; k++) {
+        int p = samples[k];
+        double ex = soa->x_force[p] - ref_x[k];
+        double ey = soa->y_force[p] - ref_y[k];
+        error += ((ex * ex) + (ey * ey)) / ((ref_x[k] * ref_x[k]) + (ref_y[k] * ref_y[k]));
+    }
+
+    AccuracyResult result;
+    result.interactions = (double)interactions / (tree->particle_count > 0 ? tree->particle_count : 1);
+    result.error = sample_count > 0 ? sqrt(error / sample_count) : 0.0;
+    printf("%-12s theta %.3f: %.1f interactions per particle, RMS relative force error %.3e\n",
+           label, opts->theta, result.interactions, result.error);
+    return result;
+}
+
+void report_accuracy(const Options* opts, ThreadPool* pool, const Particle* particles, int particle_count,
+                     AccuracyReport* report) {
+    ParticleSoA* soa = create_particle_soa(particle_count);
+    load_particle_soa(soa, particles);
+
+    TreeBuilder* builder = create_tree_builder(opts->builder, opts->leaf_size, particle_count, NULL);
+    FlatTree* tree = create_flat_tree(2 * particle_count);
+    tree->quadrupoles = 1;
+    build_tree(builder, soa, tree, 0);
+
+    // Spread the samples evenly over the tree, a direct sum is O(N) per sample.
+    // When they cover the whole tree the all-pairs sum gives every reference
+    // at half the cost.
+    int sample_count = opts->accuracy_samples < tree->particle_count ? opts->accuracy_samples : tree->particle_count;
+    int all_pairs = sample_count > 0 && sample_count == tree->particle_count;
+    int* samples = (int*)malloc((sample_count > 0 ? sample_count : 1) * sizeof(int));
+    double* ref_x = (double*)malloc((sample_count > 0 ? sample_count : 1) * sizeof(double));
+    double* ref_y = (double*)malloc((sample_count > 0 ? sample_count : 1) * sizeof(double));
+    if (!samples || !ref_x || !ref_y) {
+        perror("Memory allocation error");
+        exit(EXIT_FAILURE);
+    }
+    if (all_pairs) {
+        DirectSum* direct = create_direct_sum(particle_count);
+        compute_direct_forces(pool, direct, soa, MPI_COMM_SELF);
+        destroy_direct_sum(direct);
+    }
+
+    int kept = 0;
+    for (int k = 0; k < sample_count; k++) {
+        int p = tree->order[(long long)k * tree->particle_count / sample_count];
+        double fx = 0.0;
+        double fy = 0.0;
+        if (all_pairs) {
+            fx = soa->x_force[p];
+            fy = soa->y_force[p];
+        } else {
+            leaf_kernel(tree->x_pos, tree->y_pos, tree->mass, tree->particle_count,
+                        soa->x_pos[p], soa->y_pos[p], soa->mass[p], &fx, &fy);
+        }
+
+        // A particle with no net force has no relative error
+        if (fx == 0.0 && fy == 0.0) continue;
+        samples[kept] = p;
+        ref_x[kept] = fx;
+        ref_y[kept] = fy;
+        kept += 1;
+    }
+
+    GroupSet* groups = NULL;
+    InteractionList* list = create_interaction_list(1024);
+    if (opts->group_size > 0) {
+        groups = create_group_set(particle_count);
+        find_groups(groups, tree, opts->group_size, particle_count);
+    }
+
+    printf("Accuracy against %s over %d %sparticles (%s walk):\n", all_pairs ? "the all-pairs sum" : "a direct sum",
+           kept, all_pairs ? "" : "sampled ", groups ? "grouped" : "per particle");
+    tree->quadrupoles = 0;
+    AccuracyResult monopole = measure_forces("Monopole", opts, tree, groups, list, soa, samples, ref_x, ref_y, kept);
+    tree->quadrupoles = 1;
+    AccuracyResult quadrupole = measure_forces("Quadrupole", opts, tree, groups, list, soa, samples, ref_x, ref_y, kept);
+    if (report) {
+        report->samples = kept;
+        report->all_pairs = all_pairs;
+        report->monopole = monopole;
+        report->quadrupole = quadrupole;
+    }
+
+    // Same walks in single precision, and how far they move every particle's
+    // force from the double precision quadrupole walk
+    if (opts->single_precision && !groups) {
+        double* double_x = create_particle_column(particle_count);
+        double* double_y = create_particle_column(particle_count);
+        memcpy(double_x, soa->x_force, particle_count * sizeof(double));
+        memcpy(double_y, soa->y_force, particle_count * sizeof(double));
+
+        tree->single_precision = 1;
+        compute_single_nodes(tree);
+        tree->quadrupoles = 0;
+        AccuracyResult monopole_single = measure_forces("Monopole F", opts, tree, NULL, list, soa, samples, ref_x, ref_y, kept);
+        tree->quadrupoles = 1;
+        AccuracyResult quadrupole_single = measure_forces("Quadrupole F", opts, tree, NULL, list, soa, samples, ref_x, ref_y, kept);
+
+        double difference = 0.0;
+        int compared = 0;
+        for (int s = 0; s < tree->particle_count; s++) {
+            int p = tree->order[s];
+            double magnitude = (double_x[p] * double_x[p]) + (double_y[p] * double_y[p]);
+            if (magnitude == 0.0) continue;
+            double dx = soa->x_force[p] - double_x[p];
+            double dy = soa->y_force[p] - double_y[p];
+            difference += ((dx * dx) + (dy * dy)) / magnitude;
+            compared += 1;
+        }
+        difference = compared > 0 ? sqrt(difference / compared) : 0.0;
+        printf("Single against double precision walk over %d particles: RMS relative difference %.3e\n",
+               compared, difference);
+        if (report) {
+            report->single_precision = 1;
+            report->monopole_single = monopole_single;
+            report->quadrupole_single = quadrupole_single;
+            report->single_difference = difference;
+        }
+        free(double_x);
+        free(double_y);
+    }
+
+    destroy_group_set(groups);
+    destroy_interaction_list(list);
+    destroy_tree_builder(builder);
+    destroy_flat_tree(tree);
+    destroy_particle_soa(soa);
+    free(samples);
+    free(ref_x);
+    free(ref_y);
+}
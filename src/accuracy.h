@@ -0,0 +1,43 @@
+#ifndef ACCURACY_H
+#define ACCURACY_H
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "builder.h"
+#include "direct.h"
+#include "flat_tree.h"
+#include "group.h"
+#include "io.h"
+#include "kernel.h"
+#include "particle.h"
+
+// Interactions per particle and RMS relative force error of one expansion order
+typedef struct {
+    double interactions;
+    double error;
+} AccuracyResult;
+
+typedef struct {
+    int samples;               // Particles checked against the direct sum
+    int all_pairs;             // Every particle, against the all-pairs sum
+    AccuracyResult monopole;
+    AccuracyResult quadrupole;
+    int single_precision;      // Whether the single precision walk was measured
+    AccuracyResult monopole_single;
+    AccuracyResult quadrupole_single;
+    double single_difference;  // RMS relative difference to the double walk, all particles
+} AccuracyReport;
+
+// Build the tree of the given state with the run's settings and print, for
+// monopoles and for quadrupoles, the interactions per particle and the RMS
+// relative force error of a sample of particles against a direct sum. With -F
+// the single precision walk is measured as well. The numbers are also stored
+// in report unless it is NULL. A sample of every particle (-A all) is checked
+// against the all-pairs sum, run on pool.
+void report_accuracy(const Options* opts, ThreadPool* pool, const Particle* particles, int particle_count,
+                     AccuracyReport* report);
+
+#endif // ACCURACY_H
@@ -0,0 +1,177 @@
+#include "active.h"
+
+ActiveSet* create_active_set(int count) {
+    ActiveSet* set = (ActiveSet*)malloc(sizeof(ActiveSet));
+    int slots = count > 0 ? count : 1;
+    if (set) {
+        set->origin = (int*)malloc(slots * sizeof(int));
+        set->lost_step = (int*)malloc(slots * sizeof(int));
+        set->from = (int*)malloc(slots * sizeof(int));
+    }
+    if (!set || !set->origin || !set->lost_step || !set->from) {
+        perror("Memory allocation error");
+        exit(EXIT_FAILURE);
+    }
+    set->scratch = create_particle_column(count);
+    set->count = count;
+    set->live = count;
+    for (int s = 0; s < count; s++) set->origin[s] = s;
+    return set;
+}
+
+void destroy_active_set(ActiveSet* set) {
+    if (set == NULL) return;
+    free(set->origin);
+    free(set->lost_step);
+    free(set->from);
+    free(set->scratch);
+    free(set);
+}
+
+// Slots [0, n) of each column take the values of slots from[0, n)
+static void gather_doubles(double* column, const int* from, int n, double* scratch) {
+    for (int s = 0; s < n; s++) scratch[s] = column[from[s]];
+    memcpy(column, scratch, n * sizeof(double));
+}
+
+static void gather_ints(int* column, const int* from, int n, int* scratch) {
+    for (int s = 0; s < n; s++) scratch[s] = column[from[s]];
+    memcpy(column, scratch, n * sizeof(int));
+}
+
+static void gather_floats(float* column, const int* from, int n, float* scratch) {
+    for (int s = 0; s < n; s++) scratch[s] = column[from[s]];
+    memcpy(column, scratch, n * sizeof(float));
+}
+
+static void gather_slots(ActiveSet* set, ParticleSoA* soa, int n) {
+    double* columns[] = {soa->x_pos, soa->y_pos, soa->mass, soa->x_vel, soa->y_vel, soa->x_force, soa->y_force};
+    for (int c = 0; c < 7; c++) gather_doubles(columns[c], set->from, n, set->scratch);
+    gather_ints(soa->index, set->from, n, (int*)set->scratch);
+    gather_floats(soa->cost, set->from, n, (float*)set->scratch);
+    gather_ints(set->origin, set->from, n, (int*)set->scratch);
+    gather_ints(set->lost_step, set->from, n, (int*)set->scratch);
+}
+
+int count_lost_slots(const ActiveSet* set, const ParticleSoA* soa) {
+    int lost = 0;
+    for (int s = 0; s < set->live; s++) {
+        if (soa->mass[s] < 0) lost += 1;
+    }
+    return lost;
+}
+
+int count_moved_slots(const ActiveSet* set, int first, int last) {
+    int moved = 0;
+    for (int s = set->live; s < set->count; s++) {
+        if (set->origin[s] >= first && set->origin[s] < last) moved += 1;
+    }
+    return moved;
+}
+
+int compact_active_set(ActiveSet* set, ParticleSoA* soa, int steps_done) {
+    int live = 0;
+    for (int s = 0; s < set->live; s++) {
+        if (soa->mass[s] >= 0) set->from[live++] = s;
+    }
+    int moved = set->live - live;
+    if (moved == 0) return 0;
+
+    int next = live;
+    for (int s = 0; s < set->live; s++) {
+        if (soa->mass[s] < 0) {
+            set->lost_step[s] = steps_done;
+            set->from[next++] = s;
+        }
+    }
+    gather_slots(set, soa, set->live);
+    set->live = live;
+    return moved;
+}
+
+// The update of a lost particle every step: its force is reset, nothing is
+// added, and update_particles moves it by its velocity
+static void drift_lost_slot(ParticleSoA* soa, int s, int steps, double dt) {
+    for (int k = 0; k < steps; k++) {
+        soa->x_force[s] = 0.0;
+        soa->y_force[s] = 0.0;
+        soa->cost[s] = 1.0f;
+        update_particles(soa, s, s + 1, dt, DEFAULT_BOUNDARY_SIZE);
+    }
+}
+
+void restore_active_set(ActiveSet* set, ParticleSoA* soa, int steps_done, double dt) {
+    if (set->live == set->count) return;
+
+    for (int s = set->live; s < set->count; s++) {
+        drift_lost_slot(soa, s, steps_done - set->lost_step[s], dt);
+    }
+    for (int s = 0; s < set->count; s++) set->from[set->origin[s]] = s;
+    gather_slots(set, soa, set->count);
+    set->live = set->count;
+}
+
+LostSet* create_lost_set(void) {
+    LostSet* set = (LostSet*)calloc(1, sizeof(LostSet));
+    if (set == NULL) {
+        perror("Memory allocation error");
+        exit(EXIT_FAILURE);
+    }
+    return set;
+}
+
+void destroy_lost_set(LostSet* set) {
+    if (set == NULL) return;
+    free(set->particles);
+    free(set->lost_step);
+    free(set);
+}
+
+int remove_lost_particles(LostSet* set, Particle* particles, int* count, int steps_done) {
+    int kept = 0;
+    int taken = 0;
+    for (int i = 0; i < *count; i++) {
+        if (particles[i].mass >= 0) {
+            particles[kept++] = particles[i];
+            continue;
+        }
+        if (set->count == set->capacity) {
+            set->capacity = set->capacity > 0 ? 2 * set->capacity : 64;
+            set->particles = (Particle*)realloc(set->particles, set->capacity * sizeof(Particle));
+            set->lost_step = (int*)realloc(set->lost_step, set->capacity * sizeof(int));
+            if (!set->particles || !set->lost_step) {
+                perror("Memory allocation error");
+                exit(EXIT_FAILURE);
+            }
+        }
+        set->particles[set->count] = particles[i];
+        set->lost_step[set->count] = steps_done;
+        set->count += 1;
+        taken += 1;
+    }
+    *count = kept;
+    return taken;
+}
+
+Particle* return_lost_particles(LostSet* set, Particle* particles, int* count, int steps_done, double dt) {
+    if (set->count == 0) return particles;
+
+    particles = (Particle*)realloc(particles, (*count + set->count) * sizeof(Particle));
+    if (particles == NULL) {
+        perror("Memory allocation error");
+        exit(EXIT_FAILURE);
+    }
+    for (int l = 0; l < set->count; l++) {
+        Particle* particle = &set->particles[l];
+        for (int k = set->lost_step[l]; k < steps_done; k++) {
+            particle->x_force = 0.0;
+            particle->y_force = 0.0;
+            particle->cost = 1.0f;
+            update_particle(particle, dt, DEFAULT_BOUNDARY_SIZE);
+        }
+        particles[*count + l] = *particle;
+    }
+    *count += set->count;
+    set->count = 0;
+    return particles;
+}
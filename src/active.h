@@ -0,0 +1,70 @@
+#ifndef ACTIVE_H
+#define ACTIVE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "particle.h"
+#include "tree.h"
+
+// Steps between compactions of the active set
+#define ACTIVE_SET_INTERVAL 8
+
+// A particle that leaves the domain is lost for good: mass -1, no force, and
+// the update only drifts it along its last velocity. Lost particles are moved
+// out of the loops in batches, and their drift over the steps they skipped is
+// replayed before the state is written, so outputs and checkpoints hold the
+// same values as when every particle takes every step.
+
+// Replicated store: slots [0, live) hold the live particles in input order,
+// the lost ones follow
+typedef struct {
+    int count;          // Particles in the store
+    int live;           // Slots taking part in the steps
+    int* origin;        // Input position of the particle in each slot
+    int* lost_step;     // Steps completed when the slot's particle was moved out
+    int* from;          // Scratch, old slot of each new slot
+    double* scratch;    // Scratch column, also used for the int and float columns
+} ActiveSet;
+
+ActiveSet* create_active_set(int count);
+
+// Lost particles among slots [0, live)
+int count_lost_slots(const ActiveSet* set, const ParticleSoA* soa);
+
+// Lost particles moved out of the steps whose input position is in [first, last)
+int count_moved_slots(const ActiveSet* set, int first, int last);
+
+// Move the lost particles among slots [0, live) behind the live ones, keeping
+// the order of both. Returns how many were moved.
+int compact_active_set(ActiveSet* set, ParticleSoA* soa, int steps_done);
+
+// Replay the drift of the moved particles up to steps_done and put every
+// particle back in its input slot. All slots are live again afterwards.
+void restore_active_set(ActiveSet* set, ParticleSoA* soa, int steps_done, double dt);
+
+void destroy_active_set(ActiveSet* set);
+
+// Distributed mode: lost particles taken out of a rank's own particles. They
+// never migrate, so they stay with the rank that lost them.
+typedef struct {
+    Particle* particles;
+    int* lost_step;     // Steps completed when each was taken out
+    int count;
+    int capacity;
+} LostSet;
+
+LostSet* create_lost_set(void);
+
+// Take the lost particles out of particles[0, *count), keeping the order of
+// the others. Returns how many were taken.
+int remove_lost_particles(LostSet* set, Particle* particles, int* count, int steps_done);
+
+// Replay their drift up to steps_done and append them to particles, which is
+// reallocated. The set is empty afterwards.
+Particle* return_lost_particles(LostSet* set, Particle* particles, int* count, int steps_done, double dt);
+
+void destroy_lost_set(LostSet* set);
+
+#endif // ACTIVE_H
@@ -0,0 +1,95 @@
+
+#include "arena.h"
+
+static ArenaBlock* create_arena_block(size_t size) {
+    ArenaBlock* block = (ArenaBlock*)malloc(sizeof(ArenaBlock));
+    if (block == NULL) {
+        perror("Memory allocation error");
+        exit(EXIT_FAILURE);
+    }
+
+    block->data = (unsigned char*)aligned_alloc(ARENA_ALIGNMENT, size);
+    if (block->data == NULL) {
+        perror("Memory allocation error");
+        exit(EXIT_FAILURE);
+    }
+
+    block->next = NULL;
+    block->size = size;
+    block->used = 0;
+    return block;
+}
+
+Arena* create_arena(size_t block_size) {
+    Arena* arena = (Arena*)malloc(sizeof(Arena));
+    if (arena == NULL) {
+        perror("Memory allocation error");
+        exit(EXIT_FAILURE);
+    }
+
+    // Keep every block a multiple of the alignment
+    block_size = (block_size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+
+    arena->block_size = block_size;
+    arena->head = create_arena_block(block_size);
+    arena->current = arena->head;
+    return arena;
+}
+
+// Hand out the next aligned chunk, moving on to (or adding) another block when
+// the current one is full
+void* arena_alloc(Arena* arena, size_t bytes) {
+    bytes = (bytes + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+
+    ArenaBlock* block = arena->current;
+    while (block->used + bytes > block->size) {
+        if (block->next == NULL) {
+            size_t size = bytes > arena->block_size ? bytes : arena->block_size;
+            block->next = create_arena_block(size);
+        }
+        block = block->next;
+        block->used = 0;
+    }
+
+    arena->current = block;
+    void* ptr = block->data + block->used;
+    block->used += bytes;
+    return ptr;
+}
+
+// Release every allocation at once while keeping the blocks for reuse
+void arena_reset(Arena* arena) {
+    arena->current = arena->head;
+    arena->head->used = 0;
+}
+
+// Total bytes reserved from the system by the arena
+size_t arena_capacity(const Arena* arena) {
+    size_t total = 0;
+    for (ArenaBlock* block = arena->head; block != NULL; block = block->next) {
+        total += block->size;
+    }
+    return total;
+}
+
+// Bytes handed out since the last reset
+size_t arena_used(const Arena* arena) {
+    size_t total = 0;
+    for (ArenaBlock* block = arena->head; block != NULL; block = block->next) {
+        total += block->used;
+    }
+    return total;
+}
+
+void destroy_arena(Arena* arena) {
+    if (arena == NULL) return;
+
+    ArenaBlock* block = arena->head;
+    while (block != NULL) {
+        ArenaBlock* next = block->next;
+        free(block->data);
+        free(block);
+        block = next;
+    }
+    free(arena);
+}
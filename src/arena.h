@@ -0,0 +1,39 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Default size of one arena block (1 MiB)
+#define ARENA_BLOCK_SIZE (1 << 20)
+
+// Alignment of every arena allocation
+#define ARENA_ALIGNMENT 16
+
+typedef struct ArenaBlock ArenaBlock;
+
+// One system allocation carved up by the arena
+struct ArenaBlock {
+    ArenaBlock* next; // Next block in the chain
+    size_t size;      // Usable bytes in this block
+    size_t used;      // Bytes handed out since the last reset
+    unsigned char* data;
+};
+
+// Bump allocator: allocations are never freed one by one, the whole arena is
+// reset at once and its blocks are reused by the next round of allocations.
+typedef struct {
+    ArenaBlock* head;    // First block in the chain
+    ArenaBlock* current; // Block allocations are served from
+    size_t block_size;   // Size of newly added blocks
+} Arena;
+
+Arena* create_arena(size_t block_size);
+void* arena_alloc(Arena* arena, size_t bytes);
+void arena_reset(Arena* arena);
+size_t arena_capacity(const Arena* arena);
+size_t arena_used(const Arena* arena);
+void destroy_arena(Arena* arena);
+
+#endif // ARENA_H
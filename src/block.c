@@ -0,0 +1,321 @@
+#include "block.h"
+
+BlockSchedule* create_block_schedule(int count, int max_level, double eta, double time_step, int ranks) {
+    BlockSchedule* schedule = (BlockSchedule*)calloc(1, sizeof(BlockSchedule));
+    if (schedule == NULL) {
+        perror("Memory allocation error");
+        exit(EXIT_FAILURE);
+    }
+
+    schedule->max_level = max_level;
+    schedule->ticks = 1 << max_level;
+    schedule->tick = time_step / schedule->ticks;
+    schedule->eta = eta;
+    schedule->count = count;
+
+    int slots = count > 0 ? count : 1;
+    schedule->level = (int*)malloc(slots * sizeof(int));
+    schedule->start = (int*)malloc(slots * sizeof(int));
+    schedule->level_head = (int*)malloc((max_level + 1) * sizeof(int));
+    schedule->level_next = (int*)malloc(slots * sizeof(int));
+    schedule->active = (int*)malloc(slots * sizeof(int));
+    schedule->counts = (int*)malloc(ranks * sizeof(int));
+    schedule->displs = (int*)malloc(ranks * sizeof(int));
+    if (!schedule->level || !schedule->start || !schedule->level_head || !schedule->level_next || !schedule->active ||
+        !schedule->counts || !schedule->displs) {
+        perror("Memory allocation error");
+        exit(EXIT_FAILURE);
+    }
+    schedule->x_pred = create_particle_column(count);
+    schedule->y_pred = create_particle_column(count);
+    schedule->force_buffer = create_particle_column(2 * count);
+    return schedule;
+}
+
+void destroy_block_schedule(BlockSchedule* schedule) {
+    if (schedule == NULL) return;
+    free(schedule->level);
+    free(schedule->start);
+    free(schedule->level_head);
+    free(schedule->level_next);
+    free(schedule->active);
+    free(schedule->counts);
+    free(schedule->displs);
+    free(schedule->x_pred);
+    free(schedule->y_pred);
+    free(schedule->force_buffer);
+    free(schedule);
+}
+
+// Contiguous share [*first, *last) of count items for one rank
+static void share_range(int count, int size, int rank, int* first, int* last) {
+    int base = count / size;
+    int extra = count % size;
+    *first = rank * base + (rank < extra ? rank : extra);
+    *last = *first + base + (rank < extra ? 1 : 0);
+}
+
+// Finest level the acceleration asks for, then finer still until the new step
+// starts on a multiple of its own length, so steps of every level stay nested
+static int choose_level(const BlockSchedule* schedule, const ParticleSoA* particles, int p, int tick) {
+    int level = 0;
+    double mass = particles->mass[p];
+    if (mass > 0) {
+        double acceleration = sqrt(particles->x_force[p] * particles->x_force[p] +
+                                   particles->y_force[p] * particles->y_force[p]) / mass;
+        if (acceleration > 0) {
+            double wanted = sqrt(2.0 * schedule->eta * RLIMIT / acceleration);
+            double step = schedule->tick * schedule->ticks;
+            while (level < schedule->max_level && step > wanted) {
+                step *= 0.5;
+                level += 1;
+            }
+        }
+    }
+    while (tick % (schedule->ticks >> level) != 0) level += 1;
+    return level;
+}
+
+// Particles of a schedule and the tick being worked on, for the pool
+typedef struct {
+    BlockSchedule* schedule;
+    ParticleSoA* particles;
+    int tick;
+} TickPass;
+
+// Positions at the current tick: the committed state of the active particles,
+// the others drifted from theirs with their last force
+static void predict_range(void* context, int first, int last) {
+    TickPass* pass = (TickPass*)context;
+    BlockSchedule* schedule = pass->schedule;
+    const ParticleSoA* particles = pass->particles;
+    int tick = pass->tick;
+
+    for (int p = first; p < last; p++) {
+        if (schedule->start[p] == tick) {
+            schedule->x_pred[p] = particles->x_pos[p];
+            schedule->y_pred[p] = particles->y_pos[p];
+            continue;
+        }
+        double tau = schedule->tick * (tick - schedule->start[p]);
+        double ax = particles->x_force[p] / particles->mass[p];
+        double ay = particles->y_force[p] / particles->mass[p];
+        schedule->x_pred[p] = particles->x_pos[p] + (particles->x_vel[p] * tau) + (0.5 * ax * (tau * tau));
+        schedule->y_pred[p] = particles->y_pos[p] + (particles->y_vel[p] * tau) + (0.5 * ay * (tau * tau));
+    }
+}
+
+// Complete the steps of the active particles, which end on the current tick
+// and start the next ones there
+static void complete_range(void* context, int first, int last) {
+    TickPass* pass = (TickPass*)context;
+    BlockSchedule* schedule = pass->schedule;
+
+    for (int a = first; a < last; a++) {
+        int p = schedule->active[a];
+        update_particles(pass->particles, p, p + 1, schedule->tick * (pass->tick - schedule->start[p]),
+                         DEFAULT_BOUNDARY_SIZE);
+        schedule->start[p] = pass->tick;
+    }
+}
+
+// Force pass over the active particles only, reading predicted positions
+typedef struct {
+    const FlatTree* tree;
+    ParticleSoA* predicted;
+    const int* active;
+    double theta;
+} ActivePass;
+
+static void active_range(void* context, int first, int last) {
+    ActivePass* pass = (ActivePass*)context;
+    for (int a = first; a < last; a++) {
+        int p = pass->active[a];
+        pass->predicted->x_force[p] = 0.0;
+        pass->predicted->y_force[p] = 0.0;
+        compute_force_flat(pass->tree, pass->predicted, p, pass->theta);
+    }
+}
+
+// Give every rank the forces of all active particles, in active order
+static void allgather_active_forces(BlockSchedule* schedule, ParticleSoA* particles, int size, int rank, MPI_Comm comm) {
+    for (int r = 0; r < size; r++) {
+        int first, last;
+        share_range(schedule->active_count, size, r, &first, &last);
+        schedule->counts[r] = 2 * (last - first);
+        schedule->displs[r] = 2 * first;
+    }
+
+    int first = schedule->displs[rank] / 2;
+    int last = first + schedule->counts[rank] / 2;
+    for (int a = first; a < last; a++) {
+        schedule->force_buffer[2 * a] = particles->x_force[schedule->active[a]];
+        schedule->force_buffer[2 * a + 1] = particles->y_force[schedule->active[a]];
+    }
+    MPI_Allgatherv(MPI_IN_PLACE, 0, MPI_DATATYPE_NULL,
+                   schedule->force_buffer, schedule->counts, schedule->displs, MPI_DOUBLE, comm);
+    for (int a = 0; a < schedule->active_count; a++) {
+        particles->x_force[schedule->active[a]] = schedule->force_buffer[2 * a];
+        particles->y_force[schedule->active[a]] = schedule->force_buffer[2 * a + 1];
+    }
+}
+
+// One step of dt. Every rank keeps the whole schedule and advances every
+// particle itself, only the new forces of the active particles are shared.
+// Returns the number of force evaluations.
+static long long block_step(MPI_Comm comm, const Options* opts, ThreadPool* pool, BlockSchedule* schedule,
+                            TreeBuilder* builder, FlatTree* flat_tree, ParticleSoA* soa, int* deepest) {
+    int rank, size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+
+    ParticleSoA predicted = *soa;
+    predicted.x_pos = schedule->x_pred;
+    predicted.y_pos = schedule->y_pred;
+
+    // Every particle starts the step on tick 0
+    for (int p = 0; p < soa->count; p++) {
+        schedule->start[p] = 0;
+        schedule->active[p] = p;
+    }
+    schedule->active_count = soa->count;
+    for (int l = 0; l <= schedule->max_level; l++) schedule->level_head[l] = -1;
+
+    long long evaluations = 0;
+    int tick = 0;
+    while (tick < schedule->ticks) {
+        // Tree of all particles at this tick
+        double begin = phase_begin();
+        TickPass tick_pass = {schedule, soa, tick};
+        parallel_for(pool, 0, soa->count, THREAD_CHUNK_SIZE, predict_range, &tick_pass);
+        build_tree(builder, &predicted, flat_tree, rank == 0 ? opts->print_debug_flag : 0);
+        STATS_TREE(flat_tree);
+        phase_end(PHASE_BUILD, begin);
+
+        // New forces for this rank's share of the active particles
+        begin = phase_begin();
+        int first, last;
+        share_range(schedule->active_count, size, rank, &first, &last);
+        ActivePass pass = {flat_tree, &predicted, schedule->active, opts->theta};
+        parallel_for(pool, first, last, THREAD_CHUNK_SIZE, active_range, &pass);
+        phase_end(PHASE_FORCE, begin);
+
+        begin = phase_begin();
+        if (size > 1) allgather_active_forces(schedule, soa, size, rank, comm);
+        phase_end(PHASE_EXCHANGE, begin);
+        evaluations += schedule->active_count;
+
+        // Next level of each active particle, which joins that level's list
+        for (int a = 0; a < schedule->active_count; a++) {
+            int p = schedule->active[a];
+            int level = choose_level(schedule, soa, p, tick);
+            schedule->level[p] = level;
+            schedule->level_next[p] = schedule->level_head[level];
+            schedule->level_head[level] = p;
+            if (level > *deepest) *deepest = level;
+        }
+
+        // The steps of a level end on the next multiple of its length
+        int next = schedule->ticks;
+        for (int l = 0; l <= schedule->max_level; l++) {
+            if (schedule->level_head[l] < 0) continue;
+            int length = schedule->ticks >> l;
+            int end = tick - tick % length + length;
+            if (end < next) next = end;
+        }
+
+        // The levels ending at the next tick become active there
+        schedule->active_count = 0;
+        for (int l = 0; l <= schedule->max_level; l++) {
+            if (next % (schedule->ticks >> l) != 0) continue;
+            for (int p = schedule->level_head[l]; p >= 0; p = schedule->level_next[p]) {
+                schedule->active[schedule->active_count++] = p;
+            }
+            schedule->level_head[l] = -1;
+        }
+
+        begin = phase_begin();
+        tick_pass.tick = next;
+        parallel_for(pool, 0, schedule->active_count, THREAD_CHUNK_SIZE, complete_range, &tick_pass);
+        phase_end(PHASE_FORCE, begin);
+        tick = next;
+    }
+    return evaluations;
+}
+
+void run_block_timesteps(MPI_Comm comm, const Options* opts, ThreadPool* pool, ParticleSoA* soa) {
+    int rank, size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+    int particle_count = soa->count;
+
+    // Checkpoints write one block of the replicated state per rank
+    int first, last;
+    share_range(particle_count, size, rank, &first, &last);
+
+    TreeBuilder* builder = create_tree_builder(opts->builder, opts->leaf_size, particle_count, pool);
+    if (opts->refit_threshold > 0) enable_tree_refit(builder, opts->refit_threshold);
+    FlatTree* flat_tree = create_flat_tree(2 * particle_count);
+    flat_tree->quadrupoles = opts->quadrupoles;
+    flat_tree->single_precision = opts->single_precision;
+    BlockSchedule* schedule = create_block_schedule(particle_count, opts->block_levels, opts->block_eta,
+                                                    opts->time_step, size);
+    block_report.max_level = opts->block_levels;
+
+    FrameRing* frames = NULL;
+    if (opts->visualization_flag && rank == 0) {
+        frames = create_rank_frame_ring(rank, opts->visualization_flag, particle_count);
+        printf("Publishing frames to %s\n", frames->name);
+    }
+
+    if (opts->print_debug_flag > 0 && rank == 0) {
+        printf("Running on %d rank(s) x %d thread(s), leaf kernel: %s, %d block timestep level(s)\n",
+               size, pool->thread_count, kernel_isa(), opts->block_levels + 1);
+    }
+
+    CheckpointWriter* checkpoints = NULL;
+    if (opts->checkpoint_steps > 0 || opts->checkpoint_seconds > 0) checkpoints = create_checkpoint_writer(comm, opts);
+
+    // Every particle is synchronized at the end of a step, so frames,
+    // checkpoints and restarts see the same state as with a single dt
+    for (int step = opts->start_step; step < opts->steps; step++) {
+        if (opts->print_debug_flag > 0 && rank == 0) printf("Step %d out of %d\n", step, opts->steps);
+        STATS_BEGIN_STEP(step - opts->start_step);
+
+        int deepest = 0;
+        long long evaluations = block_step(comm, opts, pool, schedule, builder, flat_tree, soa, &deepest);
+
+        // Against every live particle taking the finest step used
+        int live = 0;
+        for (int p = 0; p < particle_count; p++) {
+            if (soa->mass[p] >= 0) live += 1;
+        }
+        block_report.evaluations += evaluations;
+        block_report.uniform_evaluations += (long long)live << deepest;
+        if (deepest > block_report.deepest) block_report.deepest = deepest;
+        if (opts->print_debug_flag > 0 && rank == 0) {
+            printf("%lld force evaluations, finest level %d (%lld at a uniform dt / %d)\n",
+                   evaluations, deepest, (long long)live << deepest, 1 << deepest);
+        }
+
+        if (frames) publish_frame(frames, step + 1, (step + 1) * opts->time_step, soa, flat_tree);
+        if (checkpoints) {
+            double begin = phase_begin();
+            progress_checkpoint(checkpoints);
+            if (checkpoint_due(checkpoints, step + 1)) {
+                start_checkpoint(checkpoints, opts, step + 1, soa, first, last - first, NULL, 0);
+                discard_refit_tree(builder);
+            }
+            phase_end(PHASE_CHECKPOINT, begin);
+        }
+        STATS_END_STEP(soa, first, last, 0);
+    }
+
+    double begin = phase_begin();
+    destroy_checkpoint_writer(checkpoints);
+    phase_end(PHASE_CHECKPOINT, begin);
+    destroy_frame_ring(frames);
+    destroy_block_schedule(schedule);
+    destroy_tree_builder(builder);
+    destroy_flat_tree(flat_tree);
+}
@@ -0,0 +1,57 @@
+#ifndef BLOCK_H
+#define BLOCK_H
+
+#include <math.h>
+#include <mpi.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "builder.h"
+#include "checkpoint.h"
+#include "flat_tree.h"
+#include "frames.h"
+#include "io.h"
+#include "kernel.h"
+#include "particle.h"
+#include "stats.h"
+#include "threads.h"
+#include "timing.h"
+#include "tree.h"
+
+// Block timesteps (-L): particle i advances with dt / 2^level[i], at most
+// max_level levels below dt. A step of dt is cut into 2^max_level ticks and a
+// particle is active on the ticks that start one of its own steps. The other
+// particles are predicted to the tick from their last force, the tree is built
+// from the predicted positions and only the active particles get new forces.
+// Steps of one level all end on the same tick, so the particles are kept in a
+// list per level and a tick takes the whole lists of the levels ending there.
+
+// Level criterion: a particle wants steps of at most sqrt(2 eta RLIMIT / |a|),
+// the time to move a fraction of the softening length under its acceleration
+typedef struct {
+    int max_level;
+    int ticks;              // Ticks per step, 2^max_level
+    double tick;            // Length of one tick, dt / ticks
+    double eta;
+    int count;              // Number of particles
+    int* level;             // Current level of each particle
+    int* start;             // Tick of each particle's committed state and force
+    int* level_head;        // First particle of each level, -1 when there is none
+    int* level_next;        // Next particle of the same level, -1 after the last
+    double* x_pred;         // Positions predicted to the current tick
+    double* y_pred;
+    int* active;            // Particles starting a step on the current tick
+    int active_count;
+    double* force_buffer;   // Forces of the active particles, shared across ranks
+    int* counts;            // Per rank share of the active particles, in doubles
+    int* displs;
+} BlockSchedule;
+
+BlockSchedule* create_block_schedule(int count, int max_level, double eta, double time_step, int ranks);
+void destroy_block_schedule(BlockSchedule* schedule);
+
+// Run the simulation in replicated mode with block timesteps. Every rank
+// passes the full initial state in soa, which holds the final state on return.
+void run_block_timesteps(MPI_Comm comm, const Options* opts, ThreadPool* pool, ParticleSoA* soa);
+
+#endif // BLOCK_H
@@ -0,0 +1,170 @@
+
+#include "builder.h"
+
+TreeBuilder* create_tree_builder(int kind, int leaf_size, int capacity, ThreadPool* pool) {
+    TreeBuilder* builder = (TreeBuilder*)malloc(sizeof(TreeBuilder));
+    if (builder == NULL) {
+        perror("Memory allocation error");
+        exit(EXIT_FAILURE);
+    }
+
+    builder->kind = kind;
+    builder->leaf_size = leaf_size > 0 ? leaf_size : DEFAULT_LEAF_SIZE;
+    builder->arena = NULL;
+    builder->morton = NULL;
+    builder->pool = pool;
+    builder->refit_threshold = 0.0;
+    builder->root = NULL;
+    builder->leaf_of = NULL;
+    builder->moved = NULL;
+    builder->tracked = 0;
+    builder->rebuild_used = 0;
+    if (kind == BUILDER_MORTON) {
+        builder->morton = create_morton_workspace(capacity);
+    } else {
+        builder->arena = create_arena(ARENA_BLOCK_SIZE);
+    }
+    return builder;
+}
+
+// Keep the insertion tree between steps and update it in place while few
+// particles leave their leaf
+void enable_tree_refit(TreeBuilder* builder, double threshold) {
+    builder->refit_threshold = threshold;
+}
+
+// Drop the kept tree so the next build starts from scratch. A run resumed from
+// a checkpoint has no tree to refit, so the original run rebuilds there too.
+void discard_refit_tree(TreeBuilder* builder) {
+    builder->root = NULL;
+}
+
+// Record the leaf holding each particle of a subtree
+static void map_leaves(BHTreeNode* node, BHTreeNode** leaf_of) {
+    if (node == NULL || node->count == 0) return;
+
+    if (!node->is_sub_divided) {
+        for (int b = 0; b < node->count; b++) {
+            leaf_of[node->particles[b]] = node;
+        }
+        return;
+    }
+
+    map_leaves(node->NW, leaf_of);
+    map_leaves(node->NE, leaf_of);
+    map_leaves(node->SW, leaf_of);
+    map_leaves(node->SE, leaf_of);
+}
+
+// Update last step's tree: particles that left their leaf or were lost are
+// taken out, subtrees left small enough collapse, the movers go back in from
+// the root and masses are refit bottom-up. Returns 0 without touching the
+// tree when a full rebuild is due instead.
+static int refit_insert_tree(TreeBuilder* builder, const ParticleSoA* particles, int dbg_print) {
+    if (builder->root == NULL || particles->count != builder->tracked) return 0;
+
+    // Node garbage from collapsed subtrees builds up until the next rebuild
+    if (arena_used(builder->arena) > 2 * builder->rebuild_used) return 0;
+
+    int moved = 0;
+    int limit = (int)(builder->refit_threshold * particles->count);
+    for (int p = 0; p < particles->count; p++) {
+        BHTreeNode* leaf = builder->leaf_of[p];
+        if (leaf == NULL) continue;
+        if (particles->mass[p] < 0 || !contains(leaf, particles->x_pos[p], particles->y_pos[p])) {
+            builder->moved[moved++] = p;
+            if (moved > limit) return 0;
+        }
+    }
+
+    if (dbg_print >= 2) printf("Refit: %d of %d particles moved\n", moved, particles->count);
+
+    for (int m = 0; m < moved; m++) {
+        int p = builder->moved[m];
+        remove_particle(builder->leaf_of[p], p);
+        builder->leaf_of[p] = NULL;
+    }
+    prune_tree(builder->arena, builder->root);
+
+    // Lost particles stay out of the tree for good
+    for (int m = 0; m < moved; m++) {
+        insert_node(builder->arena, builder->root, particles, builder->moved[m]);
+    }
+
+    aggregate_data(builder->root, particles);
+    return 1;
+}
+
+// Insert every particle into a pointer quadtree, then pack it
+static void build_insert_tree(TreeBuilder* builder, const ParticleSoA* particles, FlatTree* tree, int dbg_print) {
+    if (builder->refit_threshold > 0 && refit_insert_tree(builder, particles, dbg_print)) {
+        flatten_tree(builder->root, particles, tree);
+        map_leaves(builder->root, builder->leaf_of);
+        return;
+    }
+
+    // Start over from an empty arena
+    arena_reset(builder->arena);
+
+    double cen = DEFAULT_BOUNDARY_SIZE / 2;
+    Boundary default_bounds = create_bounds(DEFAULT_BOUNDARY_SIZE, cen, cen);
+
+    // Generate the root node
+    BHTreeNode* root_node = create_tree_node(builder->arena, default_bounds, builder->leaf_size);
+
+    if (dbg_print >= 5) print_node_data(root_node);
+
+    // Build the BH Quadtree
+    for (int p = 0; p < particles->count; p++) {
+        int success = insert_node(builder->arena, root_node, particles, p);
+        if (dbg_print >= 5) {
+            printf("Inserting Particle #%d\n", particles->index[p]);
+            if (!success) {
+                printf("Failed to insert particle #%d\n", particles->index[p]);
+            } else {
+                printf("Successfully inserted particle #%d\n\n", particles->index[p]);
+            }
+
+        }
+    }
+
+    // Pack the tree into a contiguous array for the force walk
+    flatten_tree(root_node, particles, tree);
+
+    if (builder->refit_threshold > 0) {
+        // Keep the tree for the next step's refit
+        if (particles->count > builder->tracked) {
+            builder->leaf_of = (BHTreeNode**)realloc(builder->leaf_of, particles->count * sizeof(BHTreeNode*));
+            builder->moved = (int*)realloc(builder->moved, particles->count * sizeof(int));
+            if (!builder->leaf_of || !builder->moved) {
+                perror("Memory allocation error");
+                exit(EXIT_FAILURE);
+            }
+        }
+        memset(builder->leaf_of, 0, particles->count * sizeof(BHTreeNode*));
+        map_leaves(root_node, builder->leaf_of);
+        builder->root = root_node;
+        builder->tracked = particles->count;
+        builder->rebuild_used = arena_used(builder->arena);
+    }
+}
+
+void build_tree(TreeBuilder* builder, const ParticleSoA* particles, FlatTree* tree, int dbg_print) {
+    if (builder->kind == BUILDER_MORTON) {
+        build_morton_tree(builder->morton, builder->pool, particles, builder->leaf_size, tree);
+    } else {
+        build_insert_tree(builder, particles, tree, dbg_print);
+    }
+
+    if (tree->quadrupoles) compute_tree_moments(tree);
+    if (tree->single_precision) compute_single_nodes(tree);
+}
+
+void destroy_tree_builder(TreeBuilder* builder) {
+    if (builder == NULL) return;
+    if (builder->arena) destroy_arena(builder->arena);
+    if (builder->morton) destroy_morton_workspace(builder->morton);
+    free(builder->leaf_of);
+    free(builder->moved);
+    free(builder);
+}
@@ -0,0 +1,35 @@
+#ifndef BUILDER_H
+#define BUILDER_H
+
+#include "arena.h"
+#include "flat_tree.h"
+#include "io.h"
+#include "morton.h"
+#include "particle.h"
+#include "threads.h"
+#include "tree.h"
+
+// Builds the flat tree for a step with the builder picked on the command line
+typedef struct {
+    int kind;                // BUILDER_INSERT or BUILDER_MORTON
+    int leaf_size;           // Maximum particles per leaf bucket
+    Arena* arena;            // Node storage for the insertion builder
+    MortonWorkspace* morton; // Key and sort buffers for the Morton builder
+    ThreadPool* pool;        // Threads the Morton builder shares its work with
+
+    // Incremental updates of the insertion tree, kept alive between steps
+    double refit_threshold;  // Rebuild when more than this fraction moved, 0 always rebuilds
+    BHTreeNode* root;        // Tree of the previous step, NULL before the first build
+    BHTreeNode** leaf_of;    // Leaf holding each particle, NULL if not in the tree
+    int* moved;              // Particles that left their leaf this step
+    int tracked;             // Particle count the tree was built for
+    size_t rebuild_used;     // Arena bytes in use right after the last full build
+} TreeBuilder;
+
+TreeBuilder* create_tree_builder(int kind, int leaf_size, int capacity, ThreadPool* pool);
+void enable_tree_refit(TreeBuilder* builder, double threshold);
+void discard_refit_tree(TreeBuilder* builder);
+void build_tree(TreeBuilder* builder, const ParticleSoA* particles, FlatTree* tree, int dbg_print);
+void destroy_tree_builder(TreeBuilder* builder);
+
+#endif // BUILDER_H
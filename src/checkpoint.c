@@ -0,0 +1,358 @@
+#include "checkpoint.h"
+
+// Byte offset of a column, the columns are laid out as in a snapshot
+static MPI_Offset checkpoint_column_offset(int64_t count, int column) {
+    return snapshot_column_offset(count, column) - SNAPSHOT_HEADER_SIZE + CHECKPOINT_HEADER_SIZE;
+}
+
+// The cost column follows the snapshot columns, the mode's state follows it
+static MPI_Offset checkpoint_cost_offset(int64_t count) {
+    return checkpoint_column_offset(count, SNAPSHOT_COLUMNS);
+}
+
+static MPI_Offset checkpoint_state_offset(int64_t count) {
+    MPI_Offset bytes = (MPI_Offset)count * sizeof(float);
+    return checkpoint_cost_offset(count) + (bytes + SNAPSHOT_ALIGNMENT - 1) / SNAPSHOT_ALIGNMENT * SNAPSHOT_ALIGNMENT;
+}
+
+static void check_header(const CheckpointHeader* header, const char* filename) {
+    if (memcmp(header->magic, CHECKPOINT_MAGIC, sizeof(header->magic)) != 0) {
+        fprintf(stderr, "%s is not an n-body checkpoint\n", filename);
+        exit(EXIT_FAILURE);
+    }
+    if (header->version != CHECKPOINT_VERSION || header->header_size != CHECKPOINT_HEADER_SIZE) {
+        fprintf(stderr, "%s: unsupported checkpoint version %u\n", filename, header->version);
+        exit(EXIT_FAILURE);
+    }
+    if (header->count < 0 || header->count > INT32_MAX || header->step < 0 || header->step > header->steps ||
+        header->state_bytes < 0) {
+        fprintf(stderr, "%s: invalid checkpoint header\n", filename);
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Take the run parameters from the checkpoint so the resumed steps match the
+// original run. A step count given on the command line extends the run.
+void load_checkpoint_options(const char* filename, Options* opts, int ranks) {
+    FILE* file = fopen(filename, "rb");
+    if (!file) {
+        perror("Error opening checkpoint");
+        exit(EXIT_FAILURE);
+    }
+
+    CheckpointHeader header;
+    if (fread(&header, sizeof(header), 1, file) != 1) {
+        fprintf(stderr, "%s: checkpoint is truncated\n", filename);
+        exit(EXIT_FAILURE);
+    }
+    fclose(file);
+    check_header(&header, filename);
+
+    opts->start_step = header.step;
+    if (!opts->steps) opts->steps = header.steps;
+    opts->theta = header.theta;
+    opts->time_step = header.time_step;
+    opts->refit_threshold = header.refit_threshold;
+    opts->mode = header.mode;
+    opts->builder = header.builder;
+    opts->leaf_size = header.leaf_size;
+    opts->group_size = header.group_size;
+    opts->quadrupoles = header.quadrupoles;
+    opts->balance_threshold = header.balance_threshold;
+    opts->block_levels = header.block_levels;
+    opts->single_precision = header.single_precision;
+    opts->direct_below = header.direct_below;
+    if (header.block_levels > 0) opts->block_eta = header.block_eta;
+
+    // Regions and their particle order follow the rank count
+    if (opts->mode == MODE_DISTRIBUTED && header.ranks != ranks) {
+        fprintf(stderr, "Warning: checkpoint written by %d ranks, resuming on %d will not match the original run exactly\n",
+                header.ranks, ranks);
+    }
+
+    // The node-shared tree is picked on the command line, the resumed run has to allow it
+    if (opts->node_ranks > 0 && (opts->mode != MODE_REPLICATED || opts->group_size > 0 ||
+                                 opts->balance_threshold > 0 || opts->block_levels > 0 ||
+                                 opts->direct_below > 0)) {
+        fprintf(stderr, "%s: the checkpointed run cannot use a node-shared tree (-N)\n", filename);
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Read the particles of a checkpoint straight into the columns of a particle
+// store. With whole set every rank reads all particles, otherwise each rank
+// reads an equal block.
+ParticleSoA* read_checkpoint(MPI_Comm comm, const char* filename, int whole, int* num_bodies) {
+    int rank, size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+
+    MPI_File file;
+    if (MPI_File_open(comm, filename, MPI_MODE_RDONLY, MPI_INFO_NULL, &file) != MPI_SUCCESS) {
+        if (rank == 0) fprintf(stderr, "Error opening checkpoint %s\n", filename);
+        MPI_Abort(comm, EXIT_FAILURE);
+    }
+
+    CheckpointHeader header;
+    MPI_File_read_at_all(file, 0, &header, sizeof(header), MPI_BYTE, MPI_STATUS_IGNORE);
+    check_header(&header, filename);
+    int count = (int)header.count;
+
+    MPI_Offset file_size;
+    MPI_File_get_size(file, &file_size);
+    if (file_size < checkpoint_state_offset(count) + header.state_bytes) {
+        if (rank == 0) fprintf(stderr, "%s: checkpoint is truncated\n", filename);
+        MPI_Abort(comm, EXIT_FAILURE);
+    }
+
+    int first = whole ? 0 : (int)((long long)count * rank / size);
+    int last = whole ? count : (int)((long long)count * (rank + 1) / size);
+    int block = last - first;
+
+    ParticleSoA* soa = create_particle_soa(block);
+    MPI_File_read_at_all(file, checkpoint_column_offset(count, 0) + (MPI_Offset)first * sizeof(int32_t),
+                         soa->index, block, MPI_INT, MPI_STATUS_IGNORE);
+    double* columns[] = {soa->x_pos, soa->y_pos, soa->mass, soa->x_vel, soa->y_vel};
+    for (int c = 1; c < SNAPSHOT_COLUMNS; c++) {
+        MPI_File_read_at_all(file, checkpoint_column_offset(count, c) + (MPI_Offset)first * sizeof(double),
+                             columns[c - 1], block, MPI_DOUBLE, MPI_STATUS_IGNORE);
+    }
+    MPI_File_read_at_all(file, checkpoint_cost_offset(count) + (MPI_Offset)first * sizeof(float),
+                         soa->cost, block, MPI_FLOAT, MPI_STATUS_IGNORE);
+    memset(soa->x_force, 0, block * sizeof(double));
+    memset(soa->y_force, 0, block * sizeof(double));
+    MPI_File_close(&file);
+
+    *num_bodies = count;
+    return soa;
+}
+
+void* read_checkpoint_state(MPI_Comm comm, const char* filename, size_t* bytes) {
+    int rank;
+    MPI_Comm_rank(comm, &rank);
+
+    MPI_File file;
+    if (MPI_File_open(comm, filename, MPI_MODE_RDONLY, MPI_INFO_NULL, &file) != MPI_SUCCESS) {
+        if (rank == 0) fprintf(stderr, "Error opening checkpoint %s\n", filename);
+        MPI_Abort(comm, EXIT_FAILURE);
+    }
+
+    CheckpointHeader header;
+    MPI_File_read_at_all(file, 0, &header, sizeof(header), MPI_BYTE, MPI_STATUS_IGNORE);
+    check_header(&header, filename);
+
+    *bytes = (size_t)header.state_bytes;
+    void* state = NULL;
+    if (*bytes > 0) {
+        state = malloc(*bytes);
+        if (!state) {
+            perror("Memory allocation error");
+            MPI_Abort(comm, EXIT_FAILURE);
+        }
+        MPI_File_read_at_all(file, checkpoint_state_offset(header.count), state, (int)*bytes, MPI_BYTE,
+                             MPI_STATUS_IGNORE);
+    }
+    MPI_File_close(&file);
+    return state;
+}
+
+static char* join_path(const char* base, const char* suffix) {
+    char* path = (char*)malloc(strlen(base) + strlen(suffix) + 1);
+    if (!path) {
+        perror("Memory allocation error");
+        exit(EXIT_FAILURE);
+    }
+    strcpy(path, base);
+    strcat(path, suffix);
+    return path;
+}
+
+CheckpointWriter* create_checkpoint_writer(MPI_Comm comm, const Options* opts) {
+    CheckpointWriter* writer = (CheckpointWriter*)calloc(1, sizeof(CheckpointWriter));
+    if (!writer) {
+        perror("Memory allocation error");
+        exit(EXIT_FAILURE);
+    }
+
+    writer->comm = comm;
+    writer->path = join_path(opts->out_file, CHECKPOINT_SUFFIX);
+    writer->partial_path = join_path(writer->path, CHECKPOINT_PARTIAL);
+    writer->every_steps = opts->checkpoint_steps;
+    writer->every_seconds = opts->checkpoint_seconds;
+    writer->last_time = MPI_Wtime();
+    return writer;
+}
+
+// Is a checkpoint due after this many completed steps. The wall clock is only
+// read on rank 0 so every rank takes the same decision.
+int checkpoint_due(CheckpointWriter* writer, int step) {
+    int due = writer->every_steps > 0 && step % writer->every_steps == 0;
+    if (writer->every_seconds > 0) {
+        int rank;
+        MPI_Comm_rank(writer->comm, &rank);
+        int late = rank == 0 && MPI_Wtime() - writer->last_time >= writer->every_seconds;
+        MPI_Bcast(&late, 1, MPI_INT, 0, writer->comm);
+        due = due || late;
+    }
+    return due;
+}
+
+static void reserve_staging(CheckpointWriter* writer, int count) {
+    if (count <= writer->capacity && writer->index) return;
+
+    writer->capacity = count > writer->capacity ? count : writer->capacity;
+    free(writer->index);
+    writer->index = (int32_t*)malloc((writer->capacity > 0 ? writer->capacity : 1) * sizeof(int32_t));
+    if (!writer->index) {
+        perror("Memory allocation error");
+        exit(EXIT_FAILURE);
+    }
+    for (int c = 0; c < SNAPSHOT_COLUMNS - 1; c++) {
+        free(writer->columns[c]);
+        writer->columns[c] = create_particle_column(writer->capacity);
+    }
+    free(writer->cost);
+    writer->cost = (float*)malloc((writer->capacity > 0 ? writer->capacity : 1) * sizeof(float));
+    if (!writer->cost) {
+        perror("Memory allocation error");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void reserve_state(CheckpointWriter* writer, size_t bytes) {
+    if (bytes <= writer->state_capacity) return;
+
+    writer->state_capacity = bytes;
+    free(writer->state);
+    writer->state = (unsigned char*)malloc(bytes);
+    if (!writer->state) {
+        perror("Memory allocation error");
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Copy rows [first, first + count) of the store and start writing them behind
+// the rows of the lower ranks, with the mode's state from rank 0. Only the
+// copy happens here, the writes proceed while the following steps run.
+void start_checkpoint(CheckpointWriter* writer, const Options* opts, int step, const ParticleSoA* soa, int first, int count,
+                      const void* state, size_t state_bytes) {
+    int rank, size;
+    MPI_Comm_rank(writer->comm, &rank);
+    MPI_Comm_size(writer->comm, &size);
+
+    // The staging columns are reused, so the previous checkpoint has to be out
+    finish_checkpoint(writer);
+
+    long long rows = count;
+    long long offset = 0;
+    long long total = 0;
+    MPI_Exscan(&rows, &offset, 1, MPI_LONG_LONG, MPI_SUM, writer->comm);
+    MPI_Allreduce(&rows, &total, 1, MPI_LONG_LONG, MPI_SUM, writer->comm);
+    if (rank == 0) offset = 0;
+
+    reserve_staging(writer, count);
+    memcpy(writer->index, soa->index + first, count * sizeof(int32_t));
+    const double* columns[] = {soa->x_pos, soa->y_pos, soa->mass, soa->x_vel, soa->y_vel};
+    for (int c = 0; c < SNAPSHOT_COLUMNS - 1; c++) {
+        memcpy(writer->columns[c], columns[c] + first, count * sizeof(double));
+    }
+    memcpy(writer->cost, soa->cost + first, count * sizeof(float));
+    if (rank == 0 && state_bytes > 0) {
+        reserve_state(writer, state_bytes);
+        memcpy(writer->state, state, state_bytes);
+    }
+
+    CheckpointHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic));
+    header.version = CHECKPOINT_VERSION;
+    header.header_size = CHECKPOINT_HEADER_SIZE;
+    header.count = total;
+    header.step = step;
+    header.steps = opts->steps;
+    header.theta = opts->theta;
+    header.time_step = opts->time_step;
+    header.refit_threshold = opts->refit_threshold;
+    header.mode = opts->mode;
+    header.builder = opts->builder;
+    header.leaf_size = opts->leaf_size;
+    header.group_size = opts->group_size;
+    header.quadrupoles = opts->quadrupoles;
+    header.ranks = size;
+    header.balance_threshold = opts->balance_threshold;
+    header.block_levels = opts->block_levels;
+    header.block_eta = opts->block_eta;
+    header.single_precision = opts->single_precision;
+    header.direct_below = opts->direct_below;
+    header.state_bytes = (int64_t)state_bytes;
+    memset(writer->header, 0, sizeof(writer->header));
+    memcpy(writer->header, &header, sizeof(header));
+
+    if (MPI_File_open(writer->comm, writer->partial_path, MPI_MODE_CREATE | MPI_MODE_WRONLY,
+                      MPI_INFO_NULL, &writer->file) != MPI_SUCCESS) {
+        if (rank == 0) fprintf(stderr, "Error opening checkpoint %s\n", writer->partial_path);
+        MPI_Abort(writer->comm, EXIT_FAILURE);
+    }
+    MPI_File_set_size(writer->file, checkpoint_state_offset(total) + (MPI_Offset)state_bytes);
+
+    writer->request_count = 0;
+    MPI_File_iwrite_at_all(writer->file, checkpoint_column_offset(total, 0) + offset * sizeof(int32_t),
+                           writer->index, count, MPI_INT32_T, &writer->requests[writer->request_count++]);
+    for (int c = 1; c < SNAPSHOT_COLUMNS; c++) {
+        MPI_File_iwrite_at_all(writer->file, checkpoint_column_offset(total, c) + offset * sizeof(double),
+                               writer->columns[c - 1], count, MPI_DOUBLE, &writer->requests[writer->request_count++]);
+    }
+    MPI_File_iwrite_at_all(writer->file, checkpoint_cost_offset(total) + offset * sizeof(float),
+                           writer->cost, count, MPI_FLOAT, &writer->requests[writer->request_count++]);
+    if (rank == 0) {
+        MPI_File_iwrite_at(writer->file, 0, writer->header, CHECKPOINT_HEADER_SIZE, MPI_BYTE,
+                           &writer->requests[writer->request_count++]);
+        if (state_bytes > 0) {
+            MPI_File_iwrite_at(writer->file, checkpoint_state_offset(total), writer->state, (int)state_bytes,
+                               MPI_BYTE, &writer->requests[writer->request_count++]);
+        }
+    }
+
+    writer->active = 1;
+    writer->last_time = MPI_Wtime();
+}
+
+// Drive the writes in flight and publish the checkpoint once every rank is
+// done, without waiting for ranks that are not
+void progress_checkpoint(CheckpointWriter* writer) {
+    if (!writer->active) return;
+
+    int done;
+    MPI_Testall(writer->request_count, writer->requests, &done, MPI_STATUSES_IGNORE);
+    MPI_Allreduce(MPI_IN_PLACE, &done, 1, MPI_INT, MPI_MIN, writer->comm);
+    if (done) finish_checkpoint(writer);
+}
+
+// Wait for the writes in flight, then move the complete file into place
+void finish_checkpoint(CheckpointWriter* writer) {
+    if (!writer->active) return;
+
+    int rank;
+    MPI_Comm_rank(writer->comm, &rank);
+    MPI_Waitall(writer->request_count, writer->requests, MPI_STATUSES_IGNORE);
+    MPI_File_close(&writer->file);
+    if (rank == 0 && rename(writer->partial_path, writer->path) != 0) {
+        perror("Error renaming checkpoint");
+        MPI_Abort(writer->comm, EXIT_FAILURE);
+    }
+    writer->active = 0;
+}
+
+void destroy_checkpoint_writer(CheckpointWriter* writer) {
+    if (!writer) return;
+    finish_checkpoint(writer);
+    free(writer->path);
+    free(writer->partial_path);
+    free(writer->index);
+    for (int c = 0; c < SNAPSHOT_COLUMNS - 1; c++) {
+        free(writer->columns[c]);
+    }
+    free(writer->cost);
+    free(writer->state);
+    free(writer);
+}
@@ -0,0 +1,94 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <mpi.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "io.h"
+#include "particle.h"
+#include "snapshot.h"
+
+// Checkpoints use the snapshot columns behind a larger header that also holds
+// the completed step and the run parameters, followed by the measured cost of
+// every particle (float) and the state the mode keeps between steps, so a
+// restart can resume the run exactly where it stopped.
+#define CHECKPOINT_MAGIC "NBODYCKP"
+#define CHECKPOINT_VERSION 2
+#define CHECKPOINT_HEADER_SIZE 128
+
+// Checkpoints go to the output file name plus this suffix. They are written
+// under CHECKPOINT_PARTIAL first and renamed once complete, so a run killed
+// mid-write keeps its previous checkpoint.
+#define CHECKPOINT_SUFFIX ".ckpt"
+#define CHECKPOINT_PARTIAL ".part"
+
+typedef struct {
+    char magic[8];           // CHECKPOINT_MAGIC, not NUL terminated
+    uint32_t version;        // CHECKPOINT_VERSION
+    uint32_t header_size;    // Offset of the first column
+    int64_t count;           // Number of particles
+    int64_t step;            // Steps completed
+    int64_t steps;           // Steps of the whole run
+    double theta;
+    double time_step;
+    double refit_threshold;
+    int32_t mode;
+    int32_t builder;
+    int32_t leaf_size;
+    int32_t group_size;
+    int32_t quadrupoles;
+    int32_t ranks;           // Ranks of the run, distributed runs resume exactly on the same count
+    double balance_threshold;
+    int32_t block_levels;
+    int32_t single_precision;
+    double block_eta;
+    int32_t direct_below;
+    int64_t state_bytes;     // Size of the mode's state behind the cost column
+} CheckpointHeader;
+
+// Columns being written in the background. The state is copied into the
+// staging columns when a checkpoint starts, so the step loop can keep going
+// while nonblocking collective MPI-IO writes it out.
+typedef struct {
+    MPI_Comm comm;
+    char* path;              // Final checkpoint file
+    char* partial_path;      // File being written
+    int every_steps;         // Checkpoint interval in steps, 0 for none
+    double every_seconds;    // Checkpoint interval in wall clock seconds, 0 for none
+    double last_time;        // Wall clock time of the last checkpoint
+
+    int capacity;
+    int32_t* index;
+    double* columns[SNAPSHOT_COLUMNS - 1];
+    float* cost;
+    unsigned char header[CHECKPOINT_HEADER_SIZE];
+    unsigned char* state;    // Copy of the mode's state, written by rank 0
+    size_t state_capacity;
+
+    int active;              // A checkpoint is in flight
+    MPI_File file;
+    MPI_Request requests[SNAPSHOT_COLUMNS + 3];
+    int request_count;
+} CheckpointWriter;
+
+void load_checkpoint_options(const char* filename, Options* opts, int ranks);
+ParticleSoA* read_checkpoint(MPI_Comm comm, const char* filename, int whole, int* num_bodies);
+
+// Collective: the mode's state of a checkpoint on every rank, NULL when it has
+// none. The caller frees it.
+void* read_checkpoint_state(MPI_Comm comm, const char* filename, size_t* bytes);
+
+CheckpointWriter* create_checkpoint_writer(MPI_Comm comm, const Options* opts);
+int checkpoint_due(CheckpointWriter* writer, int step);
+
+// state holds state_bytes of the mode's state, the same on every rank, or is NULL
+void start_checkpoint(CheckpointWriter* writer, const Options* opts, int step, const ParticleSoA* soa, int first, int count,
+                      const void* state, size_t state_bytes);
+void progress_checkpoint(CheckpointWriter* writer);
+void finish_checkpoint(CheckpointWriter* writer);
+void destroy_checkpoint_writer(CheckpointWriter* writer);
+
+#endif // CHECKPOINT_H
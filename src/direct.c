@@ -0,0 +1,308 @@
+#include "direct.h"
+#include "stats.h"
+
+#if defined(__AVX512F__) || defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+DirectSum* create_direct_sum(int capacity) {
+    DirectSum* direct = (DirectSum*)calloc(1, sizeof(DirectSum));
+    int slots = capacity > 0 ? capacity : 1;
+    int tasks = DIRECT_MAX_BLOCKS * (DIRECT_MAX_BLOCKS + 1) / 2;
+    if (direct) {
+        direct->mass = (double*)malloc(slots * sizeof(double));
+        direct->x_partial = (double*)malloc((size_t)DIRECT_MAX_BLOCKS * slots * sizeof(double));
+        direct->y_partial = (double*)malloc((size_t)DIRECT_MAX_BLOCKS * slots * sizeof(double));
+        direct->task_first = (int*)malloc(tasks * sizeof(int));
+        direct->task_second = (int*)malloc(tasks * sizeof(int));
+    }
+    if (!direct || !direct->mass || !direct->x_partial || !direct->y_partial ||
+        !direct->task_first || !direct->task_second) {
+        perror("Memory allocation error");
+        exit(EXIT_FAILURE);
+    }
+    direct->capacity = capacity;
+    return direct;
+}
+
+void destroy_direct_sum(DirectSum* direct) {
+    if (direct == NULL) return;
+    free(direct->mass);
+    free(direct->x_partial);
+    free(direct->y_partial);
+    free(direct->task_first);
+    free(direct->task_second);
+    free(direct);
+}
+
+// Pairs of target i with sources [first, count): the force on the target is
+// added to *x_force and *y_force, the reaction on each source is subtracted
+// from x_reaction[j] and y_reaction[j]. gm is G times the target's mass.
+static inline void pair_row(double target_x, double target_y, double gm,
+                            const double* x_pos, const double* y_pos, const double* mass, int first, int count,
+                            double* x_force, double* y_force, double* x_reaction, double* y_reaction) {
+    double fx = 0.0;
+    double fy = 0.0;
+    int j = first;
+
+#if defined(__AVX512F__)
+    if (count - j >= 8) {
+        const __m512d tx = _mm512_set1_pd(target_x);
+        const __m512d ty = _mm512_set1_pd(target_y);
+        const __m512d vgm = _mm512_set1_pd(gm);
+        const __m512d rlimit = _mm512_set1_pd(RLIMIT);
+        __m512d ax = _mm512_setzero_pd();
+        __m512d ay = _mm512_setzero_pd();
+
+        for (; j + 8 <= count; j += 8) {
+            __m512d dx = _mm512_sub_pd(_mm512_loadu_pd(x_pos + j), tx);
+            __m512d dy = _mm512_sub_pd(_mm512_loadu_pd(y_pos + j), ty);
+            __m512d distance = _mm512_sqrt_pd(_mm512_add_pd(_mm512_mul_pd(dx, dx), _mm512_mul_pd(dy, dy)));
+            distance = _mm512_max_pd(distance, rlimit);
+            __m512d cube = _mm512_mul_pd(_mm512_mul_pd(distance, distance), distance);
+
+            __m512d scale = _mm512_div_pd(_mm512_mul_pd(vgm, _mm512_loadu_pd(mass + j)), cube);
+            __m512d sx = _mm512_mul_pd(scale, dx);
+            __m512d sy = _mm512_mul_pd(scale, dy);
+            ax = _mm512_add_pd(ax, sx);
+            ay = _mm512_add_pd(ay, sy);
+            _mm512_storeu_pd(x_reaction + j, _mm512_sub_pd(_mm512_loadu_pd(x_reaction + j), sx));
+            _mm512_storeu_pd(y_reaction + j, _mm512_sub_pd(_mm512_loadu_pd(y_reaction + j), sy));
+        }
+
+        fx += _mm512_reduce_add_pd(ax);
+        fy += _mm512_reduce_add_pd(ay);
+    }
+#elif defined(__AVX2__)
+    if (count - j >= 4) {
+        const __m256d tx = _mm256_set1_pd(target_x);
+        const __m256d ty = _mm256_set1_pd(target_y);
+        const __m256d vgm = _mm256_set1_pd(gm);
+        const __m256d rlimit = _mm256_set1_pd(RLIMIT);
+        __m256d ax = _mm256_setzero_pd();
+        __m256d ay = _mm256_setzero_pd();
+
+        for (; j + 4 <= count; j += 4) {
+            __m256d dx = _mm256_sub_pd(_mm256_loadu_pd(x_pos + j), tx);
+            __m256d dy = _mm256_sub_pd(_mm256_loadu_pd(y_pos + j), ty);
+            __m256d distance = _mm256_sqrt_pd(_mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy)));
+            distance = _mm256_max_pd(distance, rlimit);
+            __m256d cube = _mm256_mul_pd(_mm256_mul_pd(distance, distance), distance);
+
+            __m256d scale = _mm256_div_pd(_mm256_mul_pd(vgm, _mm256_loadu_pd(mass + j)), cube);
+            __m256d sx = _mm256_mul_pd(scale, dx);
+            __m256d sy = _mm256_mul_pd(scale, dy);
+            ax = _mm256_add_pd(ax, sx);
+            ay = _mm256_add_pd(ay, sy);
+            _mm256_storeu_pd(x_reaction + j, _mm256_sub_pd(_mm256_loadu_pd(x_reaction + j), sx));
+            _mm256_storeu_pd(y_reaction + j, _mm256_sub_pd(_mm256_loadu_pd(y_reaction + j), sy));
+        }
+
+        double lanes_x[4];
+        double lanes_y[4];
+        _mm256_storeu_pd(lanes_x, ax);
+        _mm256_storeu_pd(lanes_y, ay);
+        fx += (lanes_x[0] + lanes_x[1]) + (lanes_x[2] + lanes_x[3]);
+        fy += (lanes_y[0] + lanes_y[1]) + (lanes_y[2] + lanes_y[3]);
+    }
+#elif defined(__SSE2__)
+    // Baseline x86-64 builds, where the leaf kernel stays scalar
+    if (count - j >= 2) {
+        const __m128d tx = _mm_set1_pd(target_x);
+        const __m128d ty = _mm_set1_pd(target_y);
+        const __m128d vgm = _mm_set1_pd(gm);
+        const __m128d rlimit = _mm_set1_pd(RLIMIT);
+        __m128d ax = _mm_setzero_pd();
+        __m128d ay = _mm_setzero_pd();
+
+        for (; j + 2 <= count; j += 2) {
+            __m128d dx = _mm_sub_pd(_mm_loadu_pd(x_pos + j), tx);
+            __m128d dy = _mm_sub_pd(_mm_loadu_pd(y_pos + j), ty);
+            __m128d distance = _mm_sqrt_pd(_mm_add_pd(_mm_mul_pd(dx, dx), _mm_mul_pd(dy, dy)));
+            distance = _mm_max_pd(distance, rlimit);
+            __m128d cube = _mm_mul_pd(_mm_mul_pd(distance, distance), distance);
+
+            __m128d scale = _mm_div_pd(_mm_mul_pd(vgm, _mm_loadu_pd(mass + j)), cube);
+            __m128d sx = _mm_mul_pd(scale, dx);
+            __m128d sy = _mm_mul_pd(scale, dy);
+            ax = _mm_add_pd(ax, sx);
+            ay = _mm_add_pd(ay, sy);
+            _mm_storeu_pd(x_reaction + j, _mm_sub_pd(_mm_loadu_pd(x_reaction + j), sx));
+            _mm_storeu_pd(y_reaction + j, _mm_sub_pd(_mm_loadu_pd(y_reaction + j), sy));
+        }
+
+        double lanes_x[2];
+        double lanes_y[2];
+        _mm_storeu_pd(lanes_x, ax);
+        _mm_storeu_pd(lanes_y, ay);
+        fx += lanes_x[0] + lanes_x[1];
+        fy += lanes_y[0] + lanes_y[1];
+    }
+#endif
+
+    // Scalar path for short runs and the tail, same expression as leaf_kernel
+    for (; j < count; j++) {
+        double dx = x_pos[j] - target_x;
+        double dy = y_pos[j] - target_y;
+
+        double distance = sqrt((dx * dx) + (dy * dy));
+        distance = distance < RLIMIT ? RLIMIT : distance;
+
+        double scale = (gm * mass[j]) / (distance * distance * distance);
+        fx += scale * dx;
+        fy += scale * dy;
+        x_reaction[j] -= scale * dx;
+        y_reaction[j] -= scale * dy;
+    }
+
+    *x_force += fx;
+    *y_force += fy;
+}
+
+// Every pair between tile a and tile b, a < b, or within tile a when they are
+// the same. The forces on tile a go to its rows of a_partial, those on tile b
+// to its rows of b_partial.
+static void tile_pairs(const DirectSum* direct, int a, int b, double* ax_partial, double* ay_partial,
+                       double* bx_partial, double* by_partial) {
+    const ParticleSoA* particles = direct->particles;
+    int a_first = a * DIRECT_TILE;
+    int a_last = a_first + DIRECT_TILE < direct->count ? a_first + DIRECT_TILE : direct->count;
+    int b_first = b * DIRECT_TILE;
+    int b_last = b_first + DIRECT_TILE < direct->count ? b_first + DIRECT_TILE : direct->count;
+
+    for (int i = a_first; i < a_last; i++) {
+        int first = a == b ? i + 1 : b_first;
+        pair_row(particles->x_pos[i], particles->y_pos[i], G * direct->mass[i],
+                 particles->x_pos, particles->y_pos, direct->mass, first, b_last,
+                 &ax_partial[i], &ay_partial[i], bx_partial, by_partial);
+    }
+    STATS_INTERACTIONS(thread_pool_index(), 0, a == b ? (long long)(a_last - a_first) * (a_last - a_first - 1)
+                                                      : 2LL * (a_last - a_first) * (b_last - b_first));
+}
+
+// Particles [*first, *last) of a block
+static void block_range(const DirectSum* direct, int block, int* first, int* last) {
+    *first = block * direct->block_tiles * DIRECT_TILE;
+    *last = *first + direct->block_tiles * DIRECT_TILE;
+    if (*first > direct->count) *first = direct->count;
+    if (*last > direct->count) *last = direct->count;
+}
+
+// Each task is a pair of blocks I <= J. It owns the rows of block I in the
+// partial column of block J and the rows of block J in the column of block I,
+// so no two tasks write the same value.
+static void pair_blocks(void* context, int first, int last) {
+    DirectSum* direct = (DirectSum*)context;
+
+    for (int t = first; t < last; t++) {
+        int I = direct->task_first[t];
+        int J = direct->task_second[t];
+        double* ix_partial = direct->x_partial + (size_t)J * direct->capacity;
+        double* iy_partial = direct->y_partial + (size_t)J * direct->capacity;
+        double* jx_partial = direct->x_partial + (size_t)I * direct->capacity;
+        double* jy_partial = direct->y_partial + (size_t)I * direct->capacity;
+
+        int i_first, i_last, j_first, j_last;
+        block_range(direct, I, &i_first, &i_last);
+        block_range(direct, J, &j_first, &j_last);
+        memset(ix_partial + i_first, 0, (i_last - i_first) * sizeof(double));
+        memset(iy_partial + i_first, 0, (i_last - i_first) * sizeof(double));
+        if (I != J) {
+            memset(jx_partial + j_first, 0, (j_last - j_first) * sizeof(double));
+            memset(jy_partial + j_first, 0, (j_last - j_first) * sizeof(double));
+        }
+
+        int i_tiles = (i_last - i_first + DIRECT_TILE - 1) / DIRECT_TILE;
+        int j_tiles = (j_last - j_first + DIRECT_TILE - 1) / DIRECT_TILE;
+        int a_base = i_first / DIRECT_TILE;
+        int b_base = j_first / DIRECT_TILE;
+        for (int a = a_base; a < a_base + i_tiles; a++) {
+            for (int b = I == J ? a : b_base; b < b_base + j_tiles; b++) {
+                tile_pairs(direct, a, b, ix_partial, iy_partial, jx_partial, jy_partial);
+            }
+        }
+    }
+}
+
+// Sum the partial columns of particles [first, last) in block order
+static void sum_partials(void* context, int first, int last) {
+    DirectSum* direct = (DirectSum*)context;
+    ParticleSoA* particles = direct->particles;
+
+    for (int p = first; p < last; p++) {
+        double fx = 0.0;
+        double fy = 0.0;
+        for (int b = 0; b < direct->block_count; b++) {
+            fx += direct->x_partial[(size_t)b * direct->capacity + p];
+            fy += direct->y_partial[(size_t)b * direct->capacity + p];
+        }
+        if (particles->mass[p] < 0) {
+            fx = 0.0;
+            fy = 0.0;
+        }
+        particles->x_force[p] = fx;
+        particles->y_force[p] = fy;
+    }
+}
+
+void compute_direct_forces(ThreadPool* pool, DirectSum* direct, ParticleSoA* particles, MPI_Comm comm) {
+    int rank, size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+
+    int count = particles->count;
+    if (count > direct->capacity) {
+        fprintf(stderr, "All-pairs sum of %d particles exceeds its capacity of %d\n", count, direct->capacity);
+        MPI_Abort(comm, EXIT_FAILURE);
+    }
+
+    // Blocks of whole tiles, as few tiles per block as the block limit allows
+    int tiles = (count + DIRECT_TILE - 1) / DIRECT_TILE;
+    direct->particles = particles;
+    direct->count = count;
+    direct->block_tiles = (tiles + DIRECT_MAX_BLOCKS - 1) / DIRECT_MAX_BLOCKS;
+    if (direct->block_tiles < 1) direct->block_tiles = 1;
+    direct->block_count = (tiles + direct->block_tiles - 1) / direct->block_tiles;
+
+    int tasks = 0;
+    for (int I = 0; I < direct->block_count; I++) {
+        for (int J = I; J < direct->block_count; J++) {
+            direct->task_first[tasks] = I;
+            direct->task_second[tasks] = J;
+            tasks += 1;
+        }
+    }
+
+    // Lost particles take part with no mass
+    for (int p = 0; p < count; p++) direct->mass[p] = particles->mass[p] < 0 ? 0.0 : particles->mass[p];
+
+    // Each rank takes a contiguous run of the tasks. The other ranks' values
+    // are left at zero, so the sum over the ranks only adds zeros to them and
+    // every rank ends up with the same bits as a single rank would.
+    int first_task = (int)((long long)tasks * rank / size);
+    int last_task = (int)((long long)tasks * (rank + 1) / size);
+    size_t partials = (size_t)direct->block_count * direct->capacity;
+    if (size > 1) {
+        memset(direct->x_partial, 0, partials * sizeof(double));
+        memset(direct->y_partial, 0, partials * sizeof(double));
+    }
+
+    if (pool) {
+        parallel_for(pool, first_task, last_task, 1, pair_blocks, direct);
+    } else {
+        pair_blocks(direct, first_task, last_task);
+    }
+
+    if (size > 1) {
+        MPI_Allreduce(MPI_IN_PLACE, direct->x_partial, (int)partials, MPI_DOUBLE, MPI_SUM, comm);
+        MPI_Allreduce(MPI_IN_PLACE, direct->y_partial, (int)partials, MPI_DOUBLE, MPI_SUM, comm);
+    }
+
+    if (pool) {
+        parallel_for(pool, 0, count, THREAD_CHUNK_SIZE, sum_partials, direct);
+    } else {
+        sum_partials(direct, 0, count);
+    }
+}
@@ -0,0 +1,59 @@
+#ifndef DIRECT_H
+#define DIRECT_H
+
+#include <math.h>
+#include <mpi.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "particle.h"
+#include "threads.h"
+#include "tree.h"
+
+// Particles per tile of the all-pairs sum. Two tiles' positions, masses and
+// force accumulators stay in L1 while every pair between them is summed.
+#define DIRECT_TILE 64
+
+// At most this many blocks of tiles. A pair of blocks is one task for the
+// pool, and each block keeps one column of partial forces per particle.
+#define DIRECT_MAX_BLOCKS 16
+
+// Replicated runs with fewer particles than this sum all pairs instead of
+// building a tree when -a auto is given. Measured on one rank and thread
+// against the insertion tree at theta 0.5: the two break even near 2000
+// uniform particles in baseline and AVX-512 builds, later for clustered ones.
+#define DIRECT_CROSSOVER 2048
+
+// Exact O(N^2) forces with the G and RLIMIT of compute_force: the distance is
+// clamped to RLIMIT, a pair at the same position adds nothing and lost
+// particles (mass -1) neither pull nor are pulled. Every pair is evaluated
+// once and its force added to one particle and subtracted from the other.
+// Each pair of blocks writes its own partial columns, which are summed in a
+// fixed order, so the forces do not depend on the thread or rank count.
+typedef struct {
+    int capacity;          // Particles the columns hold
+    double* mass;          // Masses with the lost particles at zero
+    double* x_partial;     // Force from each block, block b at b * capacity
+    double* y_partial;
+    int* task_first;       // Blocks of each task, task_first <= task_second
+    int* task_second;
+
+    // Layout of the current sum
+    ParticleSoA* particles;
+    int count;
+    int block_tiles;       // Tiles per block
+    int block_count;
+} DirectSum;
+
+DirectSum* create_direct_sum(int capacity);
+
+// Sum the forces between all particles [0, particles->count) and write them
+// to their x_force and y_force. The pairs are split over the ranks of comm,
+// which all pass the same particles and all get every force, and over the
+// threads of pool, which may be NULL. Collective over comm.
+void compute_direct_forces(ThreadPool* pool, DirectSum* direct, ParticleSoA* particles, MPI_Comm comm);
+
+void destroy_direct_sum(DirectSum* direct);
+
+#endif // DIRECT_H
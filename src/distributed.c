@@ -0,0 +1,677 @@
+
+#include "distributed.h"
+
+// Group of ranks that still has to be split by the ORB
+typedef struct {
+    int node;       // Cut tree node describing this group
+    int rank_first; // First rank of the group
+    int rank_count; // Number of ranks in the group
+    Region region;  // Region covered by the group
+} OrbGroup;
+
+// Growable buffer of remote bodies
+typedef struct {
+    RemoteBody* bodies;
+    int count;
+    int capacity;
+} BodyBuffer;
+
+static void append_body(BodyBuffer* buffer, double x_pos, double y_pos, double mass, double qxx, double qxy, double qyy) {
+    if (buffer->count == buffer->capacity) {
+        buffer->capacity = buffer->capacity ? buffer->capacity * 2 : 64;
+        buffer->bodies = (RemoteBody*)realloc(buffer->bodies, buffer->capacity * sizeof(RemoteBody));
+        if (!buffer->bodies) {
+            perror("Memory allocation error");
+            exit(EXIT_FAILURE);
+        }
+    }
+    buffer->bodies[buffer->count].x_pos = x_pos;
+    buffer->bodies[buffer->count].y_pos = y_pos;
+    buffer->bodies[buffer->count].mass = mass;
+    buffer->bodies[buffer->count].qxx = qxx;
+    buffer->bodies[buffer->count].qxy = qxy;
+    buffer->bodies[buffer->count].qyy = qyy;
+    buffer->count += 1;
+}
+
+// Shortest distance from a point to a region (0 if the point is inside)
+static double region_distance(const Region* region, double x_pos, double y_pos) {
+    double dx = 0.0;
+    double dy = 0.0;
+
+    if (x_pos < region->x_min) dx = region->x_min - x_pos;
+    else if (x_pos > region->x_max) dx = x_pos - region->x_max;
+    if (y_pos < region->y_min) dy = region->y_min - y_pos;
+    else if (y_pos > region->y_max) dy = y_pos - region->y_max;
+
+    return sqrt((dx * dx) + (dy * dy));
+}
+
+// Particles that are lost or outside the domain take no part in the decomposition
+static int is_live(const Particle* particle) {
+    return particle->mass >= 0 &&
+           particle->x_pos >= 0 && particle->x_pos < DEFAULT_BOUNDARY_SIZE &&
+           particle->y_pos >= 0 && particle->y_pos < DEFAULT_BOUNDARY_SIZE;
+}
+
+// Split the domain into one region per rank with orthogonal recursive bisection.
+// Every rank takes part with its local particles and ends up with the same cuts.
+// Weighted by the measured cost of each particle the regions are cost zones,
+// otherwise every particle counts the same.
+void decompose_domain(MPI_Comm comm, const Particle* particles, int count, int weighted, Decomposition* decomp) {
+    int size;
+    MPI_Comm_size(comm, &size);
+
+    decomp->nodes = (OrbNode*)malloc((2 * size - 1) * sizeof(OrbNode));
+    decomp->regions = (Region*)malloc(size * sizeof(Region));
+    decomp->region_count = size;
+    decomp->node_count = 1;
+
+    OrbGroup* groups = (OrbGroup*)malloc(size * sizeof(OrbGroup));
+    OrbGroup* next_groups = (OrbGroup*)malloc(size * sizeof(OrbGroup));
+    int* group_of = (int*)malloc((count > 0 ? count : 1) * sizeof(int));
+    double* low = (double*)malloc(size * sizeof(double));
+    double* high = (double*)malloc(size * sizeof(double));
+    double* target = (double*)malloc(size * sizeof(double));
+    double* below = (double*)malloc(size * sizeof(double));
+    int* low_group = (int*)malloc(size * sizeof(int));
+    int* high_group = (int*)malloc(size * sizeof(int));
+
+    Region domain = {0.0, 0.0, DEFAULT_BOUNDARY_SIZE, DEFAULT_BOUNDARY_SIZE};
+    groups[0].node = 0;
+    groups[0].rank_first = 0;
+    groups[0].rank_count = size;
+    groups[0].region = domain;
+    int group_count = size > 1 ? 1 : 0;
+
+    for (int i = 0; i < count; i++) {
+        group_of[i] = is_live(&particles[i]) ? 0 : -1;
+    }
+
+    while (group_count > 0) {
+        // Place the cut of every group at the weighted median along its longer side
+        for (int g = 0; g < group_count; g++) {
+            OrbGroup* group = &groups[g];
+            int axis = (group->region.y_max - group->region.y_min) > (group->region.x_max - group->region.x_min);
+            OrbNode* node = &decomp->nodes[group->node];
+            node->axis = axis;
+            node->rank = -1;
+            low[g] = axis ? group->region.y_min : group->region.x_min;
+            high[g] = axis ? group->region.y_max : group->region.x_max;
+        }
+
+        // Weigh the live particles of each group
+        for (int g = 0; g < group_count; g++) below[g] = 0.0;
+        for (int i = 0; i < count; i++) {
+            if (group_of[i] >= 0) below[group_of[i]] += weighted ? particles[i].cost : 1.0;
+        }
+        MPI_Allreduce(MPI_IN_PLACE, below, group_count, MPI_DOUBLE, MPI_SUM, comm);
+        for (int g = 0; g < group_count; g++) {
+            int low_ranks = groups[g].rank_count / 2;
+            target[g] = below[g] * low_ranks / groups[g].rank_count;
+        }
+
+        // Bisect on the cut coordinate until the low side holds its share
+        for (int iter = 0; iter < ORB_ITERATIONS; iter++) {
+            for (int g = 0; g < group_count; g++) below[g] = 0.0;
+            for (int i = 0; i < count; i++) {
+                int g = group_of[i];
+                if (g < 0) continue;
+                double mid = 0.5 * (low[g] + high[g]);
+                double coord = decomp->nodes[groups[g].node].axis ? particles[i].y_pos : particles[i].x_pos;
+                if (coord < mid) below[g] += weighted ? particles[i].cost : 1.0;
+            }
+            MPI_Allreduce(MPI_IN_PLACE, below, group_count, MPI_DOUBLE, MPI_SUM, comm);
+            for (int g = 0; g < group_count; g++) {
+                double mid = 0.5 * (low[g] + high[g]);
+                if (below[g] < target[g]) low[g] = mid;
+                else high[g] = mid;
+            }
+        }
+
+        // Split every group in two and retire the groups made of a single rank
+        int next_count = 0;
+        for (int g = 0; g < group_count; g++) {
+            OrbGroup* group = &groups[g];
+            OrbNode* node = &decomp->nodes[group->node];
+            node->cut = 0.5 * (low[g] + high[g]);
+
+            int low_ranks = group->rank_count / 2;
+            OrbGroup halves[2];
+            halves[0] = *group;
+            halves[1] = *group;
+            halves[0].rank_count = low_ranks;
+            halves[1].rank_first = group->rank_first + low_ranks;
+            halves[1].rank_count = group->rank_count - low_ranks;
+            if (node->axis) {
+                halves[0].region.y_max = node->cut;
+                halves[1].region.y_min = node->cut;
+            } else {
+                halves[0].region.x_max = node->cut;
+                halves[1].region.x_min = node->cut;
+            }
+
+            for (int h = 0; h < 2; h++) {
+                int child = decomp->node_count++;
+                int* group_index = h == 0 ? &low_group[g] : &high_group[g];
+                halves[h].node = child;
+                if (h == 0) node->low = child;
+                else node->high = child;
+
+                if (halves[h].rank_count == 1) {
+                    decomp->nodes[child].rank = halves[h].rank_first;
+                    decomp->nodes[child].low = -1;
+                    decomp->nodes[child].high = -1;
+                    decomp->regions[halves[h].rank_first] = halves[h].region;
+                    *group_index = -1;
+                } else {
+                    *group_index = next_count;
+                    next_groups[next_count++] = halves[h];
+                }
+            }
+        }
+
+        // Move particles to the group on their side of the cut
+        for (int i = 0; i < count; i++) {
+            int g = group_of[i];
+            if (g < 0) continue;
+            OrbNode* node = &decomp->nodes[groups[g].node];
+            double coord = node->axis ? particles[i].y_pos : particles[i].x_pos;
+            group_of[i] = coord < node->cut ? low_group[g] : high_group[g];
+        }
+
+        OrbGroup* swap = groups;
+        groups = next_groups;
+        next_groups = swap;
+        group_count = next_count;
+    }
+
+    // A single rank owns the whole domain
+    if (size == 1) {
+        decomp->nodes[0].rank = 0;
+        decomp->nodes[0].low = -1;
+        decomp->nodes[0].high = -1;
+        decomp->regions[0] = domain;
+    }
+
+    free(groups);
+    free(next_groups);
+    free(group_of);
+    free(low);
+    free(high);
+    free(target);
+    free(below);
+    free(low_group);
+    free(high_group);
+}
+
+// Find the rank that owns a position by descending the ORB cut tree
+int find_owner(const Decomposition* decomp, double x_pos, double y_pos) {
+    int n = 0;
+    while (decomp->nodes[n].rank < 0) {
+        const OrbNode* node = &decomp->nodes[n];
+        double coord = node->axis ? y_pos : x_pos;
+        n = coord < node->cut ? node->low : node->high;
+    }
+    return decomp->nodes[n].rank;
+}
+
+// Send every live particle to the rank owning its position. Lost particles stay
+// where they are. Returns the new local particle array and frees the old one.
+Particle* migrate_particles(MPI_Comm comm, const Decomposition* decomp, Particle* particles, int* count) {
+    int rank, size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+
+    int* owner = (int*)malloc((*count > 0 ? *count : 1) * sizeof(int));
+    int* send_counts = (int*)calloc(size, sizeof(int));
+    int* send_displs = (int*)malloc(size * sizeof(int));
+    int* recv_counts = (int*)malloc(size * sizeof(int));
+    int* recv_displs = (int*)malloc(size * sizeof(int));
+    int* fill = (int*)malloc(size * sizeof(int));
+
+    for (int i = 0; i < *count; i++) {
+        owner[i] = is_live(&particles[i]) ? find_owner(decomp, particles[i].x_pos, particles[i].y_pos) : rank;
+        send_counts[owner[i]] += sizeof(Particle);
+    }
+
+    MPI_Alltoall(send_counts, 1, MPI_INT, recv_counts, 1, MPI_INT, comm);
+
+    int send_total = 0;
+    int recv_total = 0;
+    for (int r = 0; r < size; r++) {
+        send_displs[r] = send_total;
+        recv_displs[r] = recv_total;
+        fill[r] = send_total / (int)sizeof(Particle);
+        send_total += send_counts[r];
+        recv_total += recv_counts[r];
+    }
+
+    // Pack particles grouped by destination rank
+    Particle* send_buffer = (Particle*)malloc((send_total > 0 ? send_total : 1));
+    for (int i = 0; i < *count; i++) {
+        send_buffer[fill[owner[i]]++] = particles[i];
+    }
+
+    Particle* received = (Particle*)malloc((recv_total > 0 ? recv_total : 1));
+    if (!send_buffer || !received) {
+        perror("Memory allocation error");
+        MPI_Abort(comm, EXIT_FAILURE);
+    }
+    MPI_Alltoallv(send_buffer, send_counts, send_displs, MPI_BYTE,
+                  received, recv_counts, recv_displs, MPI_BYTE, comm);
+
+    free(particles);
+    free(send_buffer);
+    free(owner);
+    free(send_counts);
+    free(send_displs);
+    free(recv_counts);
+    free(recv_displs);
+    free(fill);
+
+    *count = recv_total / (int)sizeof(Particle);
+    return received;
+}
+
+// Decomposition as kept in checkpoints: this header, the cut tree and the regions
+typedef struct {
+    int32_t repartition;  // The next step cuts new regions
+    int32_t node_count;
+    int32_t region_count;
+    int32_t padding;
+} DecompositionState;
+
+// Pack the regions and the pending recut into one buffer, the caller frees it
+static void* pack_decomposition(const Decomposition* decomp, int repartition, size_t* bytes) {
+    DecompositionState state = {repartition, decomp->node_count, decomp->region_count, 0};
+    size_t node_bytes = (size_t)decomp->node_count * sizeof(OrbNode);
+    size_t region_bytes = (size_t)decomp->region_count * sizeof(Region);
+    *bytes = sizeof(state) + node_bytes + region_bytes;
+
+    char* buffer = (char*)malloc(*bytes);
+    if (!buffer) {
+        perror("Memory allocation error");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(buffer, &state, sizeof(state));
+    memcpy(buffer + sizeof(state), decomp->nodes, node_bytes);
+    memcpy(buffer + sizeof(state) + node_bytes, decomp->regions, region_bytes);
+    return buffer;
+}
+
+// Take up the regions of the run a checkpoint was written by. Without them, or
+// when they were cut for another rank count, the first step cuts new ones.
+static void restore_decomposition(MPI_Comm comm, const char* filename, Decomposition* decomp, int* repartition) {
+    int size;
+    MPI_Comm_size(comm, &size);
+
+    size_t bytes;
+    char* buffer = (char*)read_checkpoint_state(comm, filename, &bytes);
+    DecompositionState state;
+    if (!buffer || bytes < sizeof(state)) {
+        free(buffer);
+        return;
+    }
+    memcpy(&state, buffer, sizeof(state));
+    size_t node_bytes = (size_t)state.node_count * sizeof(OrbNode);
+    size_t region_bytes = (size_t)state.region_count * sizeof(Region);
+    if (state.region_count != size || state.node_count != 2 * size - 1 ||
+        bytes != sizeof(state) + node_bytes + region_bytes) {
+        free(buffer);
+        return;
+    }
+
+    decomp->nodes = (OrbNode*)malloc(node_bytes);
+    decomp->regions = (Region*)malloc(region_bytes);
+    if (!decomp->nodes || !decomp->regions) {
+        perror("Memory allocation error");
+        MPI_Abort(comm, EXIT_FAILURE);
+    }
+    memcpy(decomp->nodes, buffer + sizeof(state), node_bytes);
+    memcpy(decomp->regions, buffer + sizeof(state) + node_bytes, region_bytes);
+    decomp->node_count = state.node_count;
+    decomp->region_count = state.region_count;
+    *repartition = state.repartition;
+    free(buffer);
+}
+
+void destroy_decomposition(Decomposition* decomp) {
+    free(decomp->nodes);
+    free(decomp->regions);
+    decomp->nodes = NULL;
+    decomp->regions = NULL;
+}
+
+// Collect the part of the local tree a remote region needs: subtrees that pass
+// the MAC for every point of the region are sent as one summary, and leaf
+// buckets that are too close are sent particle by particle.
+static void collect_essential(const FlatTree* tree, const Region* region, double theta, BodyBuffer* out) {
+    int i = 0;
+    while (i < tree->count) {
+        const FlatNode* node = &tree->nodes[i];
+
+        // The closest point of the region gives the most conservative MAC test
+        double distance = region_distance(region, node->x_com, node->y_com);
+        if (distance < RLIMIT) {
+            distance = RLIMIT;
+        }
+        int accepted = (node->size / distance) < theta;
+
+        if (node->next == i + 1 && !(node->count > 1 && accepted)) {
+            for (int s = node->first; s < node->first + node->count; s++) {
+                append_body(out, tree->x_pos[s], tree->y_pos[s], tree->mass[s], 0.0, 0.0, 0.0);
+            }
+            i = node->next;
+        } else if (node->next == i + 1 || accepted) {
+            if (tree->quadrupoles) {
+                append_body(out, node->x_com, node->y_com, node->mass, tree->qxx[i], tree->qxy[i], tree->qyy[i]);
+            } else {
+                append_body(out, node->x_com, node->y_com, node->mass, 0.0, 0.0, 0.0);
+            }
+            i = node->next;
+        } else {
+            i += 1;
+        }
+    }
+}
+
+// Exchange locally essential trees with every other rank. Returns the bodies
+// this rank imported; the caller frees them.
+void start_essential_exchange(MPI_Comm comm, const Decomposition* decomp, const FlatTree* tree, double theta,
+                              EssentialExchange* exchange) {
+    int rank, size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+
+    exchange->send_counts = (int*)malloc(size * sizeof(int));
+    exchange->send_displs = (int*)malloc(size * sizeof(int));
+    exchange->recv_counts = (int*)malloc(size * sizeof(int));
+    exchange->recv_displs = (int*)malloc(size * sizeof(int));
+
+    // Gather the essential bodies for every remote region back to back
+    BodyBuffer export = {NULL, 0, 0};
+    for (int r = 0; r < size; r++) {
+        int start = export.count;
+        if (r != rank) collect_essential(tree, &decomp->regions[r], theta, &export);
+        exchange->send_displs[r] = start * sizeof(RemoteBody);
+        exchange->send_counts[r] = (export.count - start) * sizeof(RemoteBody);
+    }
+    exchange->exported = export.bodies;
+
+    MPI_Alltoall(exchange->send_counts, 1, MPI_INT, exchange->recv_counts, 1, MPI_INT, comm);
+
+    int recv_total = 0;
+    for (int r = 0; r < size; r++) {
+        exchange->recv_displs[r] = recv_total;
+        recv_total += exchange->recv_counts[r];
+    }
+
+    exchange->imported = (RemoteBody*)malloc(recv_total > 0 ? recv_total : 1);
+    if (!exchange->imported) {
+        perror("Memory allocation error");
+        MPI_Abort(comm, EXIT_FAILURE);
+    }
+    exchange->import_count = recv_total / (int)sizeof(RemoteBody);
+
+    MPI_Ialltoallv(exchange->exported, exchange->send_counts, exchange->send_displs, MPI_BYTE,
+                   exchange->imported, exchange->recv_counts, exchange->recv_displs, MPI_BYTE,
+                   comm, &exchange->overlap.requests[0]);
+    start_overlap(&exchange->overlap, 1);
+}
+
+RemoteBody* finish_essential_exchange(EssentialExchange* exchange, int* import_count) {
+    finish_overlap(&exchange->overlap);
+
+    free(exchange->exported);
+    free(exchange->send_counts);
+    free(exchange->send_displs);
+    free(exchange->recv_counts);
+    free(exchange->recv_displs);
+
+    *import_count = exchange->import_count;
+    return exchange->imported;
+}
+
+static int compare_index(const void* a, const void* b) {
+    const Particle* pa = (const Particle*)a;
+    const Particle* pb = (const Particle*)b;
+    return (pa->index > pb->index) - (pa->index < pb->index);
+}
+
+// Hand out the input held by the root in equal blocks, the first
+// decomposition then fixes ownership
+Particle* scatter_particles(MPI_Comm comm, const Particle* particles, int particle_count, int* local_count) {
+    int rank, size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+
+    int* counts = (int*)malloc(size * sizeof(int));
+    int* displs = (int*)malloc(size * sizeof(int));
+    int offset = 0;
+    for (int r = 0; r < size; r++) {
+        int block = particle_count / size + (r < particle_count % size ? 1 : 0);
+        counts[r] = block * sizeof(Particle);
+        displs[r] = offset * sizeof(Particle);
+        offset += block;
+    }
+
+    *local_count = counts[rank] / (int)sizeof(Particle);
+    Particle* local = (Particle*)malloc(*local_count > 0 ? counts[rank] : 1);
+    MPI_Scatterv(particles, counts, displs, MPI_BYTE,
+                 local, counts[rank], MPI_BYTE, 0, comm);
+
+    free(counts);
+    free(displs);
+    return local;
+}
+
+void run_distributed(MPI_Comm comm, const Options* opts, ThreadPool* pool, Particle* local, int local_count, Particle* particles, int particle_count) {
+    int rank, size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+
+    int* counts = (int*)malloc(size * sizeof(int));
+    int* displs = (int*)malloc(size * sizeof(int));
+
+    TreeBuilder* builder = create_tree_builder(opts->builder, opts->leaf_size, local_count, pool);
+    FlatTree* flat_tree = create_flat_tree(2 * local_count);
+    flat_tree->quadrupoles = opts->quadrupoles;
+    flat_tree->single_precision = opts->single_precision;
+    InteractionList* remote = create_interaction_list(1024);
+
+    // Lost particles stay with their rank, they are set aside between steps
+    LostSet* lost = create_lost_set();
+
+    GroupSet* groups = NULL;
+    InteractionList** lists = NULL;
+    if (opts->group_size > 0) {
+        groups = create_group_set(local_count);
+        lists = create_interaction_lists(pool->thread_count);
+    }
+
+    // Every rank publishes the region it owns, a viewer merges the rings by
+    // index. Rings are sized by the local share and grow with it.
+    FrameRing* frames = NULL;
+    if (opts->visualization_flag) {
+        frames = create_rank_frame_ring(rank, opts->visualization_flag, local_count + local_count / 4);
+        if (rank == 0) printf("Publishing frames to %s.0 to %s.%d\n", FRAME_RING_PREFIX, FRAME_RING_PREFIX, size - 1);
+    }
+
+    // Periodic checkpoints, each rank writes the particles it owns
+    CheckpointWriter* checkpoints = NULL;
+    if (opts->checkpoint_steps > 0 || opts->checkpoint_seconds > 0) checkpoints = create_checkpoint_writer(comm, opts);
+
+    // The regions are kept while the load stays balanced: the work measured
+    // in the last step with cost zones (-B), the particle counts without
+    int balance = opts->balance_threshold > 0;
+    double threshold = balance ? opts->balance_threshold : ORB_COUNT_IMBALANCE;
+    int repartition = 1;
+    Decomposition decomp;
+    decomp.nodes = NULL;
+    decomp.regions = NULL;
+
+    // A resumed run takes up the regions of the run it continues, the
+    // measured costs come back with the particles
+    if (opts->restart) restore_decomposition(comm, opts->in_file, &decomp, &repartition);
+
+    for (int step = opts->start_step; step < opts->steps; step++) {
+        if (opts->print_debug_flag > 0 && rank == 0) printf("Step %d out of %d\n", step, opts->steps);
+        STATS_BEGIN_STEP(step - opts->start_step);
+
+        // Rebalance the regions and move particles to their owners
+        double begin = phase_begin();
+        if (repartition) {
+            destroy_decomposition(&decomp);
+            decompose_domain(comm, local, local_count, balance, &decomp);
+        }
+        local = migrate_particles(comm, &decomp, local, &local_count);
+        phase_end(PHASE_EXCHANGE, begin);
+
+        // The engine works on a structure of arrays copy of the owned particles
+        begin = phase_begin();
+        ParticleSoA* soa = create_particle_soa(local_count);
+        load_particle_soa(soa, local);
+
+        // Build the tree of the particles this rank owns
+        build_tree(builder, soa, flat_tree, 0);
+        STATS_TREE(flat_tree);
+        if (groups) find_groups(groups, flat_tree, opts->group_size, local_count);
+        phase_end(PHASE_BUILD, begin);
+
+        // Send the essential trees, and walk the local tree while they travel
+        begin = phase_begin();
+        EssentialExchange exchange;
+        start_essential_exchange(comm, &decomp, flat_tree, opts->theta, &exchange);
+        phase_end(PHASE_EXCHANGE, begin);
+
+        begin = phase_begin();
+        ForcePass pass = {.tree = flat_tree, .particles = soa, .theta = opts->theta, .time_step = opts->time_step,
+                          .remote = remote, .groups = groups, .lists = lists, .stage = FORCE_LOCAL,
+                          .overlap = &exchange.overlap};
+        if (groups) {
+            run_group_pass(pool, &pass, 0, groups->count);
+            run_untreed_pass(&pass);
+        } else {
+            run_force_pass(pool, &pass, 0, local_count);
+        }
+        phase_end(PHASE_FORCE, begin);
+
+        begin = phase_begin();
+        int import_count = 0;
+        RemoteBody* imported = finish_essential_exchange(&exchange, &import_count);
+        phase_end(PHASE_EXCHANGE, begin);
+
+        if (opts->print_debug_flag >= 2) {
+            printf("Rank %d: %d local particles, %d imported bodies\n", rank, local_count, import_count);
+        }
+        if (opts->print_debug_flag > 0 && rank == 0) {
+            printf("Essential tree exchange: %.6f s hidden, %.6f s exposed\n", exchange.overlap.hidden, exchange.overlap.exposed);
+        }
+
+        // Unpack the imported bodies into columns for the kernels
+        begin = phase_begin();
+        remote->count = 0;
+        remote->cell_count = 0;
+        for (int b = 0; b < import_count; b++) {
+            const RemoteBody* body = &imported[b];
+            if (body->qxx != 0.0 || body->qxy != 0.0 || body->qyy != 0.0) {
+                append_cell(remote, body->x_pos, body->y_pos, body->mass, body->qxx, body->qxy, body->qyy);
+            } else {
+                append_source(remote, body->x_pos, body->y_pos, body->mass);
+            }
+        }
+
+        // Add the contribution of the remote summaries and advance
+        pass.stage = FORCE_FINISH;
+        pass.overlap = NULL;
+        run_force_pass(pool, &pass, 0, local_count);
+        store_particle_soa(soa, local);
+        phase_end(PHASE_FORCE, begin);
+
+        // Load of the slowest rank over the mean, from this step's costs or
+        // counts. Like the cuts it only takes in the particles in the domain,
+        // so it does not depend on which rank keeps the lost ones.
+        begin = phase_begin();
+        double work = 0.0;
+        for (int i = 0; i < local_count; i++) {
+            if (is_live(&local[i])) work += balance ? local[i].cost : 1.0;
+        }
+        double slowest, total;
+        MPI_Allreduce(&work, &slowest, 1, MPI_DOUBLE, MPI_MAX, comm);
+        MPI_Allreduce(&work, &total, 1, MPI_DOUBLE, MPI_SUM, comm);
+        double imbalance = total > 0 ? slowest * size / total : 1.0;
+        phase_end(PHASE_EXCHANGE, begin);
+
+        if (balance) record_balance(imbalance, repartition);
+        if (opts->print_debug_flag > 0 && rank == 0) {
+            printf("%s imbalance %.3f%s\n", balance ? "Work" : "Count", imbalance,
+                   repartition ? (balance ? " (new cost zones)" : " (new regions)") : "");
+        }
+        repartition = imbalance > threshold;
+
+        if (frames) {
+            frames = reserve_frame_ring(frames, soa->count);
+            publish_frame(frames, step + 1, (step + 1) * opts->time_step, soa, flat_tree);
+        }
+        if (checkpoints) {
+            begin = phase_begin();
+            progress_checkpoint(checkpoints);
+            if (checkpoint_due(checkpoints, step + 1)) {
+                // Checkpoints hold every particle, the lost ones included
+                if (lost->count > 0) {
+                    local = return_lost_particles(lost, local, &local_count, step + 1, opts->time_step);
+                    destroy_particle_soa(soa);
+                    soa = create_particle_soa(local_count);
+                    load_particle_soa(soa, local);
+                }
+                // With the regions the next step works from, so a resumed
+                // run carries on as this one does
+                size_t state_bytes;
+                void* state = pack_decomposition(&decomp, repartition, &state_bytes);
+                start_checkpoint(checkpoints, opts, step + 1, soa, 0, local_count, state, state_bytes);
+                free(state);
+            }
+            phase_end(PHASE_CHECKPOINT, begin);
+        }
+        STATS_END_STEP(soa, 0, local_count, lost->count);
+
+        if ((step + 1 - opts->start_step) % ACTIVE_SET_INTERVAL == 0) {
+            remove_lost_particles(lost, local, &local_count, step + 1);
+        }
+        destroy_particle_soa(soa);
+        free(imported);
+    }
+    local = return_lost_particles(lost, local, &local_count, opts->steps, opts->time_step);
+    destroy_lost_set(lost);
+    destroy_decomposition(&decomp);
+
+    double begin = phase_begin();
+    destroy_checkpoint_writer(checkpoints);
+    phase_end(PHASE_CHECKPOINT, begin);
+
+    // Collect the final state on the root and restore input order
+    begin = phase_begin();
+    int local_bytes = local_count * sizeof(Particle);
+    MPI_Gather(&local_bytes, 1, MPI_INT, counts, 1, MPI_INT, 0, comm);
+    if (rank == 0) {
+        int offset = 0;
+        for (int r = 0; r < size; r++) {
+            displs[r] = offset;
+            offset += counts[r];
+        }
+    }
+    MPI_Gatherv(local, local_bytes, MPI_BYTE, particles, counts, displs, MPI_BYTE, 0, comm);
+    if (rank == 0) qsort(particles, particle_count, sizeof(Particle), compare_index);
+    phase_end(PHASE_EXCHANGE, begin);
+
+    destroy_frame_ring(frames);
+    destroy_tree_builder(builder);
+    destroy_flat_tree(flat_tree);
+    destroy_group_set(groups);
+    destroy_interaction_lists(lists, pool->thread_count);
+    destroy_interaction_list(remote);
+    free(local);
+    free(counts);
+    free(displs);
+}
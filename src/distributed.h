@@ -0,0 +1,94 @@
+#ifndef DISTRIBUTED_H
+#define DISTRIBUTED_H
+
+#include <mpi.h>
+
+#include "active.h"
+#include "builder.h"
+#include "checkpoint.h"
+#include "flat_tree.h"
+#include "force.h"
+#include "group.h"
+#include "io.h"
+#include "kernel.h"
+#include "particle.h"
+#include "threads.h"
+#include "timing.h"
+#include "tree.h"
+
+// Number of bisection iterations used to place each ORB cut
+#define ORB_ITERATIONS 32
+
+// Without cost zones the ORB cuts are kept until the rank holding the most
+// particles holds this much more than the mean
+#define ORB_COUNT_IMBALANCE 1.05
+
+// Axis aligned rectangle of the domain
+typedef struct {
+    double x_min;
+    double y_min;
+    double x_max;
+    double y_max;
+} Region;
+
+// Node of the orthogonal recursive bisection (ORB) cut tree
+typedef struct {
+    int axis;   // Split axis (0 = x, 1 = y)
+    double cut; // Split coordinate, coordinates below the cut go low
+    int low;    // Child holding coordinates below the cut
+    int high;   // Child holding coordinates at or above the cut
+    int rank;   // Owning rank for leaves, -1 for internal cuts
+} OrbNode;
+
+// Spatial decomposition of the domain across ranks
+typedef struct {
+    OrbNode* nodes;   // ORB cut tree, root at index 0
+    int node_count;   // Number of nodes in the cut tree
+    Region* regions;  // Region owned by each rank
+    int region_count; // Number of ranks
+} Decomposition;
+
+// Mass summary of a remote subtree or a single remote particle. Summaries
+// carry their quadrupole moments when the tree has them, particles zeros.
+typedef struct {
+    double x_pos;
+    double y_pos;
+    double mass;
+    double qxx;
+    double qxy;
+    double qyy;
+} RemoteBody;
+
+// Domain decomposition and particle migration
+void decompose_domain(MPI_Comm comm, const Particle* particles, int count, int weighted, Decomposition* decomp);
+int find_owner(const Decomposition* decomp, double x_pos, double y_pos);
+Particle* migrate_particles(MPI_Comm comm, const Decomposition* decomp, Particle* particles, int* count);
+void destroy_decomposition(Decomposition* decomp);
+
+// Locally essential tree exchange in flight. The summaries each rank needs
+// from this one are collected and the counts swapped before it starts, the
+// bodies themselves move while the local tree is walked.
+typedef struct {
+    RemoteBody* exported;   // Send buffer, kept until the exchange completes
+    RemoteBody* imported;
+    int import_count;
+    int* send_counts;       // In bytes
+    int* send_displs;
+    int* recv_counts;
+    int* recv_displs;
+    Overlap overlap;
+} EssentialExchange;
+
+void start_essential_exchange(MPI_Comm comm, const Decomposition* decomp, const FlatTree* tree, double theta,
+                              EssentialExchange* exchange);
+// Wait for the bodies and release the send side, the caller frees the result
+RemoteBody* finish_essential_exchange(EssentialExchange* exchange, int* import_count);
+
+Particle* scatter_particles(MPI_Comm comm, const Particle* particles, int particle_count, int* local_count);
+
+// Run the simulation with each rank owning one spatial region, starting from
+// its block local (taken over and freed). On the root rank particles receives
+// the final state of all particle_count particles in index order.
+void run_distributed(MPI_Comm comm, const Options* opts, ThreadPool* pool, Particle* local, int local_count, Particle* particles, int particle_count);
+
+#endif // DISTRIBUTED_H
@@ -0,0 +1,214 @@
+#include "ensemble.h"
+
+// Members are parsed with at most this many arguments of their own
+#define ENSEMBLE_MAX_ARGS 64
+
+static char* copy_string(const char* string) {
+    if (string == NULL) return NULL;
+    char* copy = strdup(string);
+    if (copy == NULL) {
+        perror("Memory allocation error");
+        exit(EXIT_FAILURE);
+    }
+    return copy;
+}
+
+static char* read_manifest(const char* filename) {
+    FILE* file = fopen(filename, "rb");
+    if (!file) {
+        perror("Error opening ensemble manifest");
+        exit(EXIT_FAILURE);
+    }
+    fseek(file, 0, SEEK_END);
+    long length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    char* text = (char*)malloc(length + 1);
+    if (text == NULL) {
+        perror("Memory allocation error");
+        exit(EXIT_FAILURE);
+    }
+    if (fread(text, 1, length, file) != (size_t)length) {
+        perror("Error reading ensemble manifest");
+        exit(EXIT_FAILURE);
+    }
+    text[length] = '\0';
+    fclose(file);
+    return text;
+}
+
+// Parse one manifest line after the command line arguments, line is split in place
+static void parse_member(char* line, int line_number, int argc, char** argv, int group_ranks, Options* member) {
+    char** args = (char**)malloc((argc + ENSEMBLE_MAX_ARGS) * sizeof(char*));
+    if (args == NULL) {
+        perror("Memory allocation error");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(args, argv, argc * sizeof(char*));
+
+    int count = argc;
+    for (char* token = strtok(line, " \t\r"); token; token = strtok(NULL, " \t\r")) {
+        if (count == argc + ENSEMBLE_MAX_ARGS) {
+            fprintf(stderr, "Ensemble manifest line %d: more than %d arguments\n", line_number, ENSEMBLE_MAX_ARGS);
+            exit(EXIT_FAILURE);
+        }
+        if (strcmp(token, "-E") == 0 || strcmp(token, "-R") == 0) {
+            fprintf(stderr, "Ensemble manifest line %d: %s only goes on the command line\n", line_number, token);
+            exit(EXIT_FAILURE);
+        }
+        args[count++] = token;
+    }
+
+    memset(member, 0, sizeof(Options));
+    argument_parse(count, args, member);
+    free(args);
+    if (member->restart) load_checkpoint_options(member->in_file, member, group_ranks);
+
+    // Frame rings are named by rank, groups running at once would share them
+    if (member->visualization_flag) {
+        fprintf(stderr, "Ensemble manifest line %d: frames (-V) are not published in ensemble mode\n", line_number);
+        exit(EXIT_FAILURE);
+    }
+
+    member->in_file = copy_string(member->in_file);
+    member->out_file = copy_string(member->out_file);
+    member->report_file = copy_string(member->report_file);
+    member->ensemble_file = copy_string(member->ensemble_file);
+}
+
+Ensemble* read_ensemble(const char* filename, int argc, char** argv, int group_ranks) {
+    char* text = read_manifest(filename);
+
+    Ensemble* ensemble = (Ensemble*)calloc(1, sizeof(Ensemble));
+    int capacity = 16;
+    if (ensemble) ensemble->members = (Options*)malloc(capacity * sizeof(Options));
+    if (ensemble == NULL || ensemble->members == NULL) {
+        perror("Memory allocation error");
+        exit(EXIT_FAILURE);
+    }
+
+    int line_number = 0;
+    char* next = text;
+    while (next) {
+        char* line = next;
+        next = strchr(line, '\n');
+        if (next) *next++ = '\0';
+        line_number += 1;
+
+        char* first = line + strspn(line, " \t\r");
+        if (*first == '\0' || *first == '#') continue;
+
+        if (ensemble->count == capacity) {
+            capacity *= 2;
+            ensemble->members = (Options*)realloc(ensemble->members, capacity * sizeof(Options));
+            if (ensemble->members == NULL) {
+                perror("Memory allocation error");
+                exit(EXIT_FAILURE);
+            }
+        }
+        parse_member(first, line_number, argc, argv, group_ranks, &ensemble->members[ensemble->count]);
+        ensemble->count += 1;
+    }
+    free(text);
+
+    if (ensemble->count == 0) {
+        fprintf(stderr, "Ensemble manifest %s lists no members\n", filename);
+        exit(EXIT_FAILURE);
+    }
+
+    // Members writing the same file would overwrite each other
+    for (int a = 0; a < ensemble->count; a++) {
+        for (int b = a + 1; b < ensemble->count; b++) {
+            const Options* first = &ensemble->members[a];
+            const Options* second = &ensemble->members[b];
+            if (strcmp(first->out_file, second->out_file) == 0 ||
+                (first->report_file && second->report_file && strcmp(first->report_file, second->report_file) == 0)) {
+                fprintf(stderr, "Ensemble members %d and %d write the same output\n", a + 1, b + 1);
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+
+    ensemble->group = (int*)malloc(ensemble->count * sizeof(int));
+    ensemble->order = (int*)malloc(ensemble->count * sizeof(int));
+    if (ensemble->group == NULL || ensemble->order == NULL) {
+        perror("Memory allocation error");
+        exit(EXIT_FAILURE);
+    }
+    return ensemble;
+}
+
+// Estimated work of a member: input size times the steps left to run
+typedef struct {
+    double work;
+    int member;
+} MemberWork;
+
+static int compare_work(const void* a, const void* b) {
+    const MemberWork* first = (const MemberWork*)a;
+    const MemberWork* second = (const MemberWork*)b;
+    if (first->work != second->work) return first->work > second->work ? -1 : 1;
+    return first->member - second->member;
+}
+
+// Group, then input file, then manifest order
+static const Ensemble* sorted_ensemble;
+
+static int compare_order(const void* a, const void* b) {
+    int first = *(const int*)a;
+    int second = *(const int*)b;
+    if (sorted_ensemble->group[first] != sorted_ensemble->group[second]) {
+        return sorted_ensemble->group[first] - sorted_ensemble->group[second];
+    }
+    int input = strcmp(sorted_ensemble->members[first].in_file, sorted_ensemble->members[second].in_file);
+    return input != 0 ? input : first - second;
+}
+
+void assign_ensemble(Ensemble* ensemble, int group_count) {
+    MemberWork* work = (MemberWork*)malloc(ensemble->count * sizeof(MemberWork));
+    double* load = (double*)calloc(group_count, sizeof(double));
+    if (work == NULL || load == NULL) {
+        perror("Memory allocation error");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int m = 0; m < ensemble->count; m++) {
+        const Options* member = &ensemble->members[m];
+        struct stat info;
+        double bytes = stat(member->in_file, &info) == 0 ? (double)info.st_size : 1.0;
+        work[m].work = bytes * (member->steps - member->start_step);
+        work[m].member = m;
+    }
+    qsort(work, ensemble->count, sizeof(MemberWork), compare_work);
+
+    for (int k = 0; k < ensemble->count; k++) {
+        int lightest = 0;
+        for (int g = 1; g < group_count; g++) {
+            if (load[g] < load[lightest]) lightest = g;
+        }
+        ensemble->group[work[k].member] = lightest;
+        load[lightest] += work[k].work;
+    }
+
+    for (int m = 0; m < ensemble->count; m++) ensemble->order[m] = m;
+    sorted_ensemble = ensemble;
+    qsort(ensemble->order, ensemble->count, sizeof(int), compare_order);
+    sorted_ensemble = NULL;
+
+    free(work);
+    free(load);
+}
+
+void destroy_ensemble(Ensemble* ensemble) {
+    if (ensemble == NULL) return;
+    for (int m = 0; m < ensemble->count; m++) {
+        free(ensemble->members[m].in_file);
+        free(ensemble->members[m].out_file);
+        free(ensemble->members[m].report_file);
+        free(ensemble->members[m].ensemble_file);
+    }
+    free(ensemble->members);
+    free(ensemble->group);
+    free(ensemble->order);
+    free(ensemble);
+}
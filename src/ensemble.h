@@ -0,0 +1,36 @@
+#ifndef ENSEMBLE_H
+#define ENSEMBLE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "checkpoint.h"
+#include "io.h"
+
+// Ensemble mode (-E manifest): many independent runs in one launch. Every
+// non-empty line of the manifest not starting with '#' is one member, written
+// as the arguments of a single run ("-i in.txt -o out.txt -s 100 -t 0.5 ...").
+// The command line options come first, so they are the members' defaults.
+// The ranks are split into groups of -R ranks, each group runs its members
+// one after the other and writes their output and reports as single runs do.
+typedef struct {
+    Options* members;
+    int count;
+    int* group;     // Group that runs each member
+    int* order;     // Members in the order the groups run them
+} Ensemble;
+
+// Parse the manifest with the command line as defaults, rank 0 only. Exits
+// on an invalid member or on two members writing the same output.
+Ensemble* read_ensemble(const char* filename, int argc, char** argv, int group_ranks);
+
+// Spread the members over group_count groups, largest estimated work first
+// onto the least loaded group. Each group runs its members sorted by input
+// file, so members starting from the same file follow each other.
+void assign_ensemble(Ensemble* ensemble, int group_count);
+
+void destroy_ensemble(Ensemble* ensemble);
+
+#endif // ENSEMBLE_H
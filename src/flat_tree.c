@@ -0,0 +1,415 @@
+
+#include "flat_tree.h"
+#include "kernel.h"
+#include "stats.h"
+#include "threads.h"
+
+FlatTree* create_flat_tree(int capacity) {
+    FlatTree* tree = (FlatTree*)calloc(1, sizeof(FlatTree));
+    if (tree == NULL) {
+        perror("Memory allocation error");
+        exit(EXIT_FAILURE);
+    }
+
+    tree->capacity = capacity > 0 ? capacity : 1;
+    tree->nodes = (FlatNode*)malloc(tree->capacity * sizeof(FlatNode));
+    if (tree->nodes == NULL) {
+        perror("Memory allocation error");
+        exit(EXIT_FAILURE);
+    }
+    reserve_tree_particles(tree, capacity / 2);
+    return tree;
+}
+
+// Copy count items of size bytes into fresh memory of capacity items
+static void* own_array(const void* from, size_t size, int count, int capacity) {
+    if (from == NULL) return NULL;
+    void* to = aligned_alloc(PARTICLE_ALIGNMENT,
+        ((size_t)(capacity > 0 ? capacity : 1) * size + PARTICLE_ALIGNMENT - 1) & ~(size_t)(PARTICLE_ALIGNMENT - 1));
+    if (to == NULL) {
+        perror("Memory allocation error");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(to, from, (size_t)count * size);
+    return to;
+}
+
+// Move a borrowed tree into memory of its own at the same capacities, so it
+// can grow. The caller's arrays are left as they are.
+void own_flat_tree(FlatTree* tree) {
+    if (!tree->borrowed) return;
+
+    int slots = tree->particle_capacity;
+    tree->nodes = (FlatNode*)own_array(tree->nodes, sizeof(FlatNode), tree->count, tree->capacity);
+    tree->order = (int*)own_array(tree->order, sizeof(int), slots, slots);
+    tree->x_pos = (double*)own_array(tree->x_pos, sizeof(double), slots, slots);
+    tree->y_pos = (double*)own_array(tree->y_pos, sizeof(double), slots, slots);
+    tree->mass = (double*)own_array(tree->mass, sizeof(double), slots, slots);
+    tree->qxx = (double*)own_array(tree->qxx, sizeof(double), tree->moment_capacity, tree->moment_capacity);
+    tree->qxy = (double*)own_array(tree->qxy, sizeof(double), tree->moment_capacity, tree->moment_capacity);
+    tree->qyy = (double*)own_array(tree->qyy, sizeof(double), tree->moment_capacity, tree->moment_capacity);
+    tree->single_nodes = (SingleNode*)own_array(tree->single_nodes, sizeof(SingleNode), tree->single_capacity,
+                                                tree->single_capacity);
+    int single_slots = tree->single_particle_capacity;
+    tree->x_offset = (float*)own_array(tree->x_offset, sizeof(float), single_slots, single_slots);
+    tree->y_offset = (float*)own_array(tree->y_offset, sizeof(float), single_slots, single_slots);
+    tree->single_mass = (float*)own_array(tree->single_mass, sizeof(float), single_slots, single_slots);
+    tree->borrowed = 0;
+}
+
+// Append an uninitialized node, growing the array when it is full
+FlatNode* append_flat_node(FlatTree* tree) {
+    if (tree->count == tree->capacity) {
+        own_flat_tree(tree);
+        tree->capacity *= 2;
+        tree->nodes = (FlatNode*)realloc(tree->nodes, tree->capacity * sizeof(FlatNode));
+        if (tree->nodes == NULL) {
+            perror("Memory allocation error");
+            exit(EXIT_FAILURE);
+        }
+    }
+    return &tree->nodes[tree->count++];
+}
+
+// Make room for count nodes in total
+void reserve_flat_nodes(FlatTree* tree, int count) {
+    if (count <= tree->capacity) return;
+
+    own_flat_tree(tree);
+    while (tree->capacity < count) tree->capacity *= 2;
+    tree->nodes = (FlatNode*)realloc(tree->nodes, tree->capacity * sizeof(FlatNode));
+    if (tree->nodes == NULL) {
+        perror("Memory allocation error");
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Make room for count particles in tree order
+void reserve_tree_particles(FlatTree* tree, int count) {
+    if (count <= tree->particle_capacity && tree->order != NULL) return;
+
+    own_flat_tree(tree);
+    tree->particle_capacity = count > tree->particle_capacity ? count : tree->particle_capacity;
+    free(tree->order);
+    free(tree->x_pos);
+    free(tree->y_pos);
+    free(tree->mass);
+    tree->order = (int*)malloc((tree->particle_capacity > 0 ? tree->particle_capacity : 1) * sizeof(int));
+    if (tree->order == NULL) {
+        perror("Memory allocation error");
+        exit(EXIT_FAILURE);
+    }
+    tree->x_pos = create_particle_column(tree->particle_capacity);
+    tree->y_pos = create_particle_column(tree->particle_capacity);
+    tree->mass = create_particle_column(tree->particle_capacity);
+}
+
+// Copy positions and masses into tree order so leaf buckets are contiguous
+void gather_tree_particles(FlatTree* tree, const ParticleSoA* particles) {
+    for (int s = 0; s < tree->particle_count; s++) {
+        int p = tree->order[s];
+        tree->x_pos[s] = particles->x_pos[p];
+        tree->y_pos[s] = particles->y_pos[p];
+        tree->mass[s] = particles->mass[p];
+    }
+}
+
+// Emit a subtree in preorder, skipping empty cells
+static void flatten_node(BHTreeNode* node, FlatTree* tree) {
+    if (node == NULL || node->count == 0) return;
+
+    int index = tree->count;
+    FlatNode* flat = append_flat_node(tree);
+    flat->x_com = node->center_mass.x_pos;
+    flat->y_com = node->center_mass.y_pos;
+    flat->mass = node->total_mass;
+    flat->size = node->boundary.size;
+
+    int first = tree->particle_count;
+    if (!node->is_sub_divided) {
+        for (int b = 0; b < node->count; b++) {
+            tree->order[tree->particle_count++] = node->particles[b];
+        }
+    } else {
+        flatten_node(node->NW, tree);
+        flatten_node(node->NE, tree);
+        flatten_node(node->SW, tree);
+        flatten_node(node->SE, tree);
+    }
+
+    // The array may have moved while the children were appended
+    tree->nodes[index].next = tree->count;
+    tree->nodes[index].first = first;
+    tree->nodes[index].count = tree->particle_count - first;
+}
+
+// Copy a pointer quadtree into the flat array and lay its particles out in
+// tree order
+void flatten_tree(BHTreeNode* root, const ParticleSoA* particles, FlatTree* tree) {
+    reserve_tree_particles(tree, particles->count);
+    tree->count = 0;
+    tree->particle_count = 0;
+    flatten_node(root, tree);
+    gather_tree_particles(tree, particles);
+}
+
+// Fill in the quadrupole moments of every node with a sweep from the last node
+// back to the root. Leaves sum their bucket about the center of mass, internal
+// nodes shift their children's moments to their own center of mass. The
+// moments are those of the 3D potential with every particle at z = 0:
+// Q = sum m (3 r r^T - |r|^2 I), restricted to the plane.
+void compute_tree_moments(FlatTree* tree) {
+    if (tree->count > tree->moment_capacity) {
+        own_flat_tree(tree);
+        tree->moment_capacity = tree->capacity;
+        free(tree->qxx);
+        free(tree->qxy);
+        free(tree->qyy);
+        tree->qxx = create_particle_column(tree->moment_capacity);
+        tree->qxy = create_particle_column(tree->moment_capacity);
+        tree->qyy = create_particle_column(tree->moment_capacity);
+    }
+
+    for (int i = tree->count - 1; i >= 0; i--) {
+        const FlatNode* node = &tree->nodes[i];
+        double qxx = 0.0;
+        double qxy = 0.0;
+        double qyy = 0.0;
+
+        if (node->next == i + 1) {
+            for (int s = node->first; s < node->first + node->count; s++) {
+                double dx = tree->x_pos[s] - node->x_com;
+                double dy = tree->y_pos[s] - node->y_com;
+                double r2 = (dx * dx) + (dy * dy);
+                qxx += tree->mass[s] * (3.0 * dx * dx - r2);
+                qxy += tree->mass[s] * (3.0 * dx * dy);
+                qyy += tree->mass[s] * (3.0 * dy * dy - r2);
+            }
+        } else {
+            for (int c = i + 1; c < node->next; c = tree->nodes[c].next) {
+                const FlatNode* child = &tree->nodes[c];
+                double dx = child->x_com - node->x_com;
+                double dy = child->y_com - node->y_com;
+                double r2 = (dx * dx) + (dy * dy);
+                qxx += tree->qxx[c] + child->mass * (3.0 * dx * dx - r2);
+                qxy += tree->qxy[c] + child->mass * (3.0 * dx * dy);
+                qyy += tree->qyy[c] + child->mass * (3.0 * dy * dy - r2);
+            }
+        }
+
+        tree->qxx[i] = qxx;
+        tree->qxy[i] = qxy;
+        tree->qyy[i] = qyy;
+    }
+}
+
+// Allocate one aligned column of floats
+static float* create_single_column(int count) {
+    size_t bytes = (size_t)(count > 0 ? count : 1) * sizeof(float);
+    bytes = (bytes + PARTICLE_ALIGNMENT - 1) & ~(size_t)(PARTICLE_ALIGNMENT - 1);
+
+    float* column = (float*)aligned_alloc(PARTICLE_ALIGNMENT, bytes);
+    if (column == NULL) {
+        perror("Memory allocation error");
+        exit(EXIT_FAILURE);
+    }
+    return column;
+}
+
+// Fill in the single precision copy of the nodes, and the slot positions as
+// offsets from the rounded center of mass of their leaf
+void compute_single_nodes(FlatTree* tree) {
+    if (tree->count > tree->single_capacity) {
+        own_flat_tree(tree);
+        tree->single_capacity = tree->capacity;
+        free(tree->single_nodes);
+        tree->single_nodes = (SingleNode*)aligned_alloc(PARTICLE_ALIGNMENT,
+            ((size_t)tree->single_capacity * sizeof(SingleNode) + PARTICLE_ALIGNMENT - 1) & ~(size_t)(PARTICLE_ALIGNMENT - 1));
+        if (tree->single_nodes == NULL) {
+            perror("Memory allocation error");
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (tree->particle_count > tree->single_particle_capacity) {
+        own_flat_tree(tree);
+        tree->single_particle_capacity = tree->particle_capacity;
+        free(tree->x_offset);
+        free(tree->y_offset);
+        free(tree->single_mass);
+        tree->x_offset = create_single_column(tree->single_particle_capacity);
+        tree->y_offset = create_single_column(tree->single_particle_capacity);
+        tree->single_mass = create_single_column(tree->single_particle_capacity);
+    }
+
+    for (int i = 0; i < tree->count; i++) {
+        const FlatNode* node = &tree->nodes[i];
+        SingleNode* single = &tree->single_nodes[i];
+        single->x_com = (float)node->x_com;
+        single->y_com = (float)node->y_com;
+        single->mass = (float)node->mass;
+        single->size = (float)node->size;
+        single->next = node->next;
+        single->first = node->first;
+        single->count = node->count;
+        single->padding = 0;
+
+        if (node->next != i + 1) continue;
+        for (int s = node->first; s < node->first + node->count; s++) {
+            tree->x_offset[s] = (float)(tree->x_pos[s] - (double)single->x_com);
+            tree->y_offset[s] = (float)(tree->y_pos[s] - (double)single->y_com);
+            tree->single_mass[s] = (float)tree->mass[s];
+        }
+    }
+}
+
+// Mixed precision version of compute_force_flat below. Offsets from the
+// target are taken in double and rounded, distances, the MAC and each
+// interaction are evaluated in float with a reciprocal square root, and the
+// force is summed in double.
+static int compute_force_single(const FlatTree* tree, ParticleSoA* particles, int index, double theta) {
+    double mass = particles->mass[index];
+
+    // Do not account for this lost particle
+    if (mass < 0) {
+        return 0;
+    }
+
+    const SingleNode* nodes = tree->single_nodes;
+    int count = tree->count;
+    double x_pos = particles->x_pos[index];
+    double y_pos = particles->y_pos[index];
+    double x_force = particles->x_force[index];
+    double y_force = particles->y_force[index];
+    float gm = (float)(G * mass);
+    float single_theta = (float)theta;
+    int interactions = 0;
+#ifdef NBODY_STATS
+    int cells = 0;
+#endif
+
+    int i = 0;
+    while (i < count) {
+        const SingleNode* node = &nodes[i];
+
+        float dx = (float)((double)node->x_com - x_pos);
+        float dy = (float)((double)node->y_com - y_pos);
+        float r2 = (dx * dx) + (dy * dy);
+
+        // Ensure that the distance is no less than the RLIMIT to prevent infinite forces
+        float inverse = single_inverse_sqrt(r2 > (float)(RLIMIT * RLIMIT) ? r2 : (float)(RLIMIT * RLIMIT));
+
+        int is_leaf = node->next == i + 1;
+        int accepted = (node->size * inverse) < single_theta;
+        if (is_leaf && !(node->count > 1 && accepted)) {
+            leaf_kernel_single(tree->x_offset + node->first, tree->y_offset + node->first,
+                               tree->single_mass + node->first, node->count, dx, dy, gm, &x_force, &y_force);
+            interactions += node->count;
+            i = node->next;
+        } else if (is_leaf || accepted) {
+            float scale = gm * node->mass * (inverse * inverse * inverse);
+            x_force += (double)(scale * dx);
+            y_force += (double)(scale * dy);
+            if (tree->quadrupoles) {
+                quadrupole_force(-(double)dx, -(double)dy, 1.0 / (double)inverse,
+                                 tree->qxx[i], tree->qxy[i], tree->qyy[i], mass, &x_force, &y_force);
+            }
+            interactions += 1;
+#ifdef NBODY_STATS
+            cells += 1;
+#endif
+            i = node->next;
+        } else {
+            i += 1;
+        }
+    }
+
+    particles->x_force[index] = x_force;
+    particles->y_force[index] = y_force;
+    STATS_INTERACTIONS(thread_pool_index(), cells, interactions - cells);
+    return interactions;
+}
+
+// Compute the force on particle index with an iterative walk: accepted cells
+// and leaves jump over their subtree, opened cells fall through to their first
+// child. Leaf buckets are summed with the vectorized leaf kernel unless the
+// whole bucket passes the MAC. Single particle leaves reproduce compute_force.
+// Returns the number of interactions (cells plus particles) summed.
+int compute_force_flat(const FlatTree* tree, ParticleSoA* particles, int index, double theta) {
+    if (tree->single_precision) return compute_force_single(tree, particles, index, theta);
+
+    double mass = particles->mass[index];
+
+    // Do not account for this lost particle
+    if (mass < 0) {
+        return 0;
+    }
+
+    const FlatNode* nodes = tree->nodes;
+    int count = tree->count;
+    double x_pos = particles->x_pos[index];
+    double y_pos = particles->y_pos[index];
+    double x_force = particles->x_force[index];
+    double y_force = particles->y_force[index];
+    int interactions = 0;
+#ifdef NBODY_STATS
+    int cells = 0;
+#endif
+
+    int i = 0;
+    while (i < count) {
+        const FlatNode* node = &nodes[i];
+
+        double dx = node->x_com - x_pos;
+        double dy = node->y_com - y_pos;
+
+        double distance = sqrt((dx * dx) + (dy * dy));
+
+        // Ensure that the distance is no less than the RLIMIT to prevent infinite forces
+        if (distance < RLIMIT) {
+            distance = RLIMIT;
+        }
+
+        int is_leaf = node->next == i + 1;
+        if (is_leaf && !(node->count > 1 && (node->size / distance) < theta)) {
+            leaf_kernel(tree->x_pos + node->first, tree->y_pos + node->first, tree->mass + node->first,
+                        node->count, x_pos, y_pos, mass, &x_force, &y_force);
+            interactions += node->count;
+            i = node->next;
+        } else if (is_leaf || (node->size / distance) < theta) {
+            x_force += (G * node->mass * mass * dx) / (distance * distance * distance);
+            y_force += (G * node->mass * mass * dy) / (distance * distance * distance);
+            if (tree->quadrupoles) {
+                quadrupole_force(-dx, -dy, distance, tree->qxx[i], tree->qxy[i], tree->qyy[i], mass, &x_force, &y_force);
+            }
+            interactions += 1;
+#ifdef NBODY_STATS
+            cells += 1;
+#endif
+            i = node->next;
+        } else {
+            i += 1;
+        }
+    }
+
+    particles->x_force[index] = x_force;
+    particles->y_force[index] = y_force;
+    STATS_INTERACTIONS(thread_pool_index(), cells, interactions - cells);
+    return interactions;
+}
+
+void destroy_flat_tree(FlatTree* tree) {
+    if (tree == NULL) return;
+    free(tree->nodes);
+    free(tree->order);
+    free(tree->x_pos);
+    free(tree->y_pos);
+    free(tree->mass);
+    free(tree->qxx);
+    free(tree->qxy);
+    free(tree->qyy);
+    free(tree->single_nodes);
+    free(tree->x_offset);
+    free(tree->y_offset);
+    free(tree->single_mass);
+    free(tree);
+}
@@ -0,0 +1,85 @@
+#ifndef FLAT_TREE_H
+#define FLAT_TREE_H
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "particle.h"
+#include "tree.h"
+
+// Compact quadtree node. Nodes are stored in depth first (preorder) order, so
+// the children of an internal node start right after it and the whole subtree
+// is skipped by jumping to next. A node is a leaf when next is its own index
+// plus one.
+typedef struct {
+    double x_com;  // Center of mass X position
+    double y_com;  // Center of mass Y position
+    double mass;   // Total mass of the subtree
+    double size;   // Full length of one side of the cell
+    int next;      // Index of the first node after this subtree
+    int first;     // First tree slot of the subtree's particles
+    int count;     // Number of particles in the subtree
+} FlatNode;
+
+// Single precision copy of a node for the mixed precision walk, two thirds of
+// the size of a FlatNode. The center of mass is rounded to float; the walk
+// takes its offset from the target in double and only then rounds it, so the
+// offsets keep full float precision relative to their own length.
+typedef struct {
+    float x_com;
+    float y_com;
+    float mass;
+    float size;
+    int next;
+    int first;
+    int count;
+    int padding;
+} SingleNode;
+
+// Contiguous node array plus the particles in tree order, so every subtree
+// (and in particular every leaf bucket) is one contiguous run of slots. The
+// storage is kept between steps and reused.
+typedef struct {
+    int borrowed;       // Arrays belong to the caller until the tree has to grow
+
+    FlatNode* nodes;
+    int count;
+    int capacity;
+
+    int* order;         // Particle index of each tree slot
+    double* x_pos;      // X position of each tree slot
+    double* y_pos;      // Y position of each tree slot
+    double* mass;       // Mass of each tree slot
+    int particle_count;
+    int particle_capacity;
+
+    int quadrupoles;    // Add quadrupole terms for accepted cells
+    double* qxx;        // Quadrupole moment of each node about its center of mass
+    double* qxy;
+    double* qyy;
+    int moment_capacity;
+
+    int single_precision; // Walk the single precision copy below
+    SingleNode* single_nodes;
+    float* x_offset;      // Slot position relative to its leaf's rounded center of mass
+    float* y_offset;
+    float* single_mass;
+    int single_capacity;
+    int single_particle_capacity;
+} FlatTree;
+
+FlatTree* create_flat_tree(int capacity);
+void own_flat_tree(FlatTree* tree);
+FlatNode* append_flat_node(FlatTree* tree);
+void reserve_flat_nodes(FlatTree* tree, int count);
+void reserve_tree_particles(FlatTree* tree, int count);
+void gather_tree_particles(FlatTree* tree, const ParticleSoA* particles);
+void flatten_tree(BHTreeNode* root, const ParticleSoA* particles, FlatTree* tree);
+void compute_tree_moments(FlatTree* tree);
+void compute_single_nodes(FlatTree* tree);
+int compute_force_flat(const FlatTree* tree, ParticleSoA* particles, int index, double theta);
+void destroy_flat_tree(FlatTree* tree);
+
+#endif // FLAT_TREE_H
@@ -0,0 +1,126 @@
+#include "force.h"
+#include "stats.h"
+
+// Add the imported remote bodies to the force on particle p, returns how many
+static int add_remote_force(ForcePass* pass, int p) {
+    ParticleSoA* particles = pass->particles;
+    if (pass->remote != NULL && particles->mass[p] >= 0) {
+        evaluate_interaction_list(pass->remote, particles->x_pos[p], particles->y_pos[p], particles->mass[p],
+                                  &particles->x_force[p], &particles->y_force[p]);
+        STATS_REMOTE(thread_pool_index(), pass->remote->count + pass->remote->cell_count);
+        return pass->remote->count + pass->remote->cell_count;
+    }
+    return 0;
+}
+
+// Work done for particle p this step, the interactions plus one for the
+// update. The cost-zone partition of the next step is cut from these.
+static void record_cost(ForcePass* pass, int p, int interactions) {
+    pass->particles->cost[p] = (float)(interactions + 1);
+}
+
+// Let the library progress the overlapped exchange, only the calling thread
+// may make MPI calls
+static void progress_overlap(ForcePass* pass) {
+    if (pass->overlap && thread_pool_index() == 0) test_overlap(pass->overlap);
+}
+
+// Each particle's force only reads the tree's copy of the positions, so a
+// particle can be advanced as soon as its own force is known. The local stage
+// keeps its interaction count in cost for the finish stage.
+static void force_range(void* context, int first, int last) {
+    ForcePass* pass = (ForcePass*)context;
+    ParticleSoA* particles = pass->particles;
+
+    for (int p = first; p < last; p++) {
+        int interactions;
+        if (pass->stage == FORCE_FINISH) {
+            interactions = (int)particles->cost[p];
+        } else {
+            // Reset particle force components
+            particles->x_force[p] = 0.0;
+            particles->y_force[p] = 0.0;
+
+            // Compute new forces
+            interactions = compute_force_flat(pass->tree, particles, p, pass->theta);
+        }
+        if (pass->stage == FORCE_LOCAL) {
+            particles->cost[p] = (float)interactions;
+            continue;
+        }
+        interactions += add_remote_force(pass, p);
+        record_cost(pass, p, interactions);
+    }
+
+    if (pass->stage != FORCE_LOCAL) {
+        STATS_UPDATE_BEGIN();
+        update_particles(particles, first, last, pass->time_step, DEFAULT_BOUNDARY_SIZE);
+        STATS_UPDATE_END(thread_pool_index());
+    }
+    progress_overlap(pass);
+}
+
+void run_force_pass(ThreadPool* pool, ForcePass* pass, int first, int last) {
+    parallel_for(pool, first, last, THREAD_CHUNK_SIZE, force_range, pass);
+}
+
+// Same walk for the particles in tree slots [first, last)
+static void slot_range(void* context, int first, int last) {
+    ForcePass* pass = (ForcePass*)context;
+    for (int s = first; s < last; s++) {
+        int p = pass->tree->order[s];
+        force_range(pass, p, p + 1);
+    }
+}
+
+void run_slot_pass(ThreadPool* pool, ForcePass* pass, int first, int last) {
+    parallel_for(pool, first, last, THREAD_CHUNK_SIZE, slot_range, pass);
+}
+
+// Build one interaction list per group and evaluate it for every member
+static void group_range(void* context, int first, int last) {
+    ForcePass* pass = (ForcePass*)context;
+    ParticleSoA* particles = pass->particles;
+    const FlatTree* tree = pass->tree;
+    InteractionList* list = pass->lists[thread_pool_index()];
+
+    for (int g = first; g < last; g++) {
+        const FlatNode* group = &tree->nodes[pass->groups->nodes[g]];
+        build_interaction_list(tree, pass->groups->nodes[g], pass->theta, list);
+
+        for (int s = group->first; s < group->first + group->count; s++) {
+            int p = tree->order[s];
+            particles->x_force[p] = 0.0;
+            particles->y_force[p] = 0.0;
+            evaluate_interaction_list(list, particles->x_pos[p], particles->y_pos[p], particles->mass[p],
+                                      &particles->x_force[p], &particles->y_force[p]);
+            int interactions = 0;
+            if (particles->mass[p] >= 0) {
+                interactions = list->count + list->cell_count;
+                STATS_INTERACTIONS(thread_pool_index(), list->accepted, interactions - list->accepted);
+            }
+            if (pass->stage == FORCE_LOCAL) {
+                particles->cost[p] = (float)interactions;
+                continue;
+            }
+            interactions += add_remote_force(pass, p);
+            record_cost(pass, p, interactions);
+
+            STATS_UPDATE_BEGIN();
+            update_particles(particles, p, p + 1, pass->time_step, DEFAULT_BOUNDARY_SIZE);
+            STATS_UPDATE_END(thread_pool_index());
+        }
+        progress_overlap(pass);
+    }
+}
+
+void run_group_pass(ThreadPool* pool, ForcePass* pass, int first, int last) {
+    parallel_for(pool, first, last, 1, group_range, pass);
+}
+
+void run_untreed_pass(ForcePass* pass) {
+    for (int u = 0; u < pass->groups->untreed_count; u++) {
+        int p = pass->groups->untreed[u];
+        force_range(pass, p, p + 1);
+    }
+}
@@ -0,0 +1,47 @@
+#ifndef FORCE_H
+#define FORCE_H
+
+#include "flat_tree.h"
+#include "group.h"
+#include "kernel.h"
+#include "particle.h"
+#include "threads.h"
+#include "timing.h"
+#include "tree.h"
+
+// Stages of a pass. The local stage walks the tree while the remote bodies
+// are still on their way, the finish stage adds them and advances the
+// particles. Together they give the same forces as a whole pass.
+#define FORCE_WHOLE  0 // Tree walk, remote bodies and update
+#define FORCE_LOCAL  1 // Tree walk only
+#define FORCE_FINISH 2 // Remote bodies and update, after the local stage
+
+// Everything one step's force and update phase reads. The tree and the remote
+// bodies are read-only while the pass runs, so threads can share them.
+typedef struct {
+    const FlatTree* tree;      // Tree of the particles being walked
+    ParticleSoA* particles;    // Targets, updated in place
+    double theta;              // MAC threshold
+    double time_step;          // Time step (dt)
+    const InteractionList* remote; // Imported bodies summed directly, may be NULL
+    const GroupSet* groups;    // Groups for the grouped walk, may be NULL
+    InteractionList** lists;   // One interaction list per pool thread
+    int stage;                 // FORCE_WHOLE unless split around an exchange
+    Overlap* overlap;          // Exchange tested between chunks, may be NULL
+} ForcePass;
+
+// Compute forces on particles [first, last) and advance them, spread over the
+// threads of the pool
+void run_force_pass(ThreadPool* pool, ForcePass* pass, int first, int last);
+
+// Same for the particles in tree slots [first, last), for a partition cut
+// along the tree order
+void run_slot_pass(ThreadPool* pool, ForcePass* pass, int first, int last);
+
+// Same for the members of groups [first, last), each group sharing one walk
+void run_group_pass(ThreadPool* pool, ForcePass* pass, int first, int last);
+
+// Walk the particles left out of the tree one by one
+void run_untreed_pass(ForcePass* pass);
+
+#endif // FORCE_H
@@ -0,0 +1,295 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "frames.h"
+
+static uint64_t align_up(uint64_t bytes) {
+    return (bytes + FRAME_ALIGNMENT - 1) / FRAME_ALIGNMENT * FRAME_ALIGNMENT;
+}
+
+static uint64_t column_bytes(int particle_capacity, int node_capacity, int column) {
+    if (column == 0) return (uint64_t)particle_capacity * sizeof(int32_t);
+    if (column <= 2) return (uint64_t)particle_capacity * sizeof(double);
+    if (column <= 6) return (uint64_t)node_capacity * sizeof(double);
+    return (uint64_t)node_capacity * sizeof(int32_t);
+}
+
+// Byte offset of a column from the start of its slot, FRAME_COLUMNS gives the slot size
+uint64_t frame_column_offset(int particle_capacity, int node_capacity, int column) {
+    uint64_t offset = align_up(sizeof(FrameSlotHeader));
+    for (int c = 0; c < column; c++) {
+        offset += align_up(column_bytes(particle_capacity, node_capacity, c));
+    }
+    return offset;
+}
+
+static unsigned char* slot_base(const FrameRingHeader* header, uint64_t frame) {
+    unsigned char* base = (unsigned char*)header + align_up(sizeof(FrameRingHeader));
+    return base + ((frame - 1) % header->slot_count) * header->slot_size;
+}
+
+static void* slot_column(const FrameRingHeader* header, unsigned char* slot, int column) {
+    return slot + frame_column_offset(header->particle_capacity, header->node_capacity, column);
+}
+
+FrameRing* create_frame_ring(const char* name, int particle_capacity, int node_capacity) {
+    FrameRing* ring = (FrameRing*)calloc(1, sizeof(FrameRing));
+    if (!ring) {
+        perror("Memory allocation error");
+        exit(EXIT_FAILURE);
+    }
+    snprintf(ring->name, sizeof(ring->name), "%s", name);
+
+    uint64_t slot_size = frame_column_offset(particle_capacity, node_capacity, FRAME_COLUMNS);
+    ring->size = align_up(sizeof(FrameRingHeader)) + FRAME_SLOTS * slot_size;
+
+    // Start from a fresh segment, a viewer still attached to an old one keeps its mapping
+    shm_unlink(ring->name);
+    int fd = shm_open(ring->name, O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (fd < 0) {
+        perror("Error creating frame ring");
+        exit(EXIT_FAILURE);
+    }
+    if (ftruncate(fd, ring->size) != 0) {
+        perror("Error sizing frame ring");
+        exit(EXIT_FAILURE);
+    }
+    void* data = mmap(NULL, ring->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        perror("Error mapping frame ring");
+        exit(EXIT_FAILURE);
+    }
+
+    // The segment starts zeroed, so every slot reads as never written
+    ring->base = (unsigned char*)data;
+    ring->header = (FrameRingHeader*)data;
+    ring->header->version = FRAME_VERSION;
+    ring->header->slot_count = FRAME_SLOTS;
+    ring->header->particle_capacity = particle_capacity;
+    ring->header->node_capacity = node_capacity;
+    ring->header->slot_size = slot_size;
+    atomic_store(&ring->header->published, 0);
+    atomic_store(&ring->header->finished, 0);
+    atomic_store(&ring->header->replaced, 0);
+
+    // Readers check the magic last, after everything else is in place
+    atomic_thread_fence(memory_order_release);
+    memcpy(ring->header->magic, FRAME_MAGIC, sizeof(ring->header->magic));
+
+    ring->frame = 1;
+    return ring;
+}
+
+// Ring of one publishing rank, named FRAME_RING_PREFIX.<rank>. Trees rarely
+// need more than three nodes per particle, larger ones are published without nodes.
+FrameRing* create_rank_frame_ring(int rank, int visualization_flag, int particle_capacity) {
+    char name[64];
+    snprintf(name, sizeof(name), "%s.%d", FRAME_RING_PREFIX, rank);
+    int node_capacity = visualization_flag == FRAMES_NODES ? 3 * particle_capacity + 1 : 0;
+    return create_frame_ring(name, particle_capacity, node_capacity);
+}
+
+// Make room for particle_count particles, for rings whose publisher holds a
+// changing share of the particles. A full ring is replaced by one of the same
+// name with a quarter to spare, frame numbers carry on and a viewer still on
+// the old segment sees it marked replaced and reopens the name.
+FrameRing* reserve_frame_ring(FrameRing* ring, int particle_count) {
+    if (particle_count <= ring->header->particle_capacity) return ring;
+
+    int particle_capacity = particle_count + particle_count / 4;
+    int node_capacity = ring->header->node_capacity > 0 ? 3 * particle_capacity + 1 : 0;
+    FrameRing* grown = create_frame_ring(ring->name, particle_capacity, node_capacity);
+    grown->frame = ring->frame;
+
+    atomic_store_explicit(&ring->header->replaced, 1, memory_order_release);
+    munmap(ring->base, ring->size);
+    free(ring);
+    return grown;
+}
+
+// Tight bounds of every node, children before parents by walking the preorder
+// array backwards. A leaf covers its bucket, an inner node its children.
+static void write_node_bounds(const FlatTree* tree, int node_count, double* x_min, double* y_min,
+                              double* x_max, double* y_max, int32_t* particles) {
+    for (int i = node_count - 1; i >= 0; i--) {
+        const FlatNode* node = &tree->nodes[i];
+        particles[i] = node->count;
+
+        if (node->next == i + 1) {
+            x_min[i] = x_max[i] = node->x_com;
+            y_min[i] = y_max[i] = node->y_com;
+            for (int s = node->first; s < node->first + node->count; s++) {
+                if (tree->x_pos[s] < x_min[i]) x_min[i] = tree->x_pos[s];
+                if (tree->x_pos[s] > x_max[i]) x_max[i] = tree->x_pos[s];
+                if (tree->y_pos[s] < y_min[i]) y_min[i] = tree->y_pos[s];
+                if (tree->y_pos[s] > y_max[i]) y_max[i] = tree->y_pos[s];
+            }
+            continue;
+        }
+
+        x_min[i] = x_min[i + 1];
+        y_min[i] = y_min[i + 1];
+        x_max[i] = x_max[i + 1];
+        y_max[i] = y_max[i + 1];
+        for (int c = tree->nodes[i + 1].next; c < node->next; c = tree->nodes[c].next) {
+            if (x_min[c] < x_min[i]) x_min[i] = x_min[c];
+            if (x_max[c] > x_max[i]) x_max[i] = x_max[c];
+            if (y_min[c] < y_min[i]) y_min[i] = y_min[c];
+            if (y_max[c] > y_max[i]) y_max[i] = y_max[c];
+        }
+    }
+}
+
+// Copy the particle positions, and the node bounds when the ring has room for
+// them, into the next slot. Never blocks: a reader still copying this slot sees
+// the sequence change and drops its copy.
+void publish_frame(FrameRing* ring, int step, double time, const ParticleSoA* soa, const FlatTree* tree) {
+    FrameRingHeader* header = ring->header;
+    unsigned char* slot = slot_base(header, ring->frame);
+    FrameSlotHeader* slot_header = (FrameSlotHeader*)slot;
+
+    atomic_store_explicit(&slot_header->sequence, 2 * ring->frame - 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    int particle_count = soa->count < header->particle_capacity ? soa->count : header->particle_capacity;
+    memcpy(slot_column(header, slot, 0), soa->index, particle_count * sizeof(int32_t));
+    memcpy(slot_column(header, slot, 1), soa->x_pos, particle_count * sizeof(double));
+    memcpy(slot_column(header, slot, 2), soa->y_pos, particle_count * sizeof(double));
+
+    // Node bounds are all or nothing, a partial preorder array is of no use
+    int node_count = 0;
+    if (tree && tree->count <= header->node_capacity) {
+        node_count = tree->count;
+        write_node_bounds(tree, node_count, slot_column(header, slot, 3), slot_column(header, slot, 4),
+                          slot_column(header, slot, 5), slot_column(header, slot, 6),
+                          slot_column(header, slot, 7));
+    }
+
+    slot_header->step = step;
+    slot_header->time = time;
+    slot_header->particle_count = particle_count;
+    slot_header->node_count = node_count;
+
+    atomic_store_explicit(&slot_header->sequence, 2 * ring->frame, memory_order_release);
+    atomic_store_explicit(&header->published, ring->frame, memory_order_release);
+    ring->frame += 1;
+}
+
+// Mark the run as over and drop the local mapping. The segment itself stays
+// so a viewer can still pick up the last frames, the next run replaces it.
+void destroy_frame_ring(FrameRing* ring) {
+    if (!ring) return;
+    atomic_store_explicit(&ring->header->finished, 1, memory_order_release);
+    munmap(ring->base, ring->size);
+    free(ring);
+}
+
+// Map an existing ring read-only, returns NULL while it does not exist yet
+const FrameRingHeader* open_frame_ring(const char* name, size_t* size) {
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) return NULL;
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(FrameRingHeader)) {
+        close(fd);
+        return NULL;
+    }
+    void* data = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return NULL;
+
+    const FrameRingHeader* header = (const FrameRingHeader*)data;
+    if (memcmp(header->magic, FRAME_MAGIC, sizeof(header->magic)) != 0 || header->version != FRAME_VERSION) {
+        munmap(data, info.st_size);
+        return NULL;
+    }
+    atomic_thread_fence(memory_order_acquire);
+
+    *size = info.st_size;
+    return header;
+}
+
+void close_frame_ring(const FrameRingHeader* header, size_t size) {
+    munmap((void*)header, size);
+}
+
+static void* create_frame_column(size_t bytes) {
+    void* column = malloc(bytes > 0 ? bytes : 1);
+    if (!column) {
+        perror("Memory allocation error");
+        exit(EXIT_FAILURE);
+    }
+    return column;
+}
+
+Frame* create_frame(const FrameRingHeader* header) {
+    Frame* frame = (Frame*)calloc(1, sizeof(Frame));
+    if (!frame) {
+        perror("Memory allocation error");
+        exit(EXIT_FAILURE);
+    }
+
+    size_t particles = header->particle_capacity;
+    size_t nodes = header->node_capacity;
+    frame->index = (int32_t*)create_frame_column(particles * sizeof(int32_t));
+    frame->x_pos = (double*)create_frame_column(particles * sizeof(double));
+    frame->y_pos = (double*)create_frame_column(particles * sizeof(double));
+    frame->x_min = (double*)create_frame_column(nodes * sizeof(double));
+    frame->y_min = (double*)create_frame_column(nodes * sizeof(double));
+    frame->x_max = (double*)create_frame_column(nodes * sizeof(double));
+    frame->y_max = (double*)create_frame_column(nodes * sizeof(double));
+    frame->node_particles = (int32_t*)create_frame_column(nodes * sizeof(int32_t));
+    return frame;
+}
+
+// Copy the newest complete frame. Returns 1 when a frame newer than the one
+// already held was copied, 0 when there is nothing new.
+int read_latest_frame(const FrameRingHeader* header, Frame* frame) {
+    for (;;) {
+        uint64_t latest = atomic_load_explicit(&header->published, memory_order_acquire);
+        if (latest == 0 || latest == frame->frame) return 0;
+
+        unsigned char* slot = slot_base(header, latest);
+        FrameSlotHeader* slot_header = (FrameSlotHeader*)slot;
+        uint64_t before = atomic_load_explicit(&slot_header->sequence, memory_order_acquire);
+        if (before != 2 * latest) continue;
+
+        int particle_count = slot_header->particle_count;
+        int node_count = slot_header->node_count;
+        frame->step = slot_header->step;
+        frame->time = slot_header->time;
+        memcpy(frame->index, slot_column(header, slot, 0), particle_count * sizeof(int32_t));
+        memcpy(frame->x_pos, slot_column(header, slot, 1), particle_count * sizeof(double));
+        memcpy(frame->y_pos, slot_column(header, slot, 2), particle_count * sizeof(double));
+        memcpy(frame->x_min, slot_column(header, slot, 3), node_count * sizeof(double));
+        memcpy(frame->y_min, slot_column(header, slot, 4), node_count * sizeof(double));
+        memcpy(frame->x_max, slot_column(header, slot, 5), node_count * sizeof(double));
+        memcpy(frame->y_max, slot_column(header, slot, 6), node_count * sizeof(double));
+        memcpy(frame->node_particles, slot_column(header, slot, 7), node_count * sizeof(int32_t));
+
+        // The writer lapped us while copying, try again with its newer frame
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&slot_header->sequence, memory_order_relaxed) != before) continue;
+
+        frame->frame = latest;
+        frame->particle_count = particle_count;
+        frame->node_count = node_count;
+        return 1;
+    }
+}
+
+void destroy_frame(Frame* frame) {
+    if (!frame) return;
+    free(frame->index);
+    free(frame->x_pos);
+    free(frame->y_pos);
+    free(frame->x_min);
+    free(frame->y_min);
+    free(frame->x_max);
+    free(frame->y_max);
+    free(frame->node_particles);
+    free(frame);
+}
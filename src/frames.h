@@ -0,0 +1,98 @@
+#ifndef FRAMES_H
+#define FRAMES_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "flat_tree.h"
+#include "particle.h"
+
+// Per-step frames published for viewers on the same machine through a POSIX
+// shared memory ring. The writer never waits for readers: every frame goes to
+// the next slot, overwriting whatever a slow reader has not picked up yet.
+// Each slot is guarded by a sequence number that is odd while the slot is
+// being written, so readers detect a torn copy and simply take a newer frame.
+#define FRAME_MAGIC "NBODYFRM"
+#define FRAME_VERSION 2
+#define FRAME_SLOTS 8
+#define FRAME_ALIGNMENT 64
+
+// Segment name of each publishing rank, followed by ".<rank>"
+#define FRAME_RING_PREFIX "/nbody-frames"
+
+// What -V publishes
+#define FRAMES_POSITIONS 1 // Particle ids and positions
+#define FRAMES_NODES     2 // Positions plus the bounds of every tree node
+
+// Start of the segment
+typedef struct {
+    char magic[8];              // FRAME_MAGIC, not NUL terminated
+    uint32_t version;           // FRAME_VERSION
+    uint32_t slot_count;        // Slots in the ring
+    int32_t particle_capacity;  // Particles a slot can hold
+    int32_t node_capacity;      // Tree nodes a slot can hold, 0 without node bounds
+    uint64_t slot_size;         // Bytes per slot, slots follow the header
+    _Atomic uint64_t published; // Number of the newest complete frame, frames count from 1
+    _Atomic uint32_t finished;  // Set once the run is over
+    _Atomic uint32_t replaced;  // Set once a larger ring took over the name, reopen it
+} FrameRingHeader;
+
+// Start of every slot, the columns follow at frame_column_offset
+typedef struct {
+    _Atomic uint64_t sequence;  // 2 * frame - 1 while writing, 2 * frame when complete
+    int64_t step;               // Simulation step the frame shows
+    double time;                // Simulated time, step * dt
+    int32_t particle_count;
+    int32_t node_count;
+} FrameSlotHeader;
+
+// Slot columns: index (int32) x_pos y_pos (double) for the particles, then
+// x_min y_min x_max y_max (double) count (int32) for the nodes in tree order.
+// Node bounds are the tight box around the node's particles.
+#define FRAME_COLUMNS 8
+
+// Writer side, owned by one rank
+typedef struct {
+    char name[64];
+    unsigned char* base;        // Mapped segment
+    size_t size;
+    FrameRingHeader* header;
+    uint64_t frame;             // Next frame number
+} FrameRing;
+
+// Reader side copy of one frame, same columns as a slot
+typedef struct {
+    uint64_t frame;             // Frame number, 0 before the first read
+    int64_t step;
+    double time;
+    int particle_count;
+    int node_count;
+    int32_t* index;
+    double* x_pos;
+    double* y_pos;
+    double* x_min;
+    double* y_min;
+    double* x_max;
+    double* y_max;
+    int32_t* node_particles;
+} Frame;
+
+uint64_t frame_column_offset(int particle_capacity, int node_capacity, int column);
+
+FrameRing* create_frame_ring(const char* name, int particle_capacity, int node_capacity);
+FrameRing* create_rank_frame_ring(int rank, int visualization_flag, int particle_capacity);
+FrameRing* reserve_frame_ring(FrameRing* ring, int particle_count);
+void publish_frame(FrameRing* ring, int step, double time, const ParticleSoA* soa, const FlatTree* tree);
+void destroy_frame_ring(FrameRing* ring);
+
+// Readers map the ring and poll for the newest frame
+const FrameRingHeader* open_frame_ring(const char* name, size_t* size);
+void close_frame_ring(const FrameRingHeader* header, size_t size);
+Frame* create_frame(const FrameRingHeader* header);
+int read_latest_frame(const FrameRingHeader* header, Frame* frame);
+void destroy_frame(Frame* frame);
+
+#endif // FRAMES_H
@@ -0,0 +1,240 @@
+#include "group.h"
+
+InteractionList* create_interaction_list(int capacity) {
+    InteractionList* list = (InteractionList*)malloc(sizeof(InteractionList));
+    if (list == NULL) {
+        perror("Memory allocation error");
+        exit(EXIT_FAILURE);
+    }
+
+    list->capacity = capacity > 0 ? capacity : 1;
+    list->count = 0;
+    list->x_pos = create_particle_column(list->capacity);
+    list->y_pos = create_particle_column(list->capacity);
+    list->mass = create_particle_column(list->capacity);
+
+    list->cell_capacity = list->capacity;
+    list->cell_count = 0;
+    list->cell_x = create_particle_column(list->cell_capacity);
+    list->cell_y = create_particle_column(list->cell_capacity);
+    list->cell_mass = create_particle_column(list->cell_capacity);
+    list->cell_qxx = create_particle_column(list->cell_capacity);
+    list->cell_qxy = create_particle_column(list->cell_capacity);
+    list->cell_qyy = create_particle_column(list->cell_capacity);
+    return list;
+}
+
+static double* grow_column(double* column, int count, int capacity) {
+    double* grown = create_particle_column(capacity);
+    memcpy(grown, column, count * sizeof(double));
+    free(column);
+    return grown;
+}
+
+void append_source(InteractionList* list, double x_pos, double y_pos, double mass) {
+    if (list->count == list->capacity) {
+        list->capacity *= 2;
+        list->x_pos = grow_column(list->x_pos, list->count, list->capacity);
+        list->y_pos = grow_column(list->y_pos, list->count, list->capacity);
+        list->mass = grow_column(list->mass, list->count, list->capacity);
+    }
+    list->x_pos[list->count] = x_pos;
+    list->y_pos[list->count] = y_pos;
+    list->mass[list->count] = mass;
+    list->count += 1;
+}
+
+void append_cell(InteractionList* list, double x_pos, double y_pos, double mass, double qxx, double qxy, double qyy) {
+    if (list->cell_count == list->cell_capacity) {
+        list->cell_capacity *= 2;
+        list->cell_x = grow_column(list->cell_x, list->cell_count, list->cell_capacity);
+        list->cell_y = grow_column(list->cell_y, list->cell_count, list->cell_capacity);
+        list->cell_mass = grow_column(list->cell_mass, list->cell_count, list->cell_capacity);
+        list->cell_qxx = grow_column(list->cell_qxx, list->cell_count, list->cell_capacity);
+        list->cell_qxy = grow_column(list->cell_qxy, list->cell_count, list->cell_capacity);
+        list->cell_qyy = grow_column(list->cell_qyy, list->cell_count, list->cell_capacity);
+    }
+    list->cell_x[list->cell_count] = x_pos;
+    list->cell_y[list->cell_count] = y_pos;
+    list->cell_mass[list->cell_count] = mass;
+    list->cell_qxx[list->cell_count] = qxx;
+    list->cell_qxy[list->cell_count] = qxy;
+    list->cell_qyy[list->cell_count] = qyy;
+    list->cell_count += 1;
+}
+
+// Add the force of every source in the list on one target
+void evaluate_interaction_list(const InteractionList* list, double target_x, double target_y, double target_mass,
+                               double* x_force, double* y_force) {
+    leaf_kernel(list->x_pos, list->y_pos, list->mass, list->count,
+                target_x, target_y, target_mass, x_force, y_force);
+    if (list->cell_count > 0) {
+        quadrupole_kernel(list->cell_x, list->cell_y, list->cell_mass,
+                          list->cell_qxx, list->cell_qxy, list->cell_qyy, list->cell_count,
+                          target_x, target_y, target_mass, x_force, y_force);
+    }
+}
+
+void destroy_interaction_list(InteractionList* list) {
+    if (list == NULL) return;
+    free(list->x_pos);
+    free(list->y_pos);
+    free(list->mass);
+    free(list->cell_x);
+    free(list->cell_y);
+    free(list->cell_mass);
+    free(list->cell_qxx);
+    free(list->cell_qxy);
+    free(list->cell_qyy);
+    free(list);
+}
+
+// One list per thread, so threads can walk groups independently
+InteractionList** create_interaction_lists(int count) {
+    InteractionList** lists = (InteractionList**)malloc(count * sizeof(InteractionList*));
+    if (lists == NULL) {
+        perror("Memory allocation error");
+        exit(EXIT_FAILURE);
+    }
+    for (int t = 0; t < count; t++) {
+        lists[t] = create_interaction_list(1024);
+    }
+    return lists;
+}
+
+void destroy_interaction_lists(InteractionList** lists, int count) {
+    if (lists == NULL) return;
+    for (int t = 0; t < count; t++) {
+        destroy_interaction_list(lists[t]);
+    }
+    free(lists);
+}
+
+GroupSet* create_group_set(int capacity) {
+    GroupSet* groups = (GroupSet*)calloc(1, sizeof(GroupSet));
+    if (groups == NULL) {
+        perror("Memory allocation error");
+        exit(EXIT_FAILURE);
+    }
+
+    groups->capacity = capacity > 0 ? capacity : 1;
+    groups->nodes = (int*)malloc(groups->capacity * sizeof(int));
+    groups->untreed = (int*)malloc(groups->capacity * sizeof(int));
+    groups->in_tree = (char*)malloc(groups->capacity * sizeof(char));
+    if (!groups->nodes || !groups->untreed || !groups->in_tree) {
+        perror("Memory allocation error");
+        exit(EXIT_FAILURE);
+    }
+    return groups;
+}
+
+// Split the tree into the largest subtrees holding at most group_size
+// particles. A leaf bucket larger than group_size is a group of its own.
+// Particles the builder left out of the tree are listed separately.
+void find_groups(GroupSet* groups, const FlatTree* tree, int group_size, int particle_count) {
+    if (particle_count > groups->capacity) {
+        groups->capacity = particle_count;
+        groups->nodes = (int*)realloc(groups->nodes, groups->capacity * sizeof(int));
+        groups->untreed = (int*)realloc(groups->untreed, groups->capacity * sizeof(int));
+        groups->in_tree = (char*)realloc(groups->in_tree, groups->capacity * sizeof(char));
+        if (!groups->nodes || !groups->untreed || !groups->in_tree) {
+            perror("Memory allocation error");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    groups->count = 0;
+    int i = 0;
+    while (i < tree->count) {
+        const FlatNode* node = &tree->nodes[i];
+        if (node->count <= group_size || node->next == i + 1) {
+            groups->nodes[groups->count++] = i;
+            i = node->next;
+        } else {
+            i += 1;
+        }
+    }
+
+    memset(groups->in_tree, 0, particle_count * sizeof(char));
+    for (int s = 0; s < tree->particle_count; s++) {
+        groups->in_tree[tree->order[s]] = 1;
+    }
+    groups->untreed_count = 0;
+    for (int p = 0; p < particle_count; p++) {
+        if (!groups->in_tree[p]) groups->untreed[groups->untreed_count++] = p;
+    }
+}
+
+// Distance from a point to the closest point of a box, zero inside it
+static double box_distance(double x_min, double y_min, double x_max, double y_max, double x_pos, double y_pos) {
+    double dx = 0.0;
+    double dy = 0.0;
+    if (x_pos < x_min) dx = x_min - x_pos;
+    else if (x_pos > x_max) dx = x_pos - x_max;
+    if (y_pos < y_min) dy = y_min - y_pos;
+    else if (y_pos > y_max) dy = y_pos - y_max;
+    return sqrt((dx * dx) + (dy * dy));
+}
+
+// Walk the tree once for a whole group. The MAC is tested against the closest
+// point of the box around the group's particles, so a cell accepted here would
+// be accepted by every member on its own walk. Accepted cells become point
+// masses and opened leaves contribute their particles, members included: a
+// source at the target's own position adds exactly zero in the leaf kernel.
+// With quadrupoles on, accepted cells keep their moments.
+void build_interaction_list(const FlatTree* tree, int group, double theta, InteractionList* list) {
+    const FlatNode* root = &tree->nodes[group];
+
+    double x_min = tree->x_pos[root->first];
+    double x_max = x_min;
+    double y_min = tree->y_pos[root->first];
+    double y_max = y_min;
+    for (int s = root->first + 1; s < root->first + root->count; s++) {
+        if (tree->x_pos[s] < x_min) x_min = tree->x_pos[s];
+        if (tree->x_pos[s] > x_max) x_max = tree->x_pos[s];
+        if (tree->y_pos[s] < y_min) y_min = tree->y_pos[s];
+        if (tree->y_pos[s] > y_max) y_max = tree->y_pos[s];
+    }
+
+    list->count = 0;
+    list->cell_count = 0;
+    list->accepted = 0;
+    int i = 0;
+    while (i < tree->count) {
+        const FlatNode* node = &tree->nodes[i];
+
+        double distance = box_distance(x_min, y_min, x_max, y_max, node->x_com, node->y_com);
+
+        // Ensure that the distance is no less than the RLIMIT to prevent infinite forces
+        if (distance < RLIMIT) {
+            distance = RLIMIT;
+        }
+
+        int accepted = (node->size / distance) < theta;
+        int is_leaf = node->next == i + 1;
+        if (is_leaf && !(node->count > 1 && accepted)) {
+            for (int s = node->first; s < node->first + node->count; s++) {
+                append_source(list, tree->x_pos[s], tree->y_pos[s], tree->mass[s]);
+            }
+            i = node->next;
+        } else if (is_leaf || accepted) {
+            if (tree->quadrupoles) {
+                append_cell(list, node->x_com, node->y_com, node->mass, tree->qxx[i], tree->qxy[i], tree->qyy[i]);
+            } else {
+                append_source(list, node->x_com, node->y_com, node->mass);
+            }
+            list->accepted += 1;
+            i = node->next;
+        } else {
+            i += 1;
+        }
+    }
+}
+
+void destroy_group_set(GroupSet* groups) {
+    if (groups == NULL) return;
+    free(groups->nodes);
+    free(groups->untreed);
+    free(groups->in_tree);
+    free(groups);
+}
@@ -0,0 +1,61 @@
+#ifndef GROUP_H
+#define GROUP_H
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "flat_tree.h"
+#include "kernel.h"
+#include "particle.h"
+#include "tree.h"
+
+// Sources a group of particles interacts with, in dense columns for the
+// kernels: point masses (particles of opened leaves, and accepted cells when
+// the tree has no quadrupoles) and accepted cells with quadrupole moments
+typedef struct {
+    double* x_pos;
+    double* y_pos;
+    double* mass;
+    int count;
+    int capacity;
+
+    double* cell_x;
+    double* cell_y;
+    double* cell_mass;
+    double* cell_qxx;
+    double* cell_qxy;
+    double* cell_qyy;
+    int cell_count;
+    int cell_capacity;
+
+    int accepted;        // Accepted cells among the entries, the rest are particles
+} InteractionList;
+
+// Groups of nearby particles that share one tree walk. Each group is a subtree
+// of the flat tree, so its members are a contiguous run of tree slots.
+typedef struct {
+    int* nodes;          // Root node of each group, in tree order
+    int count;
+    int* untreed;        // Particles that are not in the tree and walk alone
+    int untreed_count;
+    char* in_tree;       // Scratch flag per particle
+    int capacity;
+} GroupSet;
+
+InteractionList* create_interaction_list(int capacity);
+void append_source(InteractionList* list, double x_pos, double y_pos, double mass);
+void append_cell(InteractionList* list, double x_pos, double y_pos, double mass, double qxx, double qxy, double qyy);
+void evaluate_interaction_list(const InteractionList* list, double target_x, double target_y, double target_mass,
+                               double* x_force, double* y_force);
+void destroy_interaction_list(InteractionList* list);
+InteractionList** create_interaction_lists(int count);
+void destroy_interaction_lists(InteractionList** lists, int count);
+
+GroupSet* create_group_set(int capacity);
+void find_groups(GroupSet* groups, const FlatTree* tree, int group_size, int particle_count);
+void build_interaction_list(const FlatTree* tree, int group, double theta, InteractionList* list);
+void destroy_group_set(GroupSet* groups);
+
+#endif // GROUP_H
@@ -1,75 +1,407 @@
 
 #include "io.h"
 
-void argument_parse(int argc, char **argv, char **in_file_name, char **out_file_name, int *steps, double *theta, double *time_step, int *visualization_flag, int *print_debug_flag) {
-    *visualization_flag = 0; // Default: visualization off
-    *print_debug_flag = 0;   // Default: output debug statements off
- 
+void default_options(Options *opts) {
+    memset(opts, 0, sizeof(Options));
+    opts->visualization_flag = 0; // Default: visualization off
+    opts->print_debug_flag = 0;   // Default: output debug statements off
+    opts->mode = MODE_REPLICATED; // Default: replicated particle data
+    opts->builder = BUILDER_INSERT; // Default: top-down insertion
+    opts->leaf_size = 1;            // Default: one particle per leaf
+    opts->threads = 1;              // Default: single threaded ranks
+    opts->group_size = 0;           // Default: one tree walk per particle
+    opts->quadrupoles = 0;          // Default: monopoles only
+    opts->accuracy_samples = 0;     // Default: no accuracy report
+    opts->direct_below = 0;         // Default: always build the tree
+    opts->refit_threshold = 0.0;    // Default: rebuild the tree every step
+    opts->restart = 0;              // Default: start from the input file
+    opts->start_step = 0;
+    opts->checkpoint_steps = 0;     // Default: no checkpoints
+    opts->checkpoint_seconds = 0.0;
+    opts->balance_threshold = 0.0;  // Default: split particle counts evenly
+    opts->block_levels = 0;         // Default: every particle takes dt
+    opts->block_eta = BLOCK_DEFAULT_ETA;
+    opts->single_precision = 0;     // Default: double precision throughout
+    opts->stats_flag = 0;           // Default: no instrumentation
+    opts->ensemble_ranks = 1;       // Default: one rank per ensemble member
+}
+
+void argument_parse(int argc, char **argv, Options *opts) {
+    default_options(opts);
+
     // Loop through CL arguments and parse them accordingly 
     for (int i = 1; i < argc; i++) {
         if (strcmp(argv[i], "-i") == 0 && i + 1 < argc) {
-            *in_file_name = argv[++i];
+            opts->in_file = argv[++i];
         } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
-            *out_file_name = argv[++i];
+            opts->out_file = argv[++i];
         } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
-            *steps = atoi(argv[++i]);
+            opts->steps = atoi(argv[++i]);
         } else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
-            *theta = atof(argv[++i]);
+            opts->theta = atof(argv[++i]);
         } else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
-            *time_step = atof(argv[++i]);
+            opts->time_step = atof(argv[++i]);
         } else if (strcmp(argv[i], "-D") == 0 && i + 1 < argc) {
-            *print_debug_flag = atoi(argv[++i]);
+            opts->print_debug_flag = atoi(argv[++i]);
         } else if (strcmp(argv[i], "-V") == 0) {
-            *visualization_flag = 1;
+            // Optionally followed by "nodes" to publish the tree as well
+            opts->visualization_flag = FRAMES_POSITIONS;
+            if (i + 1 < argc && strcmp(argv[i + 1], "nodes") == 0) {
+                opts->visualization_flag = FRAMES_NODES;
+                i++;
+            }
+        } else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "replicated") == 0) {
+                opts->mode = MODE_REPLICATED;
+            } else if (strcmp(argv[i], "distributed") == 0) {
+                opts->mode = MODE_DISTRIBUTED;
+            } else {
+                fprintf(stderr, "Unknown mode: %s (expected replicated or distributed)\n", argv[i]);
+                exit(EXIT_FAILURE);
+            }
+        } else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "insert") == 0) {
+                opts->builder = BUILDER_INSERT;
+            } else if (strcmp(argv[i], "morton") == 0) {
+                opts->builder = BUILDER_MORTON;
+            } else {
+                fprintf(stderr, "Unknown tree builder: %s (expected insert or morton)\n", argv[i]);
+                exit(EXIT_FAILURE);
+            }
+        } else if (strcmp(argv[i], "-l") == 0 && i + 1 < argc) {
+            opts->leaf_size = atoi(argv[++i]);
+            if (opts->leaf_size < 1) {
+                fprintf(stderr, "Leaf size must be at least 1\n");
+                exit(EXIT_FAILURE);
+            }
+        } else if (strcmp(argv[i], "-T") == 0 && i + 1 < argc) {
+            opts->threads = atoi(argv[++i]);
+            if (opts->threads < 1) {
+                fprintf(stderr, "Thread count must be at least 1\n");
+                exit(EXIT_FAILURE);
+            }
+        } else if (strcmp(argv[i], "-g") == 0 && i + 1 < argc) {
+            opts->group_size = atoi(argv[++i]);
+            if (opts->group_size < 0) {
+                fprintf(stderr, "Group size must not be negative\n");
+                exit(EXIT_FAILURE);
+            }
+        } else if (strcmp(argv[i], "-q") == 0) {
+            opts->quadrupoles = 1;
+        } else if (strcmp(argv[i], "-A") == 0 && i + 1 < argc) {
+            i++;
+            opts->accuracy_samples = strcmp(argv[i], "all") == 0 ? ACCURACY_ALL : atoi(argv[i]);
+        } else if (strcmp(argv[i], "-a") == 0 && i + 1 < argc) {
+            // Sum all pairs below a particle count, auto for the measured crossover
+            i++;
+            if (strcmp(argv[i], "auto") == 0) {
+                opts->direct_below = DIRECT_CROSSOVER;
+            } else {
+                opts->direct_below = atoi(argv[i]);
+                if (opts->direct_below < 0) {
+                    fprintf(stderr, "All-pairs particle count must not be negative\n");
+                    exit(EXIT_FAILURE);
+                }
+            }
+        } else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+            opts->refit_threshold = atof(argv[++i]);
+            if (opts->refit_threshold < 0 || opts->refit_threshold > 1) {
+                fprintf(stderr, "Refit threshold must be between 0 and 1\n");
+                exit(EXIT_FAILURE);
+            }
+        } else if (strcmp(argv[i], "-J") == 0 && i + 1 < argc) {
+            opts->report_file = argv[++i];
+        } else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+            opts->checkpoint_steps = atoi(argv[++i]);
+            if (opts->checkpoint_steps < 0) {
+                fprintf(stderr, "Checkpoint interval must not be negative\n");
+                exit(EXIT_FAILURE);
+            }
+        } else if (strcmp(argv[i], "-C") == 0 && i + 1 < argc) {
+            opts->checkpoint_seconds = atof(argv[++i]);
+            if (opts->checkpoint_seconds < 0) {
+                fprintf(stderr, "Checkpoint interval must not be negative\n");
+                exit(EXIT_FAILURE);
+            }
+        } else if (strcmp(argv[i], "-B") == 0 && i + 1 < argc) {
+            // 1 cuts new cost zones every step
+            opts->balance_threshold = atof(argv[++i]);
+            if (opts->balance_threshold < 1) {
+                fprintf(stderr, "Balance threshold must be at least 1\n");
+                exit(EXIT_FAILURE);
+            }
+        } else if (strcmp(argv[i], "-L") == 0 && i + 1 < argc) {
+            opts->block_levels = atoi(argv[++i]);
+            if (opts->block_levels < 0 || opts->block_levels > BLOCK_MAX_LEVELS) {
+                fprintf(stderr, "Block timestep levels must be between 0 and %d\n", BLOCK_MAX_LEVELS);
+                exit(EXIT_FAILURE);
+            }
+        } else if (strcmp(argv[i], "-e") == 0 && i + 1 < argc) {
+            opts->block_eta = atof(argv[++i]);
+            if (opts->block_eta <= 0) {
+                fprintf(stderr, "Block timestep accuracy must be positive\n");
+                exit(EXIT_FAILURE);
+            }
+        } else if (strcmp(argv[i], "-F") == 0) {
+            opts->single_precision = 1;
+        } else if (strcmp(argv[i], "-P") == 0) {
+#ifdef NBODY_STATS
+            opts->stats_flag = 1;
+#else
+            fprintf(stderr, "Instrumentation (-P) is not built in, rebuild with make STATS=1\n");
+            exit(EXIT_FAILURE);
+#endif
+        } else if (strcmp(argv[i], "-E") == 0 && i + 1 < argc) {
+            opts->ensemble_file = argv[++i];
+        } else if (strcmp(argv[i], "-R") == 0 && i + 1 < argc) {
+            opts->ensemble_ranks = atoi(argv[++i]);
+            if (opts->ensemble_ranks < 1) {
+                fprintf(stderr, "Ranks per ensemble member must be at least 1\n");
+                exit(EXIT_FAILURE);
+            }
+        } else if (strcmp(argv[i], "-N") == 0 && i + 1 < argc) {
+            // More than the ranks of a node shares the whole node
+            opts->node_ranks = atoi(argv[++i]);
+            if (opts->node_ranks < 1) {
+                fprintf(stderr, "Ranks sharing a node's tree must be at least 1\n");
+                exit(EXIT_FAILURE);
+            }
+        } else if (strcmp(argv[i], "--restart") == 0 && i + 1 < argc) {
+            // The checkpoint replaces the input, its parameters are loaded later
+            opts->in_file = argv[++i];
+            opts->restart = 1;
         } else {
             fprintf(stderr, "Unknown or incomplete argument: %s\n", argv[i]);
             exit(EXIT_FAILURE);
         }
     }
 
-    if (!*in_file_name){
+    // The refit keeps the insertion tree of the full particle set between steps
+    if (opts->refit_threshold > 0 && (opts->builder != BUILDER_INSERT || opts->mode != MODE_REPLICATED)) {
+        fprintf(stderr, "Tree refit (-r) needs the insert builder in replicated mode\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Block timesteps walk every active particle on its own against the
+    // replicated tree
+    if (opts->block_levels > 0 && (opts->mode != MODE_REPLICATED || opts->group_size > 0 || opts->balance_threshold > 0)) {
+        fprintf(stderr, "Block timesteps (-L) need replicated mode without -g or -B\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // The node-shared tree is walked one particle at a time over index blocks
+    if (opts->node_ranks > 0 && (opts->mode != MODE_REPLICATED || opts->group_size > 0 ||
+                                 opts->balance_threshold > 0 || opts->block_levels > 0)) {
+        fprintf(stderr, "A node-shared tree (-N) needs replicated mode without -g, -B or -L\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // The all-pairs sum takes the place of the replicated tree in the plain step
+    if (opts->direct_below > 0 && (opts->mode != MODE_REPLICATED || opts->block_levels > 0 || opts->node_ranks > 0)) {
+        fprintf(stderr, "All-pairs summation (-a) needs replicated mode without -L or -N\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // The grouped walk keeps its interaction lists in double
+    if (opts->single_precision && opts->group_size > 0) {
+        fprintf(stderr, "Mixed precision (-F) needs the per-particle walk, without -g\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (opts->ensemble_file && !opts->in_file) {
+        // The manifest lines complete the options of each member
+        return;
+    } else if (!opts->in_file){
         fprintf(stderr, "Missing required argument: -i <input file name>\n");
         exit(EXIT_FAILURE);
-    } else if (!*out_file_name){
+    } else if (!opts->out_file){
         fprintf(stderr, "Missing required argument: -o <output file name>\n");
         exit(EXIT_FAILURE);
-    } else if (!*steps){
+    } else if (opts->restart) {
+        // Steps, theta and dt come from the checkpoint
+        return;
+    } else if (!opts->steps){
         fprintf(stderr, "Missing required argument: -s <number of steps>\n");
         exit(EXIT_FAILURE);
-    } else if (!*theta){
+    } else if (!opts->theta){
         fprintf(stderr, "Missing required argument: -t <theta value>\n");
         exit(EXIT_FAILURE);
-    } else if (!*time_step){
+    } else if (!opts->time_step){
         fprintf(stderr, "Missing required argument: -0 <output file name>\n");
         exit(EXIT_FAILURE);
     }
 }
 
-Particle *read_input_file(const char *filename, int *num_bodies) {
-    FILE *file = fopen(filename, "r");
+// Text input split into chunks of whole lines that threads parse on their own
+typedef struct {
+    const char *text;      // Whole file, NUL terminated
+    size_t *chunk_start;   // Byte offset of each chunk, plus the end of the text
+    int *chunk_first;      // Record count before each chunk, then the next slot
+    Particle *particles;
+    int num_bodies;
+    int bad_records;       // Records that did not parse, set by any thread
+} TextInput;
+
+// Does the line [begin, end) hold anything but whitespace
+static int is_record(const char *begin, const char *end) {
+    for (const char *c = begin; c < end; c++) {
+        if (!isspace((unsigned char)*c)) return 1;
+    }
+    return 0;
+}
+
+static void count_records(void *context, int first, int last) {
+    TextInput *input = (TextInput *)context;
+
+    for (int chunk = first; chunk < last; chunk++) {
+        const char *line = input->text + input->chunk_start[chunk];
+        const char *end = input->text + input->chunk_start[chunk + 1];
+        int records = 0;
+        while (line < end) {
+            const char *newline = memchr(line, '\n', end - line);
+            const char *line_end = newline ? newline : end;
+            records += is_record(line, line_end);
+            line = line_end + 1;
+        }
+        input->chunk_first[chunk] = records;
+    }
+}
+
+static void parse_records(void *context, int first, int last) {
+    TextInput *input = (TextInput *)context;
+
+    for (int chunk = first; chunk < last; chunk++) {
+        const char *line = input->text + input->chunk_start[chunk];
+        const char *end = input->text + input->chunk_start[chunk + 1];
+        int slot = input->chunk_first[chunk];
+        while (line < end) {
+            const char *newline = memchr(line, '\n', end - line);
+            const char *line_end = newline ? newline : end;
+            if (is_record(line, line_end)) {
+                if (slot >= input->num_bodies) {
+                    input->bad_records = 1;
+                    return;
+                }
+
+                // Same conversions as fscanf with %d and %lf
+                Particle *p = &input->particles[slot++];
+                char *cursor;
+                p->index = (int)strtol(line, &cursor, 10);
+                p->x_pos = strtod(cursor, &cursor);
+                p->y_pos = strtod(cursor, &cursor);
+                p->mass = strtod(cursor, &cursor);
+                p->x_vel = strtod(cursor, &cursor);
+                p->y_vel = strtod(cursor, &cursor);
+                p->x_force = 0.0;
+                p->y_force = 0.0;
+                p->cost = 1.0f;
+                if (cursor > line_end) input->bad_records = 1;
+            }
+            line = line_end + 1;
+        }
+    }
+}
+
+// Read the whole text file, then count and parse its lines in chunks spread
+// over the thread pool, or in one chunk on the calling thread when pool is
+// NULL. One particle per line: index x y mass x_vel y_vel.
+Particle *read_input_file(const char *filename, int *num_bodies, ThreadPool *pool) {
+    FILE *file = fopen(filename, "rb");
     if (!file) {
         perror("Error opening input file");
         exit(EXIT_FAILURE);
     }
 
-    fscanf(file, "%d", num_bodies);
-    Particle *particles = (Particle *)malloc(*num_bodies * sizeof(Particle));
+    fseek(file, 0, SEEK_END);
+    long length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    char *text = (char *)malloc(length + 1);
+    if (!text) {
+        perror("Memory allocation error");
+        exit(EXIT_FAILURE);
+    }
+    if (fread(text, 1, length, file) != (size_t)length) {
+        perror("Error reading input file");
+        exit(EXIT_FAILURE);
+    }
+    text[length] = '\0';
+    fclose(file);
+
+    // The first line holds the particle count
+    char *body;
+    *num_bodies = (int)strtol(text, &body, 10);
+    if (body == text || *num_bodies < 0) {
+        fprintf(stderr, "%s: missing particle count\n", filename);
+        exit(EXIT_FAILURE);
+    }
+    while (*body != '\0' && *body != '\n') body++;
+
+    Particle *particles = (Particle *)malloc((*num_bodies > 0 ? *num_bodies : 1) * sizeof(Particle));
     if (!particles) {
         perror("Memory allocation error");
         exit(EXIT_FAILURE);
     }
 
-    for (int i = 0; i < *num_bodies; i++) {
-        fscanf(file, "%d %lf %lf %lf %lf %lf",
-               &particles[i].index,
-               &particles[i].x_pos,
-               &particles[i].y_pos,
-               &particles[i].mass,
-               &particles[i].x_vel,
-               &particles[i].y_vel);
+    // Cut the body into chunks that end on line breaks
+    int chunks = pool ? pool->thread_count * 4 : 1;
+    size_t body_start = body - text;
+    size_t body_length = length - body_start;
+    if (body_length < (size_t)chunks * 4096) chunks = 1;
+
+    TextInput input;
+    input.text = text;
+    input.chunk_start = (size_t *)malloc((chunks + 1) * sizeof(size_t));
+    input.chunk_first = (int *)malloc(chunks * sizeof(int));
+    input.particles = particles;
+    input.num_bodies = *num_bodies;
+    input.bad_records = 0;
+    if (!input.chunk_start || !input.chunk_first) {
+        perror("Memory allocation error");
+        exit(EXIT_FAILURE);
+    }
+
+    input.chunk_start[0] = body_start;
+    for (int c = 1; c < chunks; c++) {
+        size_t start = body_start + body_length * c / chunks;
+        if (start < input.chunk_start[c - 1]) start = input.chunk_start[c - 1];
+        while (start < (size_t)length && text[start - 1] != '\n') start++;
+        input.chunk_start[c] = start;
     }
+    input.chunk_start[chunks] = length;
 
-    fclose(file);
+    if (pool) {
+        parallel_for(pool, 0, chunks, 1, count_records, &input);
+    } else {
+        count_records(&input, 0, chunks);
+    }
+
+    int records = 0;
+    for (int c = 0; c < chunks; c++) {
+        int n = input.chunk_first[c];
+        input.chunk_first[c] = records;
+        records += n;
+    }
+    if (records != *num_bodies) {
+        fprintf(stderr, "%s: expected %d particles, found %d\n", filename, *num_bodies, records);
+        exit(EXIT_FAILURE);
+    }
+
+    if (pool) {
+        parallel_for(pool, 0, chunks, 1, parse_records, &input);
+    } else {
+        parse_records(&input, 0, chunks);
+    }
+    if (input.bad_records) {
+        fprintf(stderr, "%s: malformed particle record\n", filename);
+        exit(EXIT_FAILURE);
+    }
+
+    free(input.chunk_start);
+    free(input.chunk_first);
+    free(text);
     return particles;
 }
 
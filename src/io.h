@@ -1,15 +1,71 @@
 #ifndef IO_H
 #define IO_H
 
+#include <ctype.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "direct.h"
+#include "frames.h"
 #include "particle.h"
+#include "threads.h"
+
+// Parallel execution modes
+#define MODE_REPLICATED  0 // Every rank holds all particles
+#define MODE_DISTRIBUTED 1 // Ranks own spatial regions and exchange essential trees
+
+// Tree builders
+#define BUILDER_INSERT 0 // Top-down insertion one particle at a time
+#define BUILDER_MORTON 1 // Bottom-up from Morton-sorted particles
+
+// Block timesteps
+#define BLOCK_MAX_LEVELS 20     // Ticks per step stay well within an int
+#define BLOCK_DEFAULT_ETA 0.025 // Accuracy parameter of the level criterion
+
+// -A all: every particle is checked, against the all-pairs sum
+#define ACCURACY_ALL INT_MAX
+
+// Run settings gathered from the command line
+typedef struct {
+    char *in_file;          // Input file name
+    char *out_file;         // Output file name
+    char *report_file;      // JSON phase timing report, NULL for none
+    int steps;              // Number of steps to simulate
+    double theta;           // MAC threshold
+    double time_step;       // Time step (dt)
+    int visualization_flag; // Frames published per step: 0, FRAMES_POSITIONS or FRAMES_NODES
+    int print_debug_flag;   // Debug log level
+    int mode;               // Parallel execution mode
+    int builder;            // Tree builder
+    int leaf_size;          // Maximum particles per leaf bucket
+    int threads;            // Threads per rank for the force and update phase
+    int group_size;         // Particles per grouped walk, 0 walks each particle alone
+    int quadrupoles;        // Use quadrupole moments for accepted cells
+    int accuracy_samples;   // Particles checked against a direct sum, 0 for no report
+    int direct_below;       // Sum all pairs instead of building a tree below this many particles, 0 never
+    double refit_threshold; // Fraction of moved particles that forces a rebuild, 0 always rebuilds
+    int restart;            // in_file is a checkpoint to resume from
+    int start_step;         // Steps already completed, from the checkpoint
+    int checkpoint_steps;   // Checkpoint every n steps, 0 for none
+    double checkpoint_seconds; // Checkpoint every n seconds of wall clock time, 0 for none
+    double balance_threshold; // Cost zones, recut when the work imbalance exceeds this, 0 for count splits
+    int block_levels;       // Block timestep levels below dt, 0 for one dt for all
+    double block_eta;       // Accuracy parameter of the block timestep criterion
+    int single_precision;   // Walk the tree and sum leaves in single precision
+    int stats_flag;         // Record per-step instrumentation, needs a make STATS=1 build
+    char *ensemble_file;    // Manifest of an ensemble run, NULL for a single run
+    int ensemble_ranks;     // Ranks per ensemble group
+    int node_ranks;         // Ranks of a node sharing one tree, 0 for a copy per rank
+} Options;
 
 // Function prototypes
-void argument_parse(int argc, char **argv, char **input_filename, char **output_filename, int *steps, double *theta, double *dt, int *visualization_flag, int *print_debug_flag);
-Particle *read_input_file(const char *filename, int *num_bodies);
+// Defaults of every setting, the input, output, steps, theta and dt are left
+// unset
+void default_options(Options *opts);
+void argument_parse(int argc, char **argv, Options *opts);
+Particle *read_input_file(const char *filename, int *num_bodies, ThreadPool *pool);
 void write_output_file(const char *filename, Particle *particles, int num_bodies);
 
-#endif // IO_H
\ No newline at end of file
+#endif // IO_H
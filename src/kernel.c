@@ -0,0 +1,214 @@
+
+#include "kernel.h"
+
+#if defined(__AVX512F__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+void leaf_kernel(const double* x_pos, const double* y_pos, const double* mass, int count,
+                 double target_x, double target_y, double target_mass,
+                 double* x_force, double* y_force) {
+    double fx = *x_force;
+    double fy = *y_force;
+    int i = 0;
+
+#if defined(__AVX512F__)
+    if (count >= 8) {
+        const __m512d tx = _mm512_set1_pd(target_x);
+        const __m512d ty = _mm512_set1_pd(target_y);
+        const __m512d gm = _mm512_set1_pd(G * target_mass);
+        const __m512d rlimit = _mm512_set1_pd(RLIMIT);
+        __m512d ax = _mm512_setzero_pd();
+        __m512d ay = _mm512_setzero_pd();
+
+        for (; i < count; i += 8) {
+            // Lanes past the end load zero mass and add nothing
+            __mmask8 lanes = count - i >= 8 ? 0xff : (__mmask8)((1u << (count - i)) - 1);
+            __m512d dx = _mm512_sub_pd(_mm512_maskz_loadu_pd(lanes, x_pos + i), tx);
+            __m512d dy = _mm512_sub_pd(_mm512_maskz_loadu_pd(lanes, y_pos + i), ty);
+            __m512d m = _mm512_maskz_loadu_pd(lanes, mass + i);
+
+            __m512d distance = _mm512_sqrt_pd(_mm512_add_pd(_mm512_mul_pd(dx, dx), _mm512_mul_pd(dy, dy)));
+            distance = _mm512_max_pd(distance, rlimit);
+            __m512d cube = _mm512_mul_pd(_mm512_mul_pd(distance, distance), distance);
+
+            __m512d scale = _mm512_div_pd(_mm512_mul_pd(gm, m), cube);
+            ax = _mm512_add_pd(ax, _mm512_mul_pd(scale, dx));
+            ay = _mm512_add_pd(ay, _mm512_mul_pd(scale, dy));
+        }
+
+        fx += _mm512_reduce_add_pd(ax);
+        fy += _mm512_reduce_add_pd(ay);
+    }
+#elif defined(__AVX2__)
+    if (count >= 4) {
+        const __m256d tx = _mm256_set1_pd(target_x);
+        const __m256d ty = _mm256_set1_pd(target_y);
+        const __m256d gm = _mm256_set1_pd(G * target_mass);
+        const __m256d rlimit = _mm256_set1_pd(RLIMIT);
+        __m256d ax = _mm256_setzero_pd();
+        __m256d ay = _mm256_setzero_pd();
+
+        for (; i + 4 <= count; i += 4) {
+            __m256d dx = _mm256_sub_pd(_mm256_loadu_pd(x_pos + i), tx);
+            __m256d dy = _mm256_sub_pd(_mm256_loadu_pd(y_pos + i), ty);
+            __m256d m = _mm256_loadu_pd(mass + i);
+
+            __m256d distance = _mm256_sqrt_pd(_mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy)));
+            distance = _mm256_max_pd(distance, rlimit);
+            __m256d cube = _mm256_mul_pd(_mm256_mul_pd(distance, distance), distance);
+
+            __m256d scale = _mm256_div_pd(_mm256_mul_pd(gm, m), cube);
+            ax = _mm256_add_pd(ax, _mm256_mul_pd(scale, dx));
+            ay = _mm256_add_pd(ay, _mm256_mul_pd(scale, dy));
+        }
+
+        double lanes_x[4];
+        double lanes_y[4];
+        _mm256_storeu_pd(lanes_x, ax);
+        _mm256_storeu_pd(lanes_y, ay);
+        fx += (lanes_x[0] + lanes_x[1]) + (lanes_x[2] + lanes_x[3]);
+        fy += (lanes_y[0] + lanes_y[1]) + (lanes_y[2] + lanes_y[3]);
+    }
+#endif
+
+    // Scalar path for short runs and the tail, same expression as compute_force
+    for (; i < count; i++) {
+        double dx = x_pos[i] - target_x;
+        double dy = y_pos[i] - target_y;
+
+        double distance = sqrt((dx * dx) + (dy * dy));
+        distance = distance < RLIMIT ? RLIMIT : distance;
+
+        fx += (G * mass[i] * target_mass * dx) / (distance * distance * distance);
+        fy += (G * mass[i] * target_mass * dy) / (distance * distance * distance);
+    }
+
+    *x_force = fx;
+    *y_force = fy;
+}
+
+void quadrupole_kernel(const double* x_pos, const double* y_pos, const double* mass,
+                       const double* qxx, const double* qxy, const double* qyy, int count,
+                       double target_x, double target_y, double target_mass,
+                       double* x_force, double* y_force) {
+    double fx = *x_force;
+    double fy = *y_force;
+
+    for (int i = 0; i < count; i++) {
+        double dx = x_pos[i] - target_x;
+        double dy = y_pos[i] - target_y;
+
+        double distance = sqrt((dx * dx) + (dy * dy));
+        distance = distance < RLIMIT ? RLIMIT : distance;
+
+        fx += (G * mass[i] * target_mass * dx) / (distance * distance * distance);
+        fy += (G * mass[i] * target_mass * dy) / (distance * distance * distance);
+        quadrupole_force(-dx, -dy, distance, qxx[i], qxy[i], qyy[i], target_mass, &fx, &fy);
+    }
+
+    *x_force = fx;
+    *y_force = fy;
+}
+
+void leaf_kernel_single(const float* x_offset, const float* y_offset, const float* mass, int count,
+                        float dx, float dy, float gm, double* x_force, double* y_force) {
+    const float rlimit2 = (float)(RLIMIT * RLIMIT);
+    float fx = 0.0f;
+    float fy = 0.0f;
+    int i = 0;
+
+#if defined(__AVX512F__)
+    if (count >= 8) {
+        const __m512 ox = _mm512_set1_ps(dx);
+        const __m512 oy = _mm512_set1_ps(dy);
+        const __m512 vgm = _mm512_set1_ps(gm);
+        const __m512 limit = _mm512_set1_ps(rlimit2);
+        const __m512 half = _mm512_set1_ps(0.5f);
+        const __m512 three_halves = _mm512_set1_ps(1.5f);
+        __m512 ax = _mm512_setzero_ps();
+        __m512 ay = _mm512_setzero_ps();
+
+        for (; i < count; i += 16) {
+            // Lanes past the end load zero mass and add nothing
+            __mmask16 lanes = count - i >= 16 ? 0xffff : (__mmask16)((1u << (count - i)) - 1);
+            __m512 sx = _mm512_add_ps(_mm512_maskz_loadu_ps(lanes, x_offset + i), ox);
+            __m512 sy = _mm512_add_ps(_mm512_maskz_loadu_ps(lanes, y_offset + i), oy);
+            __m512 m = _mm512_maskz_loadu_ps(lanes, mass + i);
+
+            __m512 r2 = _mm512_max_ps(_mm512_add_ps(_mm512_mul_ps(sx, sx), _mm512_mul_ps(sy, sy)), limit);
+            __m512 inverse = _mm512_rsqrt14_ps(r2);
+            inverse = _mm512_mul_ps(inverse, _mm512_sub_ps(three_halves,
+                                    _mm512_mul_ps(_mm512_mul_ps(half, r2), _mm512_mul_ps(inverse, inverse))));
+            __m512 cube = _mm512_mul_ps(_mm512_mul_ps(inverse, inverse), inverse);
+
+            __m512 scale = _mm512_mul_ps(_mm512_mul_ps(vgm, m), cube);
+            ax = _mm512_fmadd_ps(scale, sx, ax);
+            ay = _mm512_fmadd_ps(scale, sy, ay);
+        }
+
+        fx += _mm512_reduce_add_ps(ax);
+        fy += _mm512_reduce_add_ps(ay);
+    }
+#elif defined(__AVX2__)
+    if (count >= 8) {
+        const __m256 ox = _mm256_set1_ps(dx);
+        const __m256 oy = _mm256_set1_ps(dy);
+        const __m256 vgm = _mm256_set1_ps(gm);
+        const __m256 limit = _mm256_set1_ps(rlimit2);
+        const __m256 half = _mm256_set1_ps(0.5f);
+        const __m256 three_halves = _mm256_set1_ps(1.5f);
+        __m256 ax = _mm256_setzero_ps();
+        __m256 ay = _mm256_setzero_ps();
+
+        for (; i + 8 <= count; i += 8) {
+            __m256 sx = _mm256_add_ps(_mm256_loadu_ps(x_offset + i), ox);
+            __m256 sy = _mm256_add_ps(_mm256_loadu_ps(y_offset + i), oy);
+            __m256 m = _mm256_loadu_ps(mass + i);
+
+            __m256 r2 = _mm256_max_ps(_mm256_add_ps(_mm256_mul_ps(sx, sx), _mm256_mul_ps(sy, sy)), limit);
+            __m256 inverse = _mm256_rsqrt_ps(r2);
+            inverse = _mm256_mul_ps(inverse, _mm256_sub_ps(three_halves,
+                                    _mm256_mul_ps(_mm256_mul_ps(half, r2), _mm256_mul_ps(inverse, inverse))));
+            __m256 cube = _mm256_mul_ps(_mm256_mul_ps(inverse, inverse), inverse);
+
+            __m256 scale = _mm256_mul_ps(_mm256_mul_ps(vgm, m), cube);
+            ax = _mm256_add_ps(ax, _mm256_mul_ps(scale, sx));
+            ay = _mm256_add_ps(ay, _mm256_mul_ps(scale, sy));
+        }
+
+        float lanes_x[8];
+        float lanes_y[8];
+        _mm256_storeu_ps(lanes_x, ax);
+        _mm256_storeu_ps(lanes_y, ay);
+        for (int l = 0; l < 8; l++) {
+            fx += lanes_x[l];
+            fy += lanes_y[l];
+        }
+    }
+#endif
+
+    // Scalar path for short runs and the tail
+    for (; i < count; i++) {
+        float sx = dx + x_offset[i];
+        float sy = dy + y_offset[i];
+        float r2 = (sx * sx) + (sy * sy);
+        float inverse = single_inverse_sqrt(r2 > rlimit2 ? r2 : rlimit2);
+        float scale = gm * mass[i] * (inverse * inverse * inverse);
+        fx += scale * sx;
+        fy += scale * sy;
+    }
+
+    *x_force += (double)fx;
+    *y_force += (double)fy;
+}
+
+const char* kernel_isa(void) {
+#if defined(__AVX512F__)
+    return "AVX-512";
+#elif defined(__AVX2__)
+    return "AVX2";
+#else
+    return "scalar";
+#endif
+}
@@ -0,0 +1,65 @@
+#ifndef KERNEL_H
+#define KERNEL_H
+
+#include <math.h>
+
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+
+#include "tree.h"
+
+// Add the force on one target from a contiguous run of source particles. The
+// RLIMIT clamp is a max() so every lane follows the same path, and a source at
+// the target's own position contributes exactly zero.
+void leaf_kernel(const double* x_pos, const double* y_pos, const double* mass, int count,
+                 double target_x, double target_y, double target_mass,
+                 double* x_force, double* y_force);
+
+// Add the quadrupole term of a cell on a target at offset (rx, ry) from the
+// cell's center of mass, with distance the (clamped) length of that offset.
+// From the potential -G (M / r + r^T Q r / (2 r^5)) the force on the target is
+// G m (Q r / r^5 - 5/2 (r^T Q r) r / r^7) on top of the monopole term.
+static inline void quadrupole_force(double rx, double ry, double distance,
+                                    double qxx, double qxy, double qyy, double target_mass,
+                                    double* x_force, double* y_force) {
+    double qrx = (qxx * rx) + (qxy * ry);
+    double qry = (qxy * rx) + (qyy * ry);
+    double rqr = (rx * qrx) + (ry * qry);
+    double d2 = distance * distance;
+    double d5 = d2 * d2 * distance;
+    double scale = G * target_mass / d5;
+    double radial = 2.5 * rqr / d2;
+    *x_force += scale * (qrx - radial * rx);
+    *y_force += scale * (qry - radial * ry);
+}
+
+// Add the monopole and quadrupole force of a run of cells on one target
+void quadrupole_kernel(const double* x_pos, const double* y_pos, const double* mass,
+                       const double* qxx, const double* qxy, const double* qyy, int count,
+                       double target_x, double target_y, double target_mass,
+                       double* x_force, double* y_force);
+
+// Reciprocal square root for the mixed precision walk: the hardware estimate
+// refined by one Newton step, about 22 bits
+static inline float single_inverse_sqrt(float x) {
+#if defined(__SSE__)
+    float estimate = _mm_cvtss_f32(_mm_rsqrt_ss(_mm_set_ss(x)));
+    return estimate * (1.5f - 0.5f * x * estimate * estimate);
+#else
+    return 1.0f / sqrtf(x);
+#endif
+}
+
+// Mixed precision leaf kernel. The sources are given as float offsets from
+// the leaf's center of mass and (dx, dy) is the offset of that center from
+// the target, so each source sits at (dx + x_offset[i], dy + y_offset[i]).
+// gm is G times the target's mass. Each leaf is summed in float and added to
+// the double force.
+void leaf_kernel_single(const float* x_offset, const float* y_offset, const float* mass, int count,
+                        float dx, float dy, float gm, double* x_force, double* y_force);
+
+// Name of the instruction set the kernel was compiled for
+const char* kernel_isa(void);
+
+#endif // KERNEL_H
@@ -3,162 +3,93 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "checkpoint.h"
 #include "io.h"
-#include "tree.h"
+#include "simulation.h"
+#include "threads.h"
+
+// The nbody executable: parse the command line on rank 0 and hand the run to
+// the library, see simulation.h
 
-#define DEFAULT_BOUNDARY_SIZE 4.0
 
 int main(int argc, char **argv){
 
 
     // MPI Variables and Initilization
-    int rank, size;
-    MPI_Init(&argc, &argv);
+    int rank, size, provided;
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
     MPI_Comm_size(MPI_COMM_WORLD, &size);
-    
+
+    // Worker threads never call MPI, but the library must tolerate them
+    if (provided < MPI_THREAD_FUNNELED) {
+        if (rank == 0) fprintf(stderr, "MPI library does not support MPI_THREAD_FUNNELED\n");
+        MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+    }
+
     // Start the timer
     double start_time = MPI_Wtime();
 
     // Cmd Line Arg Initilization
-    char *in_file = NULL;
-    char *out_file = NULL;
-    int step_count = 0, visualize = 0, dbg_print = 0;
-    double theta = 0, time_step = 0;
+    Options opts;
+    memset(&opts, 0, sizeof(Options));
 
     // Parse Command Line Arguments and Assign values
     if (rank == 0) {
-        argument_parse(argc, argv, &in_file, &out_file, &step_count, &theta, &time_step, &visualize, &dbg_print);
+        argument_parse(argc, argv, &opts);
+        if (opts.restart) load_checkpoint_options(opts.in_file, &opts, size);
 
         // Debug Printing Statements
-        if (dbg_print > 0) {
+        if (opts.print_debug_flag > 0 && !opts.ensemble_file) {
             printf("\nParsed Command-Line Arguments and Settings:\n");
             printf("Process ID: %d\n", rank);
             printf("MPI Size: %d\n", size);
-            printf("Input File: %s\n", in_file);
-            printf("Output File: %s\n", out_file);
-            printf("Number of Steps: %d\n", step_count);
-            printf("Theta (MAC Threshold): %lf\n", theta);
-            printf("Time Step (dt): %lf\n", time_step);
-            printf("Visualization Flag: %s\n", visualize ? "Enabled" : "Disabled");
-            printf("Debug Printing Flag: %s | Log level: %d\n\n", dbg_print ? "Enabled" : "Disabled", dbg_print);
-        }
-    }
-
-    // Barnes-hut variables (tree and particles)
-    int particle_count = 0;
-    Particle* particles;
-
-    // Default center location and boundaries
-    double cen = DEFAULT_BOUNDARY_SIZE / 2;
-    Boundary default_bounds = create_bounds(DEFAULT_BOUNDARY_SIZE, cen, cen);
-
-    // Define the root node
-    BHTreeNode* root_node;
-
-    // In the main thread
-    if (rank == 0) {
-        // Read the input file and return a list of particles
-        particles = read_input_file(in_file, &particle_count);
-
-        // Debug Print Statements
-        if (dbg_print >= 5) {
-            printf("Particles: %d\n", particle_count);
-            for(int i = 0; i < particle_count; i++) {
-                Particle* p = &particles[i];
-
-                // printf("Particle #%d: (%e, %e) | M: %e | (%e, %e)\n", p->index, p->x_pos, p->y_pos, p->mass, p->x_vel, p->y_vel);
-                printf("Particle #%d: (%lf, %lf) | M: %e | (%e, %e)\n", p->index, p->x_pos, p->y_pos, p->mass, p->x_vel, p->y_vel);
-
-            }
+            printf("Input File: %s\n", opts.in_file);
+            printf("Output File: %s\n", opts.out_file);
+            printf("Number of Steps: %d\n", opts.steps);
+            printf("Theta (MAC Threshold): %lf\n", opts.theta);
+            printf("Time Step (dt): %lf\n", opts.time_step);
+            printf("Visualization Flag: %s\n", opts.visualization_flag == FRAMES_NODES ? "Enabled (with tree nodes)" : opts.visualization_flag ? "Enabled" : "Disabled");
+            printf("Debug Printing Flag: %s | Log level: %d\n", opts.print_debug_flag ? "Enabled" : "Disabled", opts.print_debug_flag);
+            printf("Mode: %s\n", opts.mode == MODE_DISTRIBUTED ? "Distributed" : "Replicated");
+            printf("Tree Builder: %s\n", opts.builder == BUILDER_MORTON ? "Morton" : "Insert");
+            printf("Leaf Size: %d\n", opts.leaf_size);
+            printf("Threads per Rank: %d\n", opts.threads);
+            printf("Group Size: %d\n", opts.group_size);
+            printf("Quadrupoles: %s\n", opts.quadrupoles ? "Enabled" : "Disabled");
+            printf("Mixed Precision: %s\n", opts.single_precision ? "Enabled" : "Disabled");
+            printf("Refit Threshold: %lf\n", opts.refit_threshold);
+            printf("Balance Threshold: %lf\n", opts.balance_threshold);
+            printf("Block Timestep Levels: %d | eta: %lf\n", opts.block_levels, opts.block_eta);
+            printf("Node-Shared Tree: %s | Ranks per node: %d\n", opts.node_ranks ? "Enabled" : "Disabled", opts.node_ranks);
+            printf("All-Pairs Sum: %s | Below: %d particles\n", opts.direct_below ? "Enabled" : "Disabled", opts.direct_below);
+            printf("Checkpoints: every %d steps | every %lf seconds\n", opts.checkpoint_steps, opts.checkpoint_seconds);
+            printf("Restart: %s | From step: %d\n\n", opts.restart ? "Enabled" : "Disabled", opts.start_step);
         }
     }
 
-    // Run Barnes-Hut nbody seqientially
-    if (size > 0) {
-        // Debug Print statement
-        if (dbg_print > 0) printf("Running seqientially\n");
-
-        // Conduct the algorithm for n-steps 
-        for (int step = 0; step < step_count; step++) {
-            if (dbg_print > 0) printf("Step %d out of %d\n", step, step_count);
-
-            // Generate the root node
-            BHTreeNode* root_node = create_tree_node(default_bounds);
-
-            if (dbg_print >= 5) print_node_data(root_node);
-
-            // Build the BH Quadtree
-            for (int p = 0; p < particle_count; p++) {
-                int success = insert_node(root_node, &particles[p]);
-                if (dbg_print >= 5) {
-                    printf("Inserting Particle #%d\n", particles[p].index);
-                    if (!success) {
-                        printf("Failed to insert particle #%d\n", particles[p].index);
-                    } else {
-                        printf("Successfully inserted particle #%d\n\n", particles[p].index);
-                    }
-
-                }
-            }
-
-            // aggregate_data(root_node);
-
-            // Compute the forces on each particle
-            for (int p = 0; p < particle_count; p++) {
-                // Reset particle force components
-                particles[p].x_force = 0.0;
-                particles[p].y_force = 0.0;
-                
-                // Compute new forces
-                compute_force(root_node, &particles[p], theta);
-            }
-
-            // Update the particles based on forces from other particles
-            for (int p = 0; p < particle_count; p++) {
-                update_particle(&particles[p], time_step, DEFAULT_BOUNDARY_SIZE);
-            }
-
-            // Clean the tree and memory
-            destroy_tree_node(root_node);
+    // Broadcast input parameters to all processes
+    broadcast_options(&opts, rank);
 
-        }
+    // Threads that share this rank's force and update work
+    ThreadPool* pool = create_thread_pool(opts.threads);
 
+    if (opts.ensemble_file) {
+        run_ensemble(argc, argv, &opts, pool, start_time);
+    } else {
+        run_simulation(MPI_COMM_WORLD, &opts, pool, start_time);
     }
-    // Run Barnes-Hut in Parallel with MPI
-    else {
-        // Broadcast input parameters to all processes
-        int in_file_len = (rank == 0) ? strlen(in_file) + 1 : 0;
-        MPI_Bcast(&in_file_len, 1, MPI_INT, 0, MPI_COMM_WORLD);
-        if (rank != 0) in_file = (char *)malloc(in_file_len * sizeof(char));
-        MPI_Bcast(in_file, in_file_len, MPI_CHAR, 0, MPI_COMM_WORLD);
-
-        int out_file_len = (rank == 0) ? strlen(out_file) + 1 : 0;
-        MPI_Bcast(&out_file_len, 1, MPI_INT, 0, MPI_COMM_WORLD);
-        if (rank != 0) out_file = (char *)malloc(out_file_len * sizeof(char));
-        MPI_Bcast(out_file, out_file_len, MPI_CHAR, 0, MPI_COMM_WORLD);
-
-        MPI_Bcast(&step_count, 1, MPI_INT, 0, MPI_COMM_WORLD);
-        MPI_Bcast(&theta, 1, MPI_DOUBLE, 0, MPI_COMM_WORLD);
-        MPI_Bcast(&time_step, 1, MPI_DOUBLE, 0, MPI_COMM_WORLD);
-        MPI_Bcast(&dbg_print, 1, MPI_INT, 0, MPI_COMM_WORLD);
-    }
-
-
-    if (rank == 0) write_output_file(out_file, particles, particle_count);
-
+    destroy_thread_pool(pool);
 
     // Cleanup Memory and MPI
     if (rank != 0) {
-        free(particles);
-        free(in_file);
-        free(out_file);
+        free(opts.in_file);
+        free(opts.out_file);
+        free(opts.report_file);
+        free(opts.ensemble_file);
     }
 
-    double end_time = MPI_Wtime();
-    printf("%f\n", end_time - start_time);
-
     MPI_Finalize();
 
     return 0;
-}
\ No newline at end of file
+}
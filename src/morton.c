@@ -0,0 +1,536 @@
+
+#include "morton.h"
+
+void reserve_morton_workspace(MortonWorkspace* ws, int count) {
+    if (count <= ws->capacity) return;
+
+    ws->capacity = count;
+    ws->keys = (uint64_t*)realloc(ws->keys, count * sizeof(uint64_t));
+    ws->order = (int*)realloc(ws->order, count * sizeof(int));
+    ws->key_tmp = (uint64_t*)realloc(ws->key_tmp, count * sizeof(uint64_t));
+    ws->order_tmp = (int*)realloc(ws->order_tmp, count * sizeof(int));
+    if (!ws->keys || !ws->order || !ws->key_tmp || !ws->order_tmp) {
+        perror("Memory allocation error");
+        exit(EXIT_FAILURE);
+    }
+}
+
+MortonWorkspace* create_morton_workspace(int capacity) {
+    MortonWorkspace* ws = (MortonWorkspace*)calloc(1, sizeof(MortonWorkspace));
+    if (ws == NULL) {
+        perror("Memory allocation error");
+        exit(EXIT_FAILURE);
+    }
+    reserve_morton_workspace(ws, capacity);
+    return ws;
+}
+
+// Spread the low 32 bits of v so that a zero bit sits between each of them
+static uint64_t spread_bits(uint64_t v) {
+    v &= 0xffffffffULL;
+    v = (v | (v << 16)) & 0x0000ffff0000ffffULL;
+    v = (v | (v << 8)) & 0x00ff00ff00ff00ffULL;
+    v = (v | (v << 4)) & 0x0f0f0f0f0f0f0f0fULL;
+    v = (v | (v << 2)) & 0x3333333333333333ULL;
+    v = (v | (v << 1)) & 0x5555555555555555ULL;
+    return v;
+}
+
+// Interleave the quantized coordinates so each pair of bits picks a quadrant:
+// 0 = NW, 1 = NE, 2 = SW, 3 = SE, matching the child order of subdivide.
+// The domain side is a power of two times the grid so quantization is exact
+// and cells line up with the ones insert_node builds.
+uint64_t morton_key(double x_pos, double y_pos, double bounds_size) {
+    double scale = (double)(1ULL << MORTON_BITS) / bounds_size;
+    uint64_t ix = (uint64_t)(x_pos * scale);
+    uint64_t iy = (uint64_t)(y_pos * scale);
+    return spread_bits(ix) | (spread_bits(iy) << 1);
+}
+
+// Lost particles and particles outside the domain are not in the tree
+static int is_keyed(const ParticleSoA* particles, int i, double bounds_size) {
+    double x_pos = particles->x_pos[i];
+    double y_pos = particles->y_pos[i];
+    return !(particles->mass[i] < 0 ||
+             x_pos < 0 || x_pos >= bounds_size ||
+             y_pos < 0 || y_pos >= bounds_size);
+}
+
+// Compute keys for every particle that insert_node would accept. Returns how
+// many particles were keyed.
+int compute_morton_keys(MortonWorkspace* ws, const ParticleSoA* particles, double bounds_size) {
+    reserve_morton_workspace(ws, particles->count);
+
+    int keyed = 0;
+    for (int i = 0; i < particles->count; i++) {
+        if (!is_keyed(particles, i, bounds_size)) continue;
+
+        ws->keys[keyed] = morton_key(particles->x_pos[i], particles->y_pos[i], bounds_size);
+        ws->order[keyed] = i;
+        keyed += 1;
+    }
+    return keyed;
+}
+
+// LSD radix sort of (key, index) pairs on the low key_bits bits. Passes over
+// digits that are the same for every key are skipped. The sorted data ends up
+// back in keys/order.
+void sort_morton_keys(uint64_t* keys, int* order, uint64_t* key_tmp, int* order_tmp, int count, int key_bits) {
+    const int buckets = 1 << RADIX_BITS;
+    const uint64_t mask = buckets - 1;
+    int histogram[1 << RADIX_BITS];
+
+    uint64_t* src_keys = keys;
+    int* src_order = order;
+    uint64_t* dst_keys = key_tmp;
+    int* dst_order = order_tmp;
+
+    for (int shift = 0; shift < key_bits; shift += RADIX_BITS) {
+        memset(histogram, 0, sizeof(histogram));
+        for (int i = 0; i < count; i++) {
+            histogram[(src_keys[i] >> shift) & mask] += 1;
+        }
+
+        // Nothing to reorder if every key shares this digit
+        if (count == 0 || histogram[(src_keys[0] >> shift) & mask] == count) continue;
+
+        int offset = 0;
+        for (int b = 0; b < buckets; b++) {
+            int n = histogram[b];
+            histogram[b] = offset;
+            offset += n;
+        }
+
+        for (int i = 0; i < count; i++) {
+            int slot = histogram[(src_keys[i] >> shift) & mask]++;
+            dst_keys[slot] = src_keys[i];
+            dst_order[slot] = src_order[i];
+        }
+
+        uint64_t* swap_keys = src_keys;
+        src_keys = dst_keys;
+        dst_keys = swap_keys;
+        int* swap_order = src_order;
+        src_order = dst_order;
+        dst_order = swap_order;
+    }
+
+    if (src_keys != keys) {
+        memcpy(keys, src_keys, count * sizeof(uint64_t));
+        memcpy(order, src_order, count * sizeof(int));
+    }
+}
+
+// Find the end of the run of sorted entries in [start, last) whose quadrant
+// digit at shift is at most quadrant. Entries of one cell share every digit
+// above shift, so the digits are non-decreasing and a binary search works.
+static int quadrant_end(const uint64_t* keys, int start, int last, int shift, uint64_t quadrant) {
+    while (start < last) {
+        int mid = start + (last - start) / 2;
+        if (((keys[mid] >> shift) & 3) <= quadrant) {
+            start = mid + 1;
+        } else {
+            last = mid;
+        }
+    }
+    return start;
+}
+
+// Emit the cell holding sorted entries [first, last) at the given depth and
+// then its non-empty children in quadrant order. Cells with at most leaf_size
+// particles, or that cannot be split any further, become leaf buckets.
+static void emit_morton_cell(const MortonWorkspace* ws, int first, int last, int depth, double size, int leaf_size, FlatTree* tree) {
+    int index = tree->count;
+    FlatNode* node = append_flat_node(tree);
+    node->size = size;
+    node->first = first;
+    node->count = last - first;
+
+    if (last - first > leaf_size && depth < MORTON_BITS) {
+        int shift = 2 * (MORTON_BITS - 1 - depth);
+        int start = first;
+        for (uint64_t quadrant = 0; quadrant < 4 && start < last; quadrant++) {
+            int end = quadrant_end(ws->keys, start, last, shift, quadrant);
+            if (end > start) emit_morton_cell(ws, start, end, depth + 1, size * 0.5, leaf_size, tree);
+            start = end;
+        }
+    }
+
+    tree->nodes[index].next = tree->count;
+}
+
+// Combine the children (or bucket particles) of node i the same way
+// aggregate_data does. The children must already be final.
+static void aggregate_flat_node(FlatTree* tree, int i) {
+    FlatNode* node = &tree->nodes[i];
+
+    // A single particle is its own center of mass
+    if (node->count == 1) {
+        node->mass = tree->mass[node->first];
+        node->x_com = tree->x_pos[node->first];
+        node->y_com = tree->y_pos[node->first];
+        return;
+    }
+
+    double total_mass = 0.0;
+    double weighted_x = 0.0;
+    double weighted_y = 0.0;
+    if (node->next == i + 1) {
+        for (int s = node->first; s < node->first + node->count; s++) {
+            total_mass += tree->mass[s];
+            weighted_x += tree->x_pos[s] * tree->mass[s];
+            weighted_y += tree->y_pos[s] * tree->mass[s];
+        }
+    } else {
+        for (int c = i + 1; c < node->next; c = tree->nodes[c].next) {
+            const FlatNode* child = &tree->nodes[c];
+            total_mass += child->mass;
+            weighted_x += child->x_com * child->mass;
+            weighted_y += child->y_com * child->mass;
+        }
+    }
+
+    if (total_mass > 0) {
+        node->x_com = weighted_x / total_mass;
+        node->y_com = weighted_y / total_mass;
+    } else {
+        node->x_com = 0.0;
+        node->y_com = 0.0;
+    }
+    node->mass = total_mass;
+}
+
+// Fill in masses and centers of mass with one sweep from the last node back to
+// the root, so every child is final before its parent reads it
+void aggregate_flat_tree(FlatTree* tree) {
+    for (int i = tree->count - 1; i >= 0; i--) {
+        aggregate_flat_node(tree, i);
+    }
+}
+
+// Shared state of one parallel build
+typedef struct {
+    MortonWorkspace* ws;
+    const ParticleSoA* particles;
+    FlatTree* tree;
+    int leaf_size;
+    int grain;          // Cells with at most this many particles become tasks
+    int block_count;    // Fixed blocks of the key and scatter passes
+    int* block_keyed;   // Keyed particles per block
+    int* histograms;    // Top digit histogram per block, then scatter offsets
+    int* bucket_first;  // First sorted entry of each top digit bucket, plus the end
+} MortonBuild;
+
+static void block_range(int count, int block_count, int block, int* first, int* last) {
+    *first = (int)((long long)count * block / block_count);
+    *last = (int)((long long)count * (block + 1) / block_count);
+}
+
+// Key each block of particles into the scratch buffers at the block's own
+// start and count the top digits of its keys
+static void key_blocks(void* context, int first_block, int last_block) {
+    MortonBuild* build = (MortonBuild*)context;
+    MortonWorkspace* ws = build->ws;
+    const ParticleSoA* particles = build->particles;
+
+    for (int b = first_block; b < last_block; b++) {
+        int first, last;
+        block_range(particles->count, build->block_count, b, &first, &last);
+
+        int* histogram = &build->histograms[b << RADIX_BITS];
+        memset(histogram, 0, (1 << RADIX_BITS) * sizeof(int));
+
+        int keyed = first;
+        for (int i = first; i < last; i++) {
+            if (!is_keyed(particles, i, DEFAULT_BOUNDARY_SIZE)) continue;
+
+            uint64_t key = morton_key(particles->x_pos[i], particles->y_pos[i], DEFAULT_BOUNDARY_SIZE);
+            ws->key_tmp[keyed] = key;
+            ws->order_tmp[keyed] = i;
+            histogram[key >> MORTON_TOP_SHIFT] += 1;
+            keyed += 1;
+        }
+        build->block_keyed[b] = keyed - first;
+    }
+}
+
+// Move each block's keys to their top digit bucket. Blocks fill each bucket in
+// block order, so the result is the same as a stable sort on the top digit.
+static void scatter_blocks(void* context, int first_block, int last_block) {
+    MortonBuild* build = (MortonBuild*)context;
+    MortonWorkspace* ws = build->ws;
+
+    for (int b = first_block; b < last_block; b++) {
+        int first, last;
+        block_range(build->particles->count, build->block_count, b, &first, &last);
+
+        int* offsets = &build->histograms[b << RADIX_BITS];
+        for (int i = first; i < first + build->block_keyed[b]; i++) {
+            uint64_t key = ws->key_tmp[i];
+            int slot = offsets[key >> MORTON_TOP_SHIFT]++;
+            ws->keys[slot] = key;
+            ws->order[slot] = ws->order_tmp[i];
+        }
+    }
+}
+
+// Finish sorting each top digit bucket on the remaining bits
+static void sort_buckets(void* context, int first_bucket, int last_bucket) {
+    MortonBuild* build = (MortonBuild*)context;
+    MortonWorkspace* ws = build->ws;
+
+    for (int d = first_bucket; d < last_bucket; d++) {
+        int start = build->bucket_first[d];
+        sort_morton_keys(ws->keys + start, ws->order + start, ws->key_tmp + start, ws->order_tmp + start,
+                         build->bucket_first[d + 1] - start, MORTON_TOP_SHIFT);
+    }
+}
+
+// Copy positions and masses into tree order
+static void gather_slots(void* context, int first, int last) {
+    MortonBuild* build = (MortonBuild*)context;
+    FlatTree* tree = build->tree;
+    const ParticleSoA* particles = build->particles;
+
+    for (int s = first; s < last; s++) {
+        int p = build->ws->order[s];
+        tree->order[s] = p;
+        tree->x_pos[s] = particles->x_pos[p];
+        tree->y_pos[s] = particles->y_pos[p];
+        tree->mass[s] = particles->mass[p];
+    }
+}
+
+static int is_task(int first, int last, int depth, int grain) {
+    return last - first <= grain || depth == MORTON_BITS;
+}
+
+static MortonTask* add_morton_task(MortonWorkspace* ws) {
+    if (ws->task_count == ws->task_capacity) {
+        int capacity = ws->task_capacity > 0 ? 2 * ws->task_capacity : 64;
+        ws->tasks = (MortonTask*)realloc(ws->tasks, capacity * sizeof(MortonTask));
+        if (ws->tasks == NULL) {
+            perror("Memory allocation error");
+            exit(EXIT_FAILURE);
+        }
+        for (int t = ws->task_capacity; t < capacity; t++) {
+            ws->tasks[t].capacity = 64;
+            ws->tasks[t].nodes = (FlatNode*)malloc(ws->tasks[t].capacity * sizeof(FlatNode));
+            if (ws->tasks[t].nodes == NULL) {
+                perror("Memory allocation error");
+                exit(EXIT_FAILURE);
+            }
+        }
+        ws->task_capacity = capacity;
+    }
+    return &ws->tasks[ws->task_count++];
+}
+
+// Split the upper levels of the tree into subtrees, in preorder, and count the
+// nodes above them
+static void plan_morton_tasks(MortonWorkspace* ws, int first, int last, int depth, double size, int grain) {
+    if (is_task(first, last, depth, grain)) {
+        MortonTask* task = add_morton_task(ws);
+        task->first = first;
+        task->last = last;
+        task->depth = depth;
+        task->size = size;
+        return;
+    }
+
+    ws->top_count += 1;
+    int shift = 2 * (MORTON_BITS - 1 - depth);
+    int start = first;
+    for (uint64_t quadrant = 0; quadrant < 4 && start < last; quadrant++) {
+        int end = quadrant_end(ws->keys, start, last, shift, quadrant);
+        if (end > start) plan_morton_tasks(ws, start, end, depth + 1, size * 0.5, grain);
+        start = end;
+    }
+}
+
+// Build each subtree into its task's own node array, with the particle
+// columns of the shared tree
+static void build_tasks(void* context, int first_task, int last_task) {
+    MortonBuild* build = (MortonBuild*)context;
+
+    for (int t = first_task; t < last_task; t++) {
+        MortonTask* task = &build->ws->tasks[t];
+
+        FlatTree view = *build->tree;
+        view.borrowed = 0;
+        view.nodes = task->nodes;
+        view.count = 0;
+        view.capacity = task->capacity;
+
+        emit_morton_cell(build->ws, task->first, task->last, task->depth, task->size, build->leaf_size, &view);
+        aggregate_flat_tree(&view);
+
+        task->nodes = view.nodes;
+        task->capacity = view.capacity;
+        task->count = view.count;
+    }
+}
+
+// Emit the nodes above the subtrees and leave room for each subtree where it
+// belongs in preorder. Mirrors plan_morton_tasks.
+static void stitch_morton_cell(MortonWorkspace* ws, int first, int last, int depth, double size, int grain, FlatTree* tree, int* task) {
+    if (is_task(first, last, depth, grain)) {
+        MortonTask* subtree = &ws->tasks[(*task)++];
+        subtree->offset = tree->count;
+        tree->count += subtree->count;
+        return;
+    }
+
+    int index = tree->count++;
+    ws->top_nodes[ws->top_count++] = index;
+    tree->nodes[index].size = size;
+    tree->nodes[index].first = first;
+    tree->nodes[index].count = last - first;
+
+    int shift = 2 * (MORTON_BITS - 1 - depth);
+    int start = first;
+    for (uint64_t quadrant = 0; quadrant < 4 && start < last; quadrant++) {
+        int end = quadrant_end(ws->keys, start, last, shift, quadrant);
+        if (end > start) stitch_morton_cell(ws, start, end, depth + 1, size * 0.5, grain, tree, task);
+        start = end;
+    }
+
+    tree->nodes[index].next = tree->count;
+}
+
+// Move each subtree into the shared tree, rebasing its links
+static void copy_tasks(void* context, int first_task, int last_task) {
+    MortonBuild* build = (MortonBuild*)context;
+    FlatTree* tree = build->tree;
+
+    for (int t = first_task; t < last_task; t++) {
+        const MortonTask* task = &build->ws->tasks[t];
+        FlatNode* nodes = &tree->nodes[task->offset];
+        memcpy(nodes, task->nodes, task->count * sizeof(FlatNode));
+        for (int k = 0; k < task->count; k++) {
+            nodes[k].next += task->offset;
+        }
+    }
+}
+
+// Parallel version of the build below. Keys are computed and split on their
+// top digit in fixed blocks, the buckets are sorted independently, and the
+// tree is cut into subtrees that threads build and aggregate on their own.
+// Only the few nodes above the subtrees are emitted and aggregated serially.
+// Every node ends up with the same contents as in the serial build.
+static void build_morton_tree_parallel(MortonWorkspace* ws, ThreadPool* pool, const ParticleSoA* particles, int leaf_size, FlatTree* tree) {
+    const int buckets = 1 << RADIX_BITS;
+    reserve_morton_workspace(ws, particles->count);
+
+    MortonBuild build;
+    build.ws = ws;
+    build.particles = particles;
+    build.tree = tree;
+    build.leaf_size = leaf_size;
+    build.block_count = pool->thread_count;
+    build.block_keyed = (int*)malloc(build.block_count * sizeof(int));
+    build.histograms = (int*)malloc(build.block_count * buckets * sizeof(int));
+    build.bucket_first = (int*)malloc((buckets + 1) * sizeof(int));
+    if (!build.block_keyed || !build.histograms || !build.bucket_first) {
+        perror("Memory allocation error");
+        exit(EXIT_FAILURE);
+    }
+
+    parallel_for(pool, 0, build.block_count, 1, key_blocks, &build);
+
+    // Turn the per block histograms into scatter offsets, bucket by bucket
+    int keyed = 0;
+    for (int d = 0; d < buckets; d++) {
+        build.bucket_first[d] = keyed;
+        for (int b = 0; b < build.block_count; b++) {
+            int n = build.histograms[(b << RADIX_BITS) + d];
+            build.histograms[(b << RADIX_BITS) + d] = keyed;
+            keyed += n;
+        }
+    }
+    build.bucket_first[buckets] = keyed;
+
+    parallel_for(pool, 0, build.block_count, 1, scatter_blocks, &build);
+    parallel_for(pool, 0, buckets, 1, sort_buckets, &build);
+
+    // The sorted order is the tree order
+    reserve_tree_particles(tree, particles->count);
+    tree->particle_count = keyed;
+    parallel_for(pool, 0, keyed, 4096, gather_slots, &build);
+
+    tree->count = 0;
+    if (keyed > 0) {
+        build.grain = keyed / (pool->thread_count * MORTON_TASKS_PER_THREAD);
+        if (build.grain < MORTON_MIN_TASK) build.grain = MORTON_MIN_TASK;
+        if (build.grain < leaf_size) build.grain = leaf_size;
+
+        ws->task_count = 0;
+        ws->top_count = 0;
+        plan_morton_tasks(ws, 0, keyed, 0, DEFAULT_BOUNDARY_SIZE, build.grain);
+        if (ws->top_count > ws->top_capacity) {
+            ws->top_capacity = ws->top_count;
+            ws->top_nodes = (int*)realloc(ws->top_nodes, ws->top_capacity * sizeof(int));
+            if (ws->top_nodes == NULL) {
+                perror("Memory allocation error");
+                exit(EXIT_FAILURE);
+            }
+        }
+
+        parallel_for(pool, 0, ws->task_count, 1, build_tasks, &build);
+
+        int total = ws->top_count;
+        for (int t = 0; t < ws->task_count; t++) total += ws->tasks[t].count;
+        reserve_flat_nodes(tree, total);
+
+        int task = 0;
+        ws->top_count = 0;
+        stitch_morton_cell(ws, 0, keyed, 0, DEFAULT_BOUNDARY_SIZE, build.grain, tree, &task);
+        parallel_for(pool, 0, ws->task_count, 1, copy_tasks, &build);
+
+        // Children come after their parent in preorder
+        for (int k = ws->top_count - 1; k >= 0; k--) {
+            aggregate_flat_node(tree, ws->top_nodes[k]);
+        }
+    }
+
+    free(build.block_keyed);
+    free(build.histograms);
+    free(build.bucket_first);
+}
+
+// Build the flat tree bottom-up from Morton-sorted particles instead of
+// inserting them one at a time. With more than one thread in the pool the work
+// is shared out, small inputs are not worth the hand-off.
+void build_morton_tree(MortonWorkspace* ws, ThreadPool* pool, const ParticleSoA* particles, int leaf_size, FlatTree* tree) {
+    if (pool != NULL && pool->thread_count > 1 && particles->count >= 2 * MORTON_MIN_TASK) {
+        build_morton_tree_parallel(ws, pool, particles, leaf_size, tree);
+        return;
+    }
+
+    int keyed = compute_morton_keys(ws, particles, DEFAULT_BOUNDARY_SIZE);
+    sort_morton_keys(ws->keys, ws->order, ws->key_tmp, ws->order_tmp, keyed, 2 * MORTON_BITS);
+
+    // The sorted order is the tree order
+    reserve_tree_particles(tree, particles->count);
+    memcpy(tree->order, ws->order, keyed * sizeof(int));
+    tree->particle_count = keyed;
+    gather_tree_particles(tree, particles);
+
+    tree->count = 0;
+    if (keyed > 0) emit_morton_cell(ws, 0, keyed, 0, DEFAULT_BOUNDARY_SIZE, leaf_size, tree);
+    aggregate_flat_tree(tree);
+}
+
+void destroy_morton_workspace(MortonWorkspace* ws) {
+    if (ws == NULL) return;
+    free(ws->keys);
+    free(ws->order);
+    free(ws->key_tmp);
+    free(ws->order_tmp);
+    for (int t = 0; t < ws->task_capacity; t++) {
+        free(ws->tasks[t].nodes);
+    }
+    free(ws->tasks);
+    free(ws->top_nodes);
+    free(ws);
+}
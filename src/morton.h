@@ -0,0 +1,66 @@
+#ifndef MORTON_H
+#define MORTON_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "flat_tree.h"
+#include "particle.h"
+#include "threads.h"
+
+// Bits of resolution per axis, this is also the deepest tree level
+#define MORTON_BITS 31
+
+// Radix sort digit width
+#define RADIX_BITS 8
+
+// The parallel build splits on the top radix digit first, then sorts each
+// bucket over the remaining bits
+#define MORTON_TOP_SHIFT (2 * MORTON_BITS - RADIX_BITS)
+
+// Subtrees built by one thread hold at least this many particles, and each
+// thread gets roughly MORTON_TASKS_PER_THREAD of them to balance the load
+#define MORTON_MIN_TASK 1024
+#define MORTON_TASKS_PER_THREAD 8
+
+// Subtree built by one thread of the parallel builder. Its nodes link to each
+// other relative to the task, and are moved into the shared tree afterwards.
+typedef struct {
+    int first;        // First sorted entry of the subtree
+    int last;         // One past the last sorted entry
+    int depth;        // Depth of the subtree root
+    double size;      // Side length of the subtree root cell
+    int offset;       // Index of the subtree root in the shared tree
+    FlatNode* nodes;  // Nodes in preorder, next relative to the task
+    int count;
+    int capacity;
+} MortonTask;
+
+// Scratch buffers for Morton ordering, grown on demand and kept between steps
+typedef struct {
+    uint64_t* keys;      // Morton key per sorted entry
+    int* order;          // Particle index per sorted entry
+    uint64_t* key_tmp;   // Radix sort scratch
+    int* order_tmp;      // Radix sort scratch
+    int capacity;
+
+    MortonTask* tasks;   // Subtrees of the parallel build, storage is kept
+    int task_count;
+    int task_capacity;
+    int* top_nodes;      // Nodes above the subtrees, in preorder
+    int top_count;
+    int top_capacity;
+} MortonWorkspace;
+
+MortonWorkspace* create_morton_workspace(int capacity);
+void reserve_morton_workspace(MortonWorkspace* ws, int count);
+uint64_t morton_key(double x_pos, double y_pos, double bounds_size);
+int compute_morton_keys(MortonWorkspace* ws, const ParticleSoA* particles, double bounds_size);
+void sort_morton_keys(uint64_t* keys, int* order, uint64_t* key_tmp, int* order_tmp, int count, int key_bits);
+void build_morton_tree(MortonWorkspace* ws, ThreadPool* pool, const ParticleSoA* particles, int leaf_size, FlatTree* tree);
+void aggregate_flat_tree(FlatTree* tree);
+void destroy_morton_workspace(MortonWorkspace* ws);
+
+#endif // MORTON_H
@@ -0,0 +1,343 @@
+#include "node.h"
+
+// Window arrays start on the column alignment, like the private columns
+static size_t aligned_bytes(size_t bytes) {
+    return (bytes + PARTICLE_ALIGNMENT - 1) & ~(size_t)(PARTICLE_ALIGNMENT - 1);
+}
+
+// Next array of bytes at *offset from base, NULL when only measuring
+static void* place_array(char* base, size_t* offset, size_t bytes) {
+    void* array = base ? base + *offset : NULL;
+    *offset += aligned_bytes(bytes);
+    return array;
+}
+
+// Allocate a window of bytes on the node leader, nothing on the other ranks,
+// and map the leader's memory on every rank of the node. The window stays
+// locked for shared access until it is freed.
+static char* allocate_node_window(NodeShare* share, size_t bytes, MPI_Win* window) {
+    char* base;
+    MPI_Aint size = share->node_rank == 0 ? (MPI_Aint)(bytes > 0 ? bytes : PARTICLE_ALIGNMENT) : 0;
+    MPI_Win_allocate_shared(size, 1, MPI_INFO_NULL, share->node, &base, window);
+
+    MPI_Aint leader_size;
+    int unit;
+    MPI_Win_shared_query(*window, 0, &leader_size, &unit, &base);
+    MPI_Win_lock_all(MPI_MODE_NOCHECK, *window);
+    return base;
+}
+
+static void free_node_window(MPI_Win* window) {
+    if (*window == MPI_WIN_NULL) return;
+    MPI_Win_unlock_all(*window);
+    MPI_Win_free(window);
+}
+
+// Stores of any rank to the window are seen by every rank of the node after this
+static void synchronize_node_window(NodeShare* share, MPI_Win window) {
+    MPI_Win_sync(window);
+    MPI_Barrier(share->node);
+    MPI_Win_sync(window);
+}
+
+// Lay out the particle columns from base, or only measure them
+static size_t place_particles(ParticleSoA* soa, char* base, int count) {
+    size_t offset = 0;
+    soa->count = count;
+    soa->index = (int*)place_array(base, &offset, count * sizeof(int));
+    double** columns[] = {&soa->x_pos, &soa->y_pos, &soa->mass, &soa->x_vel, &soa->y_vel, &soa->x_force, &soa->y_force};
+    for (int c = 0; c < 7; c++) *columns[c] = (double*)place_array(base, &offset, count * sizeof(double));
+    soa->cost = (float*)place_array(base, &offset, count * sizeof(float));
+    return offset;
+}
+
+// Lay out a tree of node_capacity nodes and slot_capacity slots from base, or
+// only measure it. The moments and the single precision copy follow the flags
+// of view. The arrays belong to the window, so the builder fills them in place.
+static size_t place_tree(FlatTree* view, char* base, int node_capacity, int slot_capacity) {
+    size_t offset = 0;
+    view->nodes = (FlatNode*)place_array(base, &offset, node_capacity * sizeof(FlatNode));
+    view->order = (int*)place_array(base, &offset, slot_capacity * sizeof(int));
+    view->x_pos = (double*)place_array(base, &offset, slot_capacity * sizeof(double));
+    view->y_pos = (double*)place_array(base, &offset, slot_capacity * sizeof(double));
+    view->mass = (double*)place_array(base, &offset, slot_capacity * sizeof(double));
+    if (view->quadrupoles) {
+        view->qxx = (double*)place_array(base, &offset, node_capacity * sizeof(double));
+        view->qxy = (double*)place_array(base, &offset, node_capacity * sizeof(double));
+        view->qyy = (double*)place_array(base, &offset, node_capacity * sizeof(double));
+        view->moment_capacity = node_capacity;
+    }
+    if (view->single_precision) {
+        view->single_nodes = (SingleNode*)place_array(base, &offset, node_capacity * sizeof(SingleNode));
+        view->x_offset = (float*)place_array(base, &offset, slot_capacity * sizeof(float));
+        view->y_offset = (float*)place_array(base, &offset, slot_capacity * sizeof(float));
+        view->single_mass = (float*)place_array(base, &offset, slot_capacity * sizeof(float));
+        view->single_capacity = node_capacity;
+        view->single_particle_capacity = slot_capacity;
+    }
+    view->capacity = node_capacity;
+    view->particle_capacity = slot_capacity;
+    view->borrowed = 1;
+    return offset;
+}
+
+// Copy a tree the leader built outside the window into it
+static void copy_tree(FlatTree* to, const FlatTree* from) {
+    int nodes = from->count;
+    int slots = from->particle_count;
+    memcpy(to->nodes, from->nodes, nodes * sizeof(FlatNode));
+    memcpy(to->order, from->order, slots * sizeof(int));
+    memcpy(to->x_pos, from->x_pos, slots * sizeof(double));
+    memcpy(to->y_pos, from->y_pos, slots * sizeof(double));
+    memcpy(to->mass, from->mass, slots * sizeof(double));
+    if (to->quadrupoles) {
+        memcpy(to->qxx, from->qxx, nodes * sizeof(double));
+        memcpy(to->qxy, from->qxy, nodes * sizeof(double));
+        memcpy(to->qyy, from->qyy, nodes * sizeof(double));
+    }
+    if (to->single_precision) {
+        memcpy(to->single_nodes, from->single_nodes, nodes * sizeof(SingleNode));
+        memcpy(to->x_offset, from->x_offset, slots * sizeof(float));
+        memcpy(to->y_offset, from->y_offset, slots * sizeof(float));
+        memcpy(to->single_mass, from->single_mass, slots * sizeof(float));
+    }
+}
+
+// Free the arrays of a tree that moved out of the window
+static void release_tree_arrays(FlatTree* tree) {
+    void* arrays[] = {tree->nodes, tree->order, tree->x_pos, tree->y_pos, tree->mass, tree->qxx, tree->qxy,
+                      tree->qyy, tree->single_nodes, tree->x_offset, tree->y_offset, tree->single_mass};
+    for (int a = 0; a < 12; a++) free(arrays[a]);
+}
+
+static void copy_particle_columns(ParticleSoA* to, const ParticleSoA* from) {
+    int count = from->count;
+    memcpy(to->index, from->index, count * sizeof(int));
+    double* to_columns[] = {to->x_pos, to->y_pos, to->mass, to->x_vel, to->y_vel, to->x_force, to->y_force};
+    const double* from_columns[] = {from->x_pos, from->y_pos, from->mass, from->x_vel, from->y_vel,
+                                    from->x_force, from->y_force};
+    for (int c = 0; c < 7; c++) memcpy(to_columns[c], from_columns[c], count * sizeof(double));
+    memcpy(to->cost, from->cost, count * sizeof(float));
+}
+
+NodeShare* create_node_share(MPI_Comm comm, int node_ranks, const ParticleSoA* soa) {
+    NodeShare* share = (NodeShare*)calloc(1, sizeof(NodeShare));
+    if (share == NULL) {
+        perror("Memory allocation error");
+        MPI_Abort(comm, EXIT_FAILURE);
+    }
+    int rank;
+    MPI_Comm_rank(comm, &rank);
+
+    // Ranks that can map each other's memory, cut into groups of node_ranks
+    MPI_Comm shared;
+    int shared_rank;
+    MPI_Comm_split_type(comm, MPI_COMM_TYPE_SHARED, rank, MPI_INFO_NULL, &shared);
+    MPI_Comm_rank(shared, &shared_rank);
+    MPI_Comm_split(shared, shared_rank / node_ranks, rank, &share->node);
+    MPI_Comm_free(&shared);
+    MPI_Comm_rank(share->node, &share->node_rank);
+    MPI_Comm_size(share->node, &share->node_size);
+
+    // Leaders in rank order, so rank 0 leads the first node
+    MPI_Comm_split(comm, share->node_rank == 0 ? 0 : MPI_UNDEFINED, rank, &share->leaders);
+    if (share->node_rank == 0) {
+        MPI_Comm_rank(share->leaders, &share->node_index);
+        MPI_Comm_size(share->leaders, &share->node_count);
+    }
+    MPI_Bcast(&share->node_index, 1, MPI_INT, 0, share->node);
+    MPI_Bcast(&share->node_count, 1, MPI_INT, 0, share->node);
+
+    ParticleSoA measure;
+    size_t bytes = place_particles(&measure, NULL, soa->count);
+    char* base = allocate_node_window(share, bytes, &share->particle_window);
+    place_particles(&share->particles, base, soa->count);
+    if (share->node_rank == 0) copy_particle_columns(&share->particles, soa);
+    synchronize_node_window(share, share->particle_window);
+
+    // The tree window is sized by reserve_node_tree
+    share->tree_window = MPI_WIN_NULL;
+    return share;
+}
+
+void reserve_node_tree(NodeShare* share, int node_capacity, int slot_capacity) {
+    FlatTree* view = &share->tree;
+    FlatTree measure = *view;
+    size_t bytes = place_tree(&measure, NULL, node_capacity, slot_capacity);
+
+    free_node_window(&share->tree_window);
+    share->tree_bytes = bytes;
+    share->tree_base = allocate_node_window(share, bytes, &share->tree_window);
+    place_tree(view, share->tree_base, node_capacity, slot_capacity);
+    view->count = 0;
+    view->particle_count = 0;
+}
+
+void publish_node_tree(NodeShare* share) {
+    FlatTree* view = &share->tree;
+    int sizes[5] = {view->count, view->particle_count, view->capacity, view->particle_capacity, !view->borrowed};
+    MPI_Bcast(sizes, 5, MPI_INT, 0, share->node);
+
+    // The build outgrew the window and moved to the leader's memory: grow the
+    // window to the builder's new capacity and bring the tree back once
+    if (sizes[4]) {
+        FlatTree grown = *view;
+        reserve_node_tree(share, sizes[2], sizes[3]);
+        if (share->node_rank == 0) {
+            copy_tree(view, &grown);
+            release_tree_arrays(&grown);
+        }
+    }
+    view->count = sizes[0];
+    view->particle_count = sizes[1];
+    synchronize_node_window(share, share->tree_window);
+}
+
+void destroy_node_share(NodeShare* share) {
+    if (share == NULL) return;
+    free_node_window(&share->tree_window);
+    free_node_window(&share->particle_window);
+    if (share->leaders != MPI_COMM_NULL) MPI_Comm_free(&share->leaders);
+    MPI_Comm_free(&share->node);
+    free(share);
+}
+
+// Contiguous share [*first, *last) of count items for one rank
+static void share_range(int count, int size, int rank, int* first, int* last) {
+    int base = count / size;
+    int extra = count % size;
+    *first = rank * base + (rank < extra ? rank : extra);
+    *last = *first + base + (rank < extra ? 1 : 0);
+}
+
+// Give every node the blocks of the others, leaders only
+static void allgather_node_blocks(NodeShare* share, int* counts, int* displs) {
+    ParticleSoA* particles = &share->particles;
+    double* columns[] = {particles->x_pos, particles->y_pos, particles->mass, particles->x_vel, particles->y_vel};
+
+    for (int c = 0; c < 5; c++) {
+        MPI_Allgatherv(MPI_IN_PLACE, 0, MPI_DATATYPE_NULL,
+                       columns[c], counts, displs, MPI_DOUBLE, share->leaders);
+    }
+}
+
+// Drop a rank's private copy of the state, the window holds it from now on
+static void release_particle_columns(ParticleSoA* soa) {
+    free(soa->index);
+    free(soa->x_pos);
+    free(soa->y_pos);
+    free(soa->mass);
+    free(soa->x_vel);
+    free(soa->y_vel);
+    free(soa->x_force);
+    free(soa->y_force);
+    free(soa->cost);
+    memset(soa, 0, sizeof(ParticleSoA));
+}
+
+void run_node_shared(MPI_Comm comm, const Options* opts, ThreadPool* pool, ParticleSoA* soa) {
+    int rank, size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+    int dbg_print = opts->print_debug_flag;
+    int particle_count = soa->count;
+
+    NodeShare* share = create_node_share(comm, opts->node_ranks, soa);
+    ParticleSoA* particles = &share->particles;
+    int leader = share->node_rank == 0;
+    if (!leader) release_particle_columns(soa);
+
+    // Each node owns a contiguous block in leader order, split among its ranks
+    int* node_counts = (int*)malloc(share->node_count * sizeof(int));
+    int* node_displs = (int*)malloc(share->node_count * sizeof(int));
+    if (!node_counts || !node_displs) {
+        perror("Memory allocation error");
+        MPI_Abort(comm, EXIT_FAILURE);
+    }
+    for (int n = 0; n < share->node_count; n++) {
+        int node_first, node_last;
+        share_range(particle_count, share->node_count, n, &node_first, &node_last);
+        node_counts[n] = node_last - node_first;
+        node_displs[n] = node_first;
+    }
+    int first, last;
+    share_range(node_counts[share->node_index], share->node_size, share->node_rank, &first, &last);
+    first += node_displs[share->node_index];
+    last += node_displs[share->node_index];
+
+    // Only the leader builds, straight into the tree window, sized like the
+    // private trees of the other modes
+    TreeBuilder* builder = NULL;
+    if (leader) {
+        builder = create_tree_builder(opts->builder, opts->leaf_size, particle_count, pool);
+        if (opts->refit_threshold > 0) enable_tree_refit(builder, opts->refit_threshold);
+    }
+    share->tree.quadrupoles = opts->quadrupoles;
+    share->tree.single_precision = opts->single_precision;
+    reserve_node_tree(share, 2 * particle_count, particle_count);
+
+    FrameRing* frames = NULL;
+    if (opts->visualization_flag && rank == 0) {
+        frames = create_rank_frame_ring(rank, opts->visualization_flag, particle_count);
+        printf("Publishing frames to %s\n", frames->name);
+    }
+
+    if (dbg_print > 0 && rank == 0) {
+        printf("Running on %d rank(s) in %d node(s) sharing a tree x %d thread(s), leaf kernel: %s\n",
+               size, share->node_count, pool->thread_count, kernel_isa());
+    }
+
+    // Leaders write their node's block, in rank order like the replicated blocks
+    CheckpointWriter* checkpoints = NULL;
+    if (opts->checkpoint_steps > 0 || opts->checkpoint_seconds > 0) checkpoints = create_checkpoint_writer(comm, opts);
+
+    for (int step = opts->start_step; step < opts->steps; step++) {
+        if (dbg_print > 0 && rank == 0) printf("Step %d out of %d\n", step, opts->steps);
+        STATS_BEGIN_STEP(step - opts->start_step);
+
+        double begin = phase_begin();
+        if (leader) build_tree(builder, particles, &share->tree, rank == 0 ? dbg_print : 0);
+        publish_node_tree(share);
+        STATS_TREE(&share->tree);
+        phase_end(PHASE_BUILD, begin);
+
+        // Ranks advance disjoint slices of the window, the walk only reads
+        // the tree and each particle's own columns
+        begin = phase_begin();
+        ForcePass pass = {.tree = &share->tree, .particles = particles, .theta = opts->theta,
+                          .time_step = opts->time_step, .stage = FORCE_WHOLE};
+        run_force_pass(pool, &pass, first, last);
+        phase_end(PHASE_FORCE, begin);
+
+        begin = phase_begin();
+        synchronize_node_window(share, share->particle_window);
+        if (leader && share->node_count > 1) allgather_node_blocks(share, node_counts, node_displs);
+        phase_end(PHASE_EXCHANGE, begin);
+
+        if (frames) publish_frame(frames, step + 1, (step + 1) * opts->time_step, particles, &share->tree);
+        if (checkpoints) {
+            begin = phase_begin();
+            progress_checkpoint(checkpoints);
+            if (checkpoint_due(checkpoints, step + 1)) {
+                start_checkpoint(checkpoints, opts, step + 1, particles, node_displs[share->node_index],
+                                 leader ? node_counts[share->node_index] : 0, NULL, 0);
+                if (leader) discard_refit_tree(builder);
+            }
+            phase_end(PHASE_CHECKPOINT, begin);
+        }
+        STATS_END_STEP(particles, first, last, 0);
+    }
+
+    double begin = phase_begin();
+    destroy_checkpoint_writer(checkpoints);
+    phase_end(PHASE_CHECKPOINT, begin);
+
+    // The leaders take the final state back into their own store
+    if (leader) copy_particle_columns(soa, particles);
+
+    destroy_frame_ring(frames);
+    destroy_tree_builder(builder);
+    destroy_node_share(share);
+    free(node_counts);
+    free(node_displs);
+}
@@ -0,0 +1,66 @@
+#ifndef NODE_H
+#define NODE_H
+
+#include <mpi.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "builder.h"
+#include "checkpoint.h"
+#include "flat_tree.h"
+#include "force.h"
+#include "frames.h"
+#include "io.h"
+#include "kernel.h"
+#include "particle.h"
+#include "stats.h"
+#include "threads.h"
+#include "timing.h"
+#include "tree.h"
+
+// Node-shared mode (-N ranks): replicated mode with one copy of the particle
+// store and of the tree per node instead of one per rank. The ranks of a node
+// (at most -N of them) map the same MPI-3 shared memory windows. The node
+// leader builds the tree straight into the tree window, every rank walks
+// it for its own share of the node's block and advances those particles in
+// place, and only the leaders exchange the node blocks between nodes.
+typedef struct {
+    MPI_Comm node;          // Ranks sharing the windows, leader first
+    MPI_Comm leaders;       // Node leaders, MPI_COMM_NULL on the other ranks
+    int node_rank;
+    int node_size;
+    int node_index;         // Position of the node among the leaders
+    int node_count;
+
+    MPI_Win particle_window;
+    ParticleSoA particles;  // Columns in the particle window
+
+    MPI_Win tree_window;
+    char* tree_base;        // Leader's memory of the tree window
+    size_t tree_bytes;      // Size of the tree window
+    FlatTree tree;          // Tree in the window, built by the leader, read-only elsewhere
+} NodeShare;
+
+// Split comm into groups of at most node_ranks ranks sharing memory and fill
+// the particle window from soa
+NodeShare* create_node_share(MPI_Comm comm, int node_ranks, const ParticleSoA* soa);
+
+// Size the tree window for node_capacity nodes and slot_capacity slots with
+// the moments and single precision copy the flags of share->tree ask for, and
+// lay share->tree out in it. Collective over the node.
+void reserve_node_tree(NodeShare* share, int node_capacity, int slot_capacity);
+
+// Make the tree the leader built in share->tree visible to the whole node. A
+// build that outgrew the window is moved into a larger one. Collective over
+// the node.
+void publish_node_tree(NodeShare* share);
+
+void destroy_node_share(NodeShare* share);
+
+// Run the simulation in node-shared mode. Every rank passes the full initial
+// state in soa. The other ranks' copies are released once the windows hold the
+// state, the node leaders' copies hold the final state on return.
+void run_node_shared(MPI_Comm comm, const Options* opts, ThreadPool* pool, ParticleSoA* soa);
+
+#endif // NODE_H
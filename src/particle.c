@@ -11,6 +11,7 @@ Particle* create_particle(int index, double x_pos, double y_pos, double mass, do
     }
 
     particle->index = index;
+    particle->cost = 1.0f;
     particle->x_pos = x_pos;
     particle->y_pos = y_pos;
     particle->mass = mass;
@@ -52,6 +53,122 @@ void destroy_particle(Particle* particle) {
     }
 }
 
+// Allocate one aligned particle column
+double* create_particle_column(int count) {
+    size_t bytes = (size_t)(count > 0 ? count : 1) * sizeof(double);
+    bytes = (bytes + PARTICLE_ALIGNMENT - 1) & ~(size_t)(PARTICLE_ALIGNMENT - 1);
+
+    double* column = (double*)aligned_alloc(PARTICLE_ALIGNMENT, bytes);
+    if (column == NULL) {
+        perror("Memory allocation error");
+        exit(EXIT_FAILURE);
+    }
+    return column;
+}
+
+// Function to create a structure of arrays store for count particles
+ParticleSoA* create_particle_soa(int count) {
+    ParticleSoA* soa = (ParticleSoA*)malloc(sizeof(ParticleSoA));
+    if (soa == NULL) {
+        perror("Memory allocation error");
+        exit(EXIT_FAILURE);
+    }
+
+    soa->count = count;
+    soa->index = (int*)malloc((count > 0 ? count : 1) * sizeof(int));
+    if (soa->index == NULL) {
+        perror("Memory allocation error");
+        exit(EXIT_FAILURE);
+    }
+    soa->x_pos = create_particle_column(count);
+    soa->y_pos = create_particle_column(count);
+    soa->mass = create_particle_column(count);
+    soa->x_vel = create_particle_column(count);
+    soa->y_vel = create_particle_column(count);
+    soa->x_force = create_particle_column(count);
+    soa->y_force = create_particle_column(count);
+    soa->cost = (float*)malloc((count > 0 ? count : 1) * sizeof(float));
+    if (soa->cost == NULL) {
+        perror("Memory allocation error");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < count; i++) {
+        soa->cost[i] = 1.0f;
+    }
+    return soa;
+}
+
+// Copy particle records into the columns of the store
+void load_particle_soa(ParticleSoA* soa, const Particle* particles) {
+    for (int i = 0; i < soa->count; i++) {
+        soa->index[i] = particles[i].index;
+        soa->x_pos[i] = particles[i].x_pos;
+        soa->y_pos[i] = particles[i].y_pos;
+        soa->mass[i] = particles[i].mass;
+        soa->x_vel[i] = particles[i].x_vel;
+        soa->y_vel[i] = particles[i].y_vel;
+        soa->x_force[i] = particles[i].x_force;
+        soa->y_force[i] = particles[i].y_force;
+        soa->cost[i] = particles[i].cost;
+    }
+}
+
+// Copy the columns of the store back into particle records
+void store_particle_soa(const ParticleSoA* soa, Particle* particles) {
+    for (int i = 0; i < soa->count; i++) {
+        particles[i].index = soa->index[i];
+        particles[i].x_pos = soa->x_pos[i];
+        particles[i].y_pos = soa->y_pos[i];
+        particles[i].mass = soa->mass[i];
+        particles[i].x_vel = soa->x_vel[i];
+        particles[i].y_vel = soa->y_vel[i];
+        particles[i].x_force = soa->x_force[i];
+        particles[i].y_force = soa->y_force[i];
+        particles[i].cost = soa->cost[i];
+    }
+}
+
+// Advance particles [first, last) of the store, same integration as update_particle
+void update_particles(ParticleSoA* soa, int first, int last, double dt, double bounds_size) {
+    for (int i = first; i < last; i++) {
+        double ax = soa->x_force[i] / soa->mass[i];
+        double ay = soa->y_force[i] / soa->mass[i];
+
+        // Calculate the new positions
+        double x_pos = soa->x_pos[i] + (soa->x_vel[i] * dt) + (0.5 * ax * (dt * dt));
+        double y_pos = soa->y_pos[i] + (soa->y_vel[i] * dt) + (0.5 * ay * (dt * dt));
+        soa->x_pos[i] = x_pos;
+        soa->y_pos[i] = y_pos;
+
+        if (x_pos < 0 ||
+            x_pos > bounds_size ||
+            y_pos < 0 ||
+            y_pos > bounds_size){
+                soa->mass[i] = -1.0;
+                continue;
+        }
+
+        // Calculate the new velocities
+        soa->x_vel[i] = soa->x_vel[i] + (ax * dt);
+        soa->y_vel[i] = soa->y_vel[i] + (ay * dt);
+    }
+}
+
+// Function to destroy a structure of arrays store
+void destroy_particle_soa(ParticleSoA* soa) {
+    if (soa == NULL) return;
+    free(soa->index);
+    free(soa->x_pos);
+    free(soa->y_pos);
+    free(soa->mass);
+    free(soa->x_vel);
+    free(soa->y_vel);
+    free(soa->x_force);
+    free(soa->y_force);
+    free(soa->cost);
+    free(soa);
+}
+
 // Function to print particle details
 void print_particle(const Particle* particle) {
     if (particle != NULL) {
@@ -3,6 +3,7 @@
 
 typedef struct {
     int index;
+    float cost;   // Force work of the last step, see ParticleSoA
     double x_pos; // X position
     double y_pos; // Y position
     double mass;  // Mass
@@ -12,11 +13,37 @@ typedef struct {
     double y_force;
 } Particle;
 
+// Alignment of the particle columns, one cache line / one AVX-512 register
+#define PARTICLE_ALIGNMENT 64
+
+// Structure of arrays particle store. Each field lives in its own aligned
+// column so the force and update loops stream through contiguous memory.
+typedef struct {
+    int count;      // Number of particles
+    int* index;     // Particle id from the input
+    double* x_pos;  // X position
+    double* y_pos;  // Y position
+    double* mass;   // Mass
+    double* x_vel;  // X velocity
+    double* y_vel;  // Y velocity
+    double* x_force;
+    double* y_force;
+    float* cost;    // Interactions evaluated for the particle in the last step
+} ParticleSoA;
+
 // Functions related to particle creation, destruction, and modification
 Particle* create_particle(int index, double x_pos, double y_pos, double mass, double x_vel, double y_vel);
 void update_particle(Particle* particle, double dt, double bounds_size);
 void destroy_particle(Particle* particle);
 
+// Functions related to the structure of arrays particle store
+double* create_particle_column(int count);
+ParticleSoA* create_particle_soa(int count);
+void load_particle_soa(ParticleSoA* soa, const Particle* particles);
+void store_particle_soa(const ParticleSoA* soa, Particle* particles);
+void update_particles(ParticleSoA* soa, int first, int last, double dt, double bounds_size);
+void destroy_particle_soa(ParticleSoA* soa);
+
 // Debug functions
 void print_particle(const Particle* particle);
 
@@ -0,0 +1,409 @@
+#include "replicated.h"
+
+// Split num_bodies into contiguous blocks, one per rank
+static void partition_blocks(int num_bodies, int size, int *counts, int *displs) {
+    int base = num_bodies / size;
+    int extra = num_bodies % size;
+    int offset = 0;
+
+    for (int r = 0; r < size; r++) {
+        int block = base + (r < extra ? 1 : 0);
+        counts[r] = block;
+        displs[r] = offset;
+        offset += block;
+    }
+}
+
+// Particles [*first, *last) of the block partition_blocks gives rank
+static void block_range(int num_bodies, int size, int rank, int *first, int *last) {
+    int base = num_bodies / size;
+    int extra = num_bodies % size;
+    *first = rank * base + (rank < extra ? rank : extra);
+    *last = *first + base + (rank < extra ? 1 : 0);
+}
+
+// Share every rank's block of the columns the tree is built from
+static void allgather_blocks(ParticleSoA *soa, int *counts, int *displs, MPI_Comm comm) {
+    double *columns[] = {soa->x_pos, soa->y_pos, soa->mass};
+
+    for (int c = 0; c < 3; c++) {
+        MPI_Allgatherv(MPI_IN_PLACE, 0, MPI_DATATYPE_NULL,
+                       columns[c], counts, displs, MPI_DOUBLE, comm);
+    }
+}
+
+
+
+static void start_velocity_exchange(VelocityExchange *exchange, const ParticleSoA *soa,
+                                    int *counts, int *displs, int rank, MPI_Comm comm) {
+    exchange->first = displs[rank];
+    exchange->last = displs[rank] + counts[rank];
+    exchange->count = soa->count;
+    int block = exchange->last - exchange->first;
+    memcpy(exchange->x_vel + exchange->first, soa->x_vel + exchange->first, block * sizeof(double));
+    memcpy(exchange->y_vel + exchange->first, soa->y_vel + exchange->first, block * sizeof(double));
+
+    MPI_Iallgatherv(MPI_IN_PLACE, 0, MPI_DATATYPE_NULL, exchange->x_vel, counts, displs, MPI_DOUBLE,
+                    comm, &exchange->overlap.requests[0]);
+    MPI_Iallgatherv(MPI_IN_PLACE, 0, MPI_DATATYPE_NULL, exchange->y_vel, counts, displs, MPI_DOUBLE,
+                    comm, &exchange->overlap.requests[1]);
+    start_overlap(&exchange->overlap, 2);
+}
+
+// Wait for the velocities and copy in the other ranks' blocks, nothing when
+// no exchange is running
+static void finish_velocity_exchange(VelocityExchange *exchange, ParticleSoA *soa) {
+    if (exchange->overlap.count == 0) return;
+    finish_overlap(&exchange->overlap);
+
+    double *columns[] = {soa->x_vel, soa->y_vel};
+    double *received[] = {exchange->x_vel, exchange->y_vel};
+    for (int c = 0; c < 2; c++) {
+        memcpy(columns[c], received[c], exchange->first * sizeof(double));
+        memcpy(columns[c] + exchange->last, received[c] + exchange->last,
+               (exchange->count - exchange->last) * sizeof(double));
+    }
+}
+
+// Equal particle counts: rank r ends at slot n (r + 1) / size
+static void count_ends(const FlatTree *tree, int size, double *ends) {
+    for (int r = 0; r < size; r++) {
+        ends[r] = (double)((long long)tree->particle_count * (r + 1) / size);
+    }
+}
+
+// Cost zones: prefix[s] is the work of tree slots [0, s), measured in the last
+// step, and rank r ends where the prefix reaches (r + 1) / size of the total
+static void cost_ends(const ParticleSoA *soa, const FlatTree *tree, int size, double *prefix, double *ends) {
+    prefix[0] = 0.0;
+    for (int s = 0; s < tree->particle_count; s++) {
+        prefix[s + 1] = prefix[s] + soa->cost[tree->order[s]];
+    }
+    for (int r = 0; r < size; r++) {
+        ends[r] = prefix[tree->particle_count] * (r + 1) / size;
+    }
+}
+
+// Split the groups into runs, one per rank, along the tree order. A group
+// goes to the first rank whose end lies past the work before the group's
+// first slot: prefix[first], or first itself when prefix is NULL. Rank r walks
+// groups [group_displs[r], group_displs[r + 1]), which cover the tree slots
+// [slot_displs[r], slot_displs[r] + slot_counts[r]).
+static void partition_groups(const GroupSet *groups, const FlatTree *tree, int size, const double *prefix,
+                             const double *ends, int *group_displs, int *slot_counts, int *slot_displs) {
+    int g = 0;
+    for (int r = 0; r < size; r++) {
+        group_displs[r] = g;
+        slot_displs[r] = g < groups->count ? tree->nodes[groups->nodes[g]].first : tree->particle_count;
+        while (g < groups->count) {
+            int first = tree->nodes[groups->nodes[g]].first;
+            if ((prefix ? prefix[first] : first) >= ends[r]) break;
+            g++;
+        }
+    }
+    group_displs[size] = groups->count;
+
+    for (int r = 0; r < size; r++) {
+        int end = r + 1 < size ? slot_displs[r + 1] : tree->particle_count;
+        slot_counts[r] = end - slot_displs[r];
+    }
+}
+
+// Share every rank's run of tree slots, going through buffer in tree order.
+// The measured costs go along when the next partition is cut from them.
+static void allgather_slots(ParticleSoA *soa, const FlatTree *tree, double *buffer, int with_cost,
+                            int *counts, int *displs, int rank, MPI_Comm comm) {
+    double *columns[] = {soa->x_pos, soa->y_pos, soa->mass, soa->x_vel, soa->y_vel};
+
+    for (int c = 0; c < 5; c++) {
+        for (int s = displs[rank]; s < displs[rank] + counts[rank]; s++) {
+            buffer[s] = columns[c][tree->order[s]];
+        }
+        MPI_Allgatherv(MPI_IN_PLACE, 0, MPI_DATATYPE_NULL,
+                       buffer, counts, displs, MPI_DOUBLE, comm);
+        for (int s = 0; s < tree->particle_count; s++) {
+            columns[c][tree->order[s]] = buffer[s];
+        }
+    }
+
+    if (with_cost) {
+        for (int s = displs[rank]; s < displs[rank] + counts[rank]; s++) {
+            buffer[s] = soa->cost[tree->order[s]];
+        }
+        MPI_Allgatherv(MPI_IN_PLACE, 0, MPI_DATATYPE_NULL,
+                       buffer, counts, displs, MPI_DOUBLE, comm);
+        for (int s = 0; s < tree->particle_count; s++) {
+            soa->cost[tree->order[s]] = (float)buffer[s];
+        }
+    }
+}
+
+// Slowest rank's share of the work over the mean share, from the costs
+// measured in the step just taken. Every rank holds them all, so every rank
+// gets the same answer.
+static double slot_imbalance(const ParticleSoA *soa, const FlatTree *tree, int size,
+                             const int *slot_counts, const int *slot_displs) {
+    double total = 0.0;
+    double slowest = 0.0;
+    for (int r = 0; r < size; r++) {
+        double work = 0.0;
+        for (int s = slot_displs[r]; s < slot_displs[r] + slot_counts[r]; s++) {
+            work += soa->cost[tree->order[s]];
+        }
+        total += work;
+        if (work > slowest) slowest = work;
+    }
+    return total > 0 ? slowest * size / total : 1.0;
+}
+
+ReplicatedRun *create_replicated_run(MPI_Comm comm, const Options *opts, ThreadPool *pool, ParticleSoA *soa) {
+    ReplicatedRun *run = (ReplicatedRun *)calloc(1, sizeof(ReplicatedRun));
+    if (!run) {
+        perror("Memory allocation error");
+        MPI_Abort(comm, EXIT_FAILURE);
+    }
+    run->comm = comm;
+    run->opts = opts;
+    run->pool = pool;
+    MPI_Comm_rank(comm, &run->rank);
+    MPI_Comm_size(comm, &run->size);
+    run->step = opts->start_step;
+    run->particle_count = soa->count;
+    run->soa = soa;
+    int rank = run->rank;
+    int size = run->size;
+    int particle_count = soa->count;
+
+    // Each rank owns a contiguous block of particles for force and update work
+    run->block_counts = (int *)malloc(size * sizeof(int));
+    run->block_displs = (int *)malloc(size * sizeof(int));
+    partition_blocks(particle_count, size, run->block_counts, run->block_displs);
+    run->first = run->block_displs[rank];
+    run->last = run->first + run->block_counts[rank];
+
+    // Small runs sum all pairs over index blocks, the tree settings do not apply
+    if (particle_count < opts->direct_below) {
+        run->direct = create_direct_sum(particle_count);
+    } else {
+        // Tree storage is reused from step to step
+        run->builder = create_tree_builder(opts->builder, opts->leaf_size, particle_count, pool);
+        if (opts->refit_threshold > 0) enable_tree_refit(run->builder, opts->refit_threshold);
+        run->flat_tree = create_flat_tree(2 * particle_count);
+        run->flat_tree->quadrupoles = opts->quadrupoles;
+        run->flat_tree->single_precision = opts->single_precision;
+    }
+
+    // The steps work on the live prefix of the store. The refit tree keeps
+    // slots between steps, so it keeps every particle in place instead, and
+    // so does the all-pairs sum, whose rounding follows the slot order.
+    run->active_set = opts->refit_threshold > 0 || run->direct ? NULL : create_active_set(particle_count);
+    run->active = *soa;
+
+    // The grouped walk and the cost zones hand out runs of groups in tree
+    // order instead of index blocks, and share the results by tree slot.
+    // Without the grouped walk the groups are the leaves. Particles left out
+    // of the tree are few and are advanced by every rank.
+    run->balance = !run->direct && opts->balance_threshold > 0;
+    if ((opts->group_size > 0 && !run->direct) || run->balance) {
+        run->groups = create_group_set(particle_count);
+        run->group_displs = (int *)malloc((size + 1) * sizeof(int));
+        run->slot_buffer = create_particle_column(particle_count);
+        run->rank_ends = (double *)malloc(size * sizeof(double));
+    }
+    if (run->groups && opts->group_size > 0) run->lists = create_interaction_lists(pool->thread_count);
+    if (run->balance) run->work_prefix = create_particle_column(particle_count + 1);
+    run->repartition = 1;
+
+    // Block partitions overlap the velocity exchange, see VelocityExchange
+    if (!run->groups && !run->direct && size > 1) {
+        run->velocities.x_vel = create_particle_column(particle_count);
+        run->velocities.y_vel = create_particle_column(particle_count);
+    }
+
+    // Rank 0 holds the full state after every step and publishes it for viewers
+    if (opts->visualization_flag && rank == 0) {
+        run->frames = create_rank_frame_ring(rank, opts->visualization_flag, particle_count);
+        printf("Publishing frames to %s\n", run->frames->name);
+    }
+
+    // Debug Print statement
+    if (opts->print_debug_flag > 0 && rank == 0) printf("Running on %d rank(s) x %d thread(s), leaf kernel: %s\n", size, pool->thread_count, kernel_isa());
+    if (opts->print_debug_flag > 0 && rank == 0 && run->direct) printf("Summing all pairs of %d particles, below %d\n", particle_count, opts->direct_below);
+
+    // Periodic checkpoints, each rank writes its own block
+    if (opts->checkpoint_steps > 0 || opts->checkpoint_seconds > 0) run->checkpoints = create_checkpoint_writer(comm, opts);
+    return run;
+}
+
+void step_replicated_run(ReplicatedRun *run) {
+    const Options *opts = run->opts;
+    ParticleSoA *soa = run->soa;
+    ParticleSoA *active = &run->active;
+    FlatTree *flat_tree = run->flat_tree;
+    GroupSet *groups = run->groups;
+    int *block_counts = run->block_counts;
+    int *block_displs = run->block_displs;
+    int rank = run->rank;
+    int size = run->size;
+    int step = run->step;
+    int dbg_print = opts->print_debug_flag;
+
+    if (dbg_print > 0 && rank == 0) printf("Step %d out of %d\n", step, opts->steps);
+    STATS_BEGIN_STEP(step - opts->start_step);
+
+    // Build the BH Quadtree from the full replicated particle set
+    double begin = phase_begin();
+    if (!run->direct) {
+        build_tree(run->builder, active, flat_tree, rank == 0 ? dbg_print : 0);
+        STATS_TREE(flat_tree);
+    }
+
+    ForcePass pass = {.tree = flat_tree, .particles = active, .theta = opts->theta, .time_step = opts->time_step,
+                      .groups = groups, .lists = run->lists, .stage = FORCE_WHOLE};
+    if (groups) {
+        // Cut the tree order into equal counts, into equal measured work,
+        // or keep the last cost zones while they stay balanced
+        find_groups(groups, flat_tree, opts->group_size, active->count);
+        const double *prefix = NULL;
+        if (!run->balance) {
+            count_ends(flat_tree, size, run->rank_ends);
+        } else if (run->repartition) {
+            cost_ends(active, flat_tree, size, run->work_prefix, run->rank_ends);
+            prefix = run->work_prefix;
+        } else {
+            for (int r = 0; r + 1 < size; r++) run->rank_ends[r] = block_displs[r + 1];
+            run->rank_ends[size - 1] = flat_tree->particle_count;
+        }
+        partition_groups(groups, flat_tree, size, prefix, run->rank_ends, run->group_displs, block_counts, block_displs);
+        phase_end(PHASE_BUILD, begin);
+
+        // Walk the groups or slots owned by this rank and update them
+        begin = phase_begin();
+        if (opts->group_size > 0) {
+            run_group_pass(run->pool, &pass, run->group_displs[rank], run->group_displs[rank + 1]);
+        } else {
+            run_slot_pass(run->pool, &pass, block_displs[rank], block_displs[rank] + block_counts[rank]);
+        }
+        run_untreed_pass(&pass);
+        phase_end(PHASE_FORCE, begin);
+
+        // Share the updated slots so every rank holds the new state
+        begin = phase_begin();
+        if (size > 1) allgather_slots(active, flat_tree, run->slot_buffer, run->balance, block_counts, block_displs, rank, run->comm);
+        phase_end(PHASE_EXCHANGE, begin);
+
+        if (run->balance) {
+            double imbalance = slot_imbalance(active, flat_tree, size, block_counts, block_displs);
+            record_balance(imbalance, run->repartition);
+            if (dbg_print > 0 && rank == 0) {
+                printf("Work imbalance %.3f%s\n", imbalance, run->repartition ? " (new cost zones)" : "");
+            }
+            run->repartition = imbalance > opts->balance_threshold;
+        }
+    } else if (run->direct) {
+        phase_end(PHASE_BUILD, begin);
+
+        // The ranks split the pairs and every rank gets every force, so every
+        // rank advances every particle and there is no state to exchange
+        begin = phase_begin();
+        compute_direct_forces(run->pool, run->direct, active, run->comm);
+        update_particles(active, 0, active->count, opts->time_step, DEFAULT_BOUNDARY_SIZE);
+        phase_end(PHASE_FORCE, begin);
+    } else {
+        phase_end(PHASE_BUILD, begin);
+
+        // Compute the forces on each particle owned by this rank and update it
+        begin = phase_begin();
+        pass.overlap = &run->velocities.overlap;
+        run_force_pass(run->pool, &pass, run->first, run->last);
+        phase_end(PHASE_FORCE, begin);
+
+        // Share the updated blocks so every rank holds the new state,
+        // the velocities once the last ones have arrived
+        begin = phase_begin();
+        if (size > 1) {
+            int running = run->velocities.overlap.count > 0;
+            finish_velocity_exchange(&run->velocities, soa);
+            if (dbg_print > 0 && rank == 0 && running) {
+                printf("Velocity exchange: %.6f s hidden, %.6f s exposed\n",
+                       run->velocities.overlap.hidden, run->velocities.overlap.exposed);
+            }
+            allgather_blocks(active, block_counts, block_displs, run->comm);
+            start_velocity_exchange(&run->velocities, active, block_counts, block_displs, rank, run->comm);
+        }
+        phase_end(PHASE_EXCHANGE, begin);
+    }
+    run->step = step + 1;
+
+    if (run->frames) publish_frame(run->frames, step + 1, (step + 1) * opts->time_step, active, flat_tree);
+    if (run->checkpoints) {
+        begin = phase_begin();
+        progress_checkpoint(run->checkpoints);
+        if (checkpoint_due(run->checkpoints, step + 1)) {
+            // Checkpoints hold every particle in input order
+            synchronize_replicated_run(run);
+            start_checkpoint(run->checkpoints, opts, step + 1, soa, run->first, run->last - run->first, NULL, 0);
+            if (run->builder) discard_refit_tree(run->builder);
+        }
+        phase_end(PHASE_CHECKPOINT, begin);
+    }
+
+    // Every rank holds the same state, so every rank moves the same
+    // lost particles out of the active set
+    ActiveSet *active_set = run->active_set;
+    if (active_set && (step + 1 - opts->start_step) % ACTIVE_SET_INTERVAL == 0 &&
+        count_lost_slots(active_set, soa) > 0) {
+        begin = phase_begin();
+        finish_velocity_exchange(&run->velocities, soa);
+        phase_end(PHASE_EXCHANGE, begin);
+        compact_active_set(active_set, soa, step + 1);
+        active->count = active_set->live;
+        block_range(active->count, size, rank, &run->first, &run->last);
+        if (!groups) partition_blocks(active->count, size, block_counts, block_displs);
+    }
+
+    // A moved lost particle counts for the rank whose block held it in input order
+    int input_first, input_last;
+    block_range(run->particle_count, size, rank, &input_first, &input_last);
+    STATS_END_STEP(soa, run->first, run->last, active_set ? count_moved_slots(active_set, input_first, input_last) : 0);
+}
+
+void synchronize_replicated_run(ReplicatedRun *run) {
+    double begin = phase_begin();
+    finish_velocity_exchange(&run->velocities, run->soa);
+    phase_end(PHASE_EXCHANGE, begin);
+
+    // Lost particles catch up on their drift and return to input order
+    ActiveSet *active_set = run->active_set;
+    if (active_set && active_set->live < run->particle_count) {
+        restore_active_set(active_set, run->soa, run->step, run->opts->time_step);
+        run->active.count = run->particle_count;
+        block_range(run->particle_count, run->size, run->rank, &run->first, &run->last);
+        if (!run->groups) partition_blocks(run->particle_count, run->size, run->block_counts, run->block_displs);
+    }
+}
+
+void destroy_replicated_run(ReplicatedRun *run) {
+    if (run == NULL) return;
+    synchronize_replicated_run(run);
+
+    double begin = phase_begin();
+    destroy_checkpoint_writer(run->checkpoints);
+    phase_end(PHASE_CHECKPOINT, begin);
+    destroy_frame_ring(run->frames);
+    destroy_tree_builder(run->builder);
+    destroy_flat_tree(run->flat_tree);
+    destroy_direct_sum(run->direct);
+    destroy_active_set(run->active_set);
+    free(run->velocities.x_vel);
+    free(run->velocities.y_vel);
+    destroy_group_set(run->groups);
+    destroy_interaction_lists(run->lists, run->pool->thread_count);
+    free(run->group_displs);
+    free(run->slot_buffer);
+    free(run->rank_ends);
+    free(run->work_prefix);
+    free(run->block_counts);
+    free(run->block_displs);
+    free(run);
+}
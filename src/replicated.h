@@ -0,0 +1,97 @@
+#ifndef REPLICATED_H
+#define REPLICATED_H
+
+#include <mpi.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "active.h"
+#include "builder.h"
+#include "checkpoint.h"
+#include "direct.h"
+#include "flat_tree.h"
+#include "force.h"
+#include "frames.h"
+#include "group.h"
+#include "io.h"
+#include "kernel.h"
+#include "particle.h"
+#include "stats.h"
+#include "threads.h"
+#include "timing.h"
+#include "tree.h"
+
+// A rank only advances its own block, so the velocities of the other blocks
+// are needed again only when particles change blocks or the state is
+// written. Their exchange runs behind the next steps' build and force pass,
+// received into columns of its own so this rank's block stays writable.
+typedef struct {
+    double *x_vel;
+    double *y_vel;
+    int first;          // This rank's block while the exchange runs
+    int last;
+    int count;          // Particles exchanged
+    Overlap overlap;
+} VelocityExchange;
+
+// Replicated mode: the full particle set on every rank. Each rank computes
+// forces and updates for its own block, and the blocks are exchanged after
+// every step. The run keeps its tree, partitions and exchanges between steps,
+// so it can be advanced a few steps at a time. Below opts->direct_below
+// particles the ranks split an all-pairs sum instead, the tree is never built
+// and every rank advances every particle.
+typedef struct {
+    MPI_Comm comm;
+    const Options *opts;
+    ThreadPool *pool;
+    int rank;
+    int size;
+    int step;                   // Steps completed
+    int particle_count;
+
+    ParticleSoA *soa;           // Full state, in input order after synchronizing
+    ActiveSet *active_set;      // NULL with the refit tree
+    ParticleSoA active;         // Live prefix of the store the steps work on
+
+    // Each rank owns a contiguous block of particles, or a run of tree slots
+    int *block_counts;
+    int *block_displs;
+    int first;
+    int last;
+
+    TreeBuilder *builder;
+    FlatTree *flat_tree;
+    DirectSum *direct;          // All-pairs sum of runs below opts->direct_below, no tree then
+
+    // Grouped walk and cost zones
+    int balance;
+    GroupSet *groups;
+    InteractionList **lists;
+    int *group_displs;
+    double *slot_buffer;
+    double *rank_ends;
+    double *work_prefix;
+    int repartition;            // Cut new cost zones in the coming step
+
+    VelocityExchange velocities;
+    FrameRing *frames;
+    CheckpointWriter *checkpoints;
+} ReplicatedRun;
+
+// Start a run on the full initial state in soa, the same on every rank. The
+// run works in soa and resumes after opts->start_step.
+ReplicatedRun *create_replicated_run(MPI_Comm comm, const Options *opts, ThreadPool *pool, ParticleSoA *soa);
+
+// Take one step, collective over the run's communicator
+void step_replicated_run(ReplicatedRun *run);
+
+// Bring soa up to date: every particle in input order with the velocities of
+// every block. Collective, the next step picks up from there.
+void synchronize_replicated_run(ReplicatedRun *run);
+
+// Synchronize, finish the checkpoint in flight and release the run. soa holds
+// the final state.
+void destroy_replicated_run(ReplicatedRun *run);
+
+#endif // REPLICATED_H
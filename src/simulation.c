@@ -0,0 +1,431 @@
+#include "simulation.h"
+
+#include "accuracy.h"
+#include "block.h"
+#include "checkpoint.h"
+#include "distributed.h"
+#include "ensemble.h"
+#include "node.h"
+#include "replicated.h"
+#include "snapshot.h"
+#include "timing.h"
+
+struct Simulation {
+    MPI_Comm comm;
+    Options opts;
+    ThreadPool* pool;
+    ThreadPool* own_pool;   // Created for the simulation, NULL with the caller's pool
+    ParticleSoA* soa;       // State the steps work in
+    ParticleSoA* loaded;    // Store around the caller's columns, NULL otherwise
+    ReplicatedRun* run;     // Started by the first step
+    StepCallback callback;
+    void* user;
+};
+
+// Release the columns load_simulation allocated, the caller's stay
+static void free_loaded_store(Simulation* simulation) {
+    ParticleSoA* soa = simulation->loaded;
+    if (soa == NULL) return;
+    free(soa->index);
+    free(soa->cost);
+    free(soa->x_force);
+    free(soa->y_force);
+    free(soa);
+    simulation->loaded = NULL;
+    simulation->soa = NULL;
+}
+
+Simulation* create_simulation(MPI_Comm comm, const Options* opts, ThreadPool* pool) {
+    int rank;
+    MPI_Comm_rank(comm, &rank);
+    if (opts->mode != MODE_REPLICATED || opts->block_levels > 0 || opts->node_ranks > 0) {
+        if (rank == 0) fprintf(stderr, "Stepping a simulation needs replicated mode without -L or -N\n");
+        MPI_Abort(comm, EXIT_FAILURE);
+    }
+
+    Simulation* simulation = (Simulation*)calloc(1, sizeof(Simulation));
+    if (simulation == NULL) {
+        perror("Memory allocation error");
+        MPI_Abort(comm, EXIT_FAILURE);
+    }
+    simulation->comm = comm;
+    simulation->opts = *opts;
+    simulation->pool = pool;
+    if (pool == NULL) {
+        simulation->own_pool = create_thread_pool(opts->threads > 0 ? opts->threads : 1);
+        simulation->pool = simulation->own_pool;
+    }
+    return simulation;
+}
+
+void load_simulation(Simulation* simulation, int count, double* x_pos, double* y_pos, double* mass,
+                     double* x_vel, double* y_vel) {
+    // A new state starts a new run
+    destroy_replicated_run(simulation->run);
+    simulation->run = NULL;
+    free_loaded_store(simulation);
+
+    // The columns the caller does not pass belong to the simulation
+    ParticleSoA* soa = (ParticleSoA*)malloc(sizeof(ParticleSoA));
+    if (soa == NULL) {
+        perror("Memory allocation error");
+        MPI_Abort(simulation->comm, EXIT_FAILURE);
+    }
+    soa->count = count;
+    soa->x_pos = x_pos;
+    soa->y_pos = y_pos;
+    soa->mass = mass;
+    soa->x_vel = x_vel;
+    soa->y_vel = y_vel;
+    soa->index = (int*)malloc((count > 0 ? count : 1) * sizeof(int));
+    soa->cost = (float*)malloc((count > 0 ? count : 1) * sizeof(float));
+    if (soa->index == NULL || soa->cost == NULL) {
+        perror("Memory allocation error");
+        MPI_Abort(simulation->comm, EXIT_FAILURE);
+    }
+    soa->x_force = create_particle_column(count);
+    soa->y_force = create_particle_column(count);
+    for (int i = 0; i < count; i++) {
+        soa->index[i] = i;
+        soa->cost[i] = 1.0f;
+        soa->x_force[i] = 0.0;
+        soa->y_force[i] = 0.0;
+    }
+    simulation->soa = soa;
+    simulation->loaded = soa;
+}
+
+void set_step_callback(Simulation* simulation, StepCallback callback, void* user) {
+    simulation->callback = callback;
+    simulation->user = user;
+}
+
+void step_simulation(Simulation* simulation, int steps) {
+    if (simulation->soa == NULL) {
+        fprintf(stderr, "A simulation has to be loaded before it steps\n");
+        MPI_Abort(simulation->comm, EXIT_FAILURE);
+    }
+    if (simulation->run == NULL) {
+        simulation->run = create_replicated_run(simulation->comm, &simulation->opts, simulation->pool, simulation->soa);
+    }
+    for (int k = 0; k < steps; k++) {
+        step_replicated_run(simulation->run);
+        if (simulation->callback) simulation->callback(simulation, simulation->run->step, simulation->user);
+    }
+}
+
+const ParticleSoA* simulation_state(Simulation* simulation) {
+    if (simulation->run) synchronize_replicated_run(simulation->run);
+    return simulation->soa;
+}
+
+int simulation_steps(const Simulation* simulation) {
+    return simulation->run ? simulation->run->step : simulation->opts.start_step;
+}
+
+void destroy_simulation(Simulation* simulation) {
+    if (simulation == NULL) return;
+    destroy_replicated_run(simulation->run);
+    free_loaded_store(simulation);
+    destroy_thread_pool(simulation->own_pool);
+    free(simulation);
+}
+
+// Broadcast a string held by rank 0, NULL stays NULL on every rank
+static char *broadcast_string(char *string, int rank) {
+    int length = (rank == 0 && string) ? strlen(string) + 1 : 0;
+    MPI_Bcast(&length, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    if (length == 0) return NULL;
+
+    if (rank != 0) string = (char *)malloc(length * sizeof(char));
+    MPI_Bcast(string, length, MPI_CHAR, 0, MPI_COMM_WORLD);
+    return string;
+}
+
+// Broadcast the parsed options from rank 0 to every other rank
+void broadcast_options(Options *opts, int rank) {
+    char *in_file = opts->in_file;
+    char *out_file = opts->out_file;
+    char *report_file = opts->report_file;
+    char *ensemble_file = opts->ensemble_file;
+    MPI_Bcast(opts, sizeof(Options), MPI_BYTE, 0, MPI_COMM_WORLD);
+
+    opts->in_file = broadcast_string(in_file, rank);
+    opts->out_file = broadcast_string(out_file, rank);
+    opts->report_file = broadcast_string(report_file, rank);
+    opts->ensemble_file = broadcast_string(ensemble_file, rank);
+}
+
+// Give every rank the full particle set parsed on rank 0
+static ParticleSoA* replicate_particles(MPI_Comm comm, Particle *particles, int particle_count) {
+    int rank;
+    MPI_Comm_rank(comm, &rank);
+
+    Particle *received = particles;
+    if (rank != 0) {
+        received = (Particle *)malloc((particle_count > 0 ? particle_count : 1) * sizeof(Particle));
+        if (!received) {
+            perror("Memory allocation error");
+            MPI_Abort(comm, EXIT_FAILURE);
+        }
+    }
+    MPI_Bcast(received, particle_count * sizeof(Particle), MPI_BYTE, 0, comm);
+
+    // The engine works on a structure of arrays copy of the particles
+    ParticleSoA *soa = create_particle_soa(particle_count);
+    load_particle_soa(soa, received);
+    if (rank != 0) free(received);
+    return soa;
+}
+
+// Initial state of the last input read on this rank, kept so the next
+// ensemble member starting from the same file skips reading it
+typedef struct {
+    char *file;
+    Particle *particles;
+    int count;
+} InputCache;
+
+static void destroy_input_cache(InputCache *cache) {
+    free(cache->file);
+    free(cache->particles);
+    memset(cache, 0, sizeof(InputCache));
+}
+
+// run_simulation, cache is NULL outside ensembles
+static double run_cached_simulation(MPI_Comm comm, Options *opts, ThreadPool *pool, InputCache *cache, double start_time) {
+    int rank, size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+    int dbg_print = opts->print_debug_flag;
+
+    reset_phase_report();
+    if (opts->stats_flag) STATS_INIT(opts->steps - opts->start_step, pool->thread_count);
+
+    // Barnes-hut variables (tree and particles). Rank 0 always holds the full
+    // set in particles for the output, the modes keep their own working copies.
+    int particle_count = 0;
+    Particle* particles = NULL;
+    ParticleSoA* soa = NULL;  // Replicated mode: full state on every rank
+    Particle* local = NULL;   // Distributed mode: this rank's block
+    int local_count = 0;
+    double read_begin = phase_begin();
+
+    // An ensemble member starting from the last input copies it instead
+    int cached = (rank == 0 && cache && cache->file && !opts->restart) ? strcmp(cache->file, opts->in_file) == 0 : 0;
+    MPI_Bcast(&cached, 1, MPI_INT, 0, comm);
+
+    // Snapshots are read in place by every rank, text is parsed on rank 0
+    int snapshot = (rank == 0 && !opts->restart && !cached) ? is_snapshot_file(opts->in_file) : 0;
+    MPI_Bcast(&snapshot, 1, MPI_INT, 0, comm);
+
+    if (opts->restart) {
+        // Checkpoints are read with collective MPI-IO straight into the columns
+        if (opts->mode == MODE_DISTRIBUTED) {
+            ParticleSoA* block = read_checkpoint(comm, opts->in_file, 0, &particle_count);
+            local_count = block->count;
+            local = (Particle *)malloc((local_count > 0 ? local_count : 1) * sizeof(Particle));
+            store_particle_soa(block, local);
+            destroy_particle_soa(block);
+        } else {
+            soa = read_checkpoint(comm, opts->in_file, 1, &particle_count);
+        }
+        if (rank == 0) {
+            particles = (Particle *)malloc((particle_count > 0 ? particle_count : 1) * sizeof(Particle));
+            if (soa) {
+                store_particle_soa(soa, particles);
+            } else if (dbg_print >= 5 || opts->accuracy_samples > 0) {
+                ParticleSoA* whole = read_checkpoint(MPI_COMM_SELF, opts->in_file, 1, &particle_count);
+                store_particle_soa(whole, particles);
+                destroy_particle_soa(whole);
+            }
+        }
+    } else if (snapshot) {
+        if (opts->mode == MODE_DISTRIBUTED) {
+            local = read_snapshot_block(comm, opts->in_file, &local_count, &particle_count);
+            if (rank == 0) {
+                if (dbg_print >= 5 || opts->accuracy_samples > 0) {
+                    particles = read_snapshot(opts->in_file, &particle_count);
+                } else {
+                    particles = (Particle *)malloc((particle_count > 0 ? particle_count : 1) * sizeof(Particle));
+                }
+            }
+        } else {
+            soa = read_snapshot_soa(opts->in_file);
+            particle_count = soa->count;
+            if (rank == 0) {
+                particles = (Particle *)malloc((particle_count > 0 ? particle_count : 1) * sizeof(Particle));
+                store_particle_soa(soa, particles);
+            }
+        }
+    } else {
+        // Read the input file and return a list of particles
+        if (rank == 0 && cached) {
+            particle_count = cache->count;
+            particles = (Particle *)malloc((particle_count > 0 ? particle_count : 1) * sizeof(Particle));
+            memcpy(particles, cache->particles, particle_count * sizeof(Particle));
+        } else if (rank == 0) {
+            particles = read_input_file(opts->in_file, &particle_count, pool);
+        }
+        MPI_Bcast(&particle_count, 1, MPI_INT, 0, comm);
+
+        if (opts->mode == MODE_DISTRIBUTED) {
+            local = scatter_particles(comm, particles, particle_count, &local_count);
+        } else {
+            soa = replicate_particles(comm, particles, particle_count);
+        }
+    }
+
+    // Keep a copy of a freshly read initial state for the next member
+    if (rank == 0 && cache && !cached && !opts->restart && (!snapshot || opts->mode != MODE_DISTRIBUTED)) {
+        destroy_input_cache(cache);
+        cache->file = strdup(opts->in_file);
+        cache->count = particle_count;
+        cache->particles = (Particle *)malloc((particle_count > 0 ? particle_count : 1) * sizeof(Particle));
+        if (!cache->file || !cache->particles) {
+            perror("Memory allocation error");
+            MPI_Abort(comm, EXIT_FAILURE);
+        }
+        memcpy(cache->particles, particles, particle_count * sizeof(Particle));
+    }
+
+    phase_end(PHASE_READ, read_begin);
+
+    // Debug Print Statements
+    if (rank == 0 && dbg_print >= 5 && particles) {
+        printf("Particles: %d\n", particle_count);
+        for(int i = 0; i < particle_count; i++) {
+            Particle* p = &particles[i];
+
+            // printf("Particle #%d: (%e, %e) | M: %e | (%e, %e)\n", p->index, p->x_pos, p->y_pos, p->mass, p->x_vel, p->y_vel);
+            printf("Particle #%d: (%lf, %lf) | M: %e | (%e, %e)\n", p->index, p->x_pos, p->y_pos, p->mass, p->x_vel, p->y_vel);
+
+        }
+    }
+
+    // Check the tree forces of the initial state against a direct sum
+    AccuracyReport accuracy;
+    memset(&accuracy, 0, sizeof(accuracy));
+    if (rank == 0 && opts->accuracy_samples > 0) {
+        report_accuracy(opts, pool, particles, particle_count, &accuracy);
+    }
+
+    if (opts->mode == MODE_DISTRIBUTED) {
+        run_distributed(comm, opts, pool, local, local_count, particles, particle_count);
+    } else {
+        if (opts->block_levels > 0) {
+            run_block_timesteps(comm, opts, pool, soa);
+        } else if (opts->node_ranks > 0) {
+            run_node_shared(comm, opts, pool, soa);
+        } else {
+            Simulation* simulation = create_simulation(comm, opts, pool);
+            simulation->soa = soa;
+            step_simulation(simulation, opts->steps - opts->start_step);
+            destroy_simulation(simulation);
+        }
+        if (rank == 0) store_particle_soa(soa, particles);
+        destroy_particle_soa(soa);
+    }
+
+    if (rank == 0) {
+        double write_begin = phase_begin();
+        if (has_snapshot_suffix(opts->out_file)) {
+            write_snapshot(opts->out_file, particles, particle_count);
+        } else {
+            write_output_file(opts->out_file, particles, particle_count);
+        }
+        phase_end(PHASE_WRITE, write_begin);
+    }
+    free(particles);
+
+    double end_time = MPI_Wtime();
+    if (rank == 0) {
+        if (opts->ensemble_file) printf("%s %f\n", opts->out_file, end_time - start_time);
+        else printf("%f\n", end_time - start_time);
+    }
+
+    STATS_FINISH(comm);
+    if (opts->report_file) {
+        write_phase_report(comm, opts->report_file, opts, particle_count, end_time - start_time,
+                           opts->accuracy_samples > 0 ? &accuracy : NULL);
+    }
+    STATS_RESET();
+    return end_time - start_time;
+}
+
+double run_simulation(MPI_Comm comm, Options *opts, ThreadPool *pool, double start_time) {
+    return run_cached_simulation(comm, opts, pool, NULL, start_time);
+}
+
+// The ranks are split into groups of opts->ensemble_ranks, and every group
+// runs the members assigned to it one after the other on its own
+// communicator, sharing this rank's thread pool.
+void run_ensemble(int argc, char **argv, const Options *opts, ThreadPool *pool, double start_time) {
+    int rank, size;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+    int group_ranks = opts->ensemble_ranks;
+    if (size % group_ranks != 0) {
+        if (rank == 0) fprintf(stderr, "%d ranks do not split into ensemble groups of %d\n", size, group_ranks);
+        MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+    }
+    int group_count = size / group_ranks;
+
+    // Rank 0 parses the manifest and places the members, every rank gets all
+    Ensemble *ensemble = NULL;
+    int count = 0;
+    if (rank == 0) {
+        ensemble = read_ensemble(opts->ensemble_file, argc, argv, group_ranks);
+        assign_ensemble(ensemble, group_count);
+        count = ensemble->count;
+    }
+    MPI_Bcast(&count, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    if (rank != 0) {
+        ensemble = (Ensemble *)calloc(1, sizeof(Ensemble));
+        if (ensemble) {
+            ensemble->count = count;
+            ensemble->members = (Options *)calloc(count, sizeof(Options));
+            ensemble->group = (int *)malloc(count * sizeof(int));
+            ensemble->order = (int *)malloc(count * sizeof(int));
+        }
+        if (!ensemble || !ensemble->members || !ensemble->group || !ensemble->order) {
+            perror("Memory allocation error");
+            MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+        }
+    }
+    for (int m = 0; m < count; m++) broadcast_options(&ensemble->members[m], rank);
+    MPI_Bcast(ensemble->group, count, MPI_INT, 0, MPI_COMM_WORLD);
+    MPI_Bcast(ensemble->order, count, MPI_INT, 0, MPI_COMM_WORLD);
+
+    int group = rank / group_ranks;
+    MPI_Comm comm;
+    MPI_Comm_split(MPI_COMM_WORLD, group, rank, &comm);
+
+    if (rank == 0) {
+        printf("Ensemble of %d member(s) on %d group(s) of %d rank(s) x %d thread(s)\n",
+               count, group_count, group_ranks, pool->thread_count);
+    }
+
+    // The pool is shared by the group's members, so it sets their thread count
+    InputCache cache;
+    memset(&cache, 0, sizeof(InputCache));
+    int members_run = 0;
+    for (int k = 0; k < count; k++) {
+        Options *member = &ensemble->members[ensemble->order[k]];
+        if (ensemble->group[ensemble->order[k]] != group) continue;
+        member->threads = pool->thread_count;
+        run_cached_simulation(comm, member, pool, &cache, MPI_Wtime());
+        members_run += 1;
+    }
+    destroy_input_cache(&cache);
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    double seconds = MPI_Wtime() - start_time;
+    if (rank == 0) {
+        printf("Ensemble finished in %f seconds, %.3f members per second\n", seconds, count / seconds);
+    }
+
+    MPI_Comm_free(&comm);
+    destroy_ensemble(ensemble);
+}
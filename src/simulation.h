@@ -0,0 +1,73 @@
+#ifndef SIMULATION_H
+#define SIMULATION_H
+
+#include <mpi.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "io.h"
+#include "particle.h"
+#include "threads.h"
+
+// Library interface of the engine, built into libnbody.a by make library. The
+// caller initializes MPI with at least MPI_THREAD_FUNNELED and makes every
+// call on every rank of the simulation's communicator, from the thread that
+// initialized MPI.
+//
+//     Options opts;
+//     default_options(&opts);
+//     opts.theta = 0.5;
+//     opts.time_step = 0.005;
+//     Simulation* simulation = create_simulation(MPI_COMM_WORLD, &opts, NULL);
+//     load_simulation(simulation, n, x, y, mass, vx, vy);
+//     step_simulation(simulation, 100);
+//     const ParticleSoA* state = simulation_state(simulation);
+//     destroy_simulation(simulation);
+//
+// Stepping runs in replicated mode, with the grouped walk, cost zones, refit,
+// quadrupoles, mixed precision, the all-pairs sum, frames and checkpoints as
+// set in the options.
+// Distributed runs, block timesteps and node-shared trees run through
+// run_simulation only.
+typedef struct Simulation Simulation;
+
+// Called on every rank after each step with the number of steps completed
+typedef void (*StepCallback)(Simulation* simulation, int step, void* user);
+
+// Copy the options, whose strings have to outlive the simulation. pool is the
+// thread pool to use, or NULL for one of opts->threads threads of its own.
+Simulation* create_simulation(MPI_Comm comm, const Options* opts, ThreadPool* pool);
+
+// Run on the caller's columns without copying them. Every rank passes the
+// same initial state. The arrays hold the state whenever simulation_state has
+// been called since the last step, and may be changed then, the same way on
+// every rank. They have to outlive the simulation.
+void load_simulation(Simulation* simulation, int count, double* x_pos, double* y_pos, double* mass,
+                     double* x_vel, double* y_vel);
+
+void set_step_callback(Simulation* simulation, StepCallback callback, void* user);
+
+// Advance steps steps of opts->time_step
+void step_simulation(Simulation* simulation, int steps);
+
+// Current state in input order, with the forces of the last step
+const ParticleSoA* simulation_state(Simulation* simulation);
+
+// Steps completed, including the opts->start_step the run resumed after
+int simulation_steps(const Simulation* simulation);
+
+void destroy_simulation(Simulation* simulation);
+
+// Broadcast the options parsed on rank 0 of MPI_COMM_WORLD to every rank
+void broadcast_options(Options* opts, int rank);
+
+// Read the input, run the simulation on comm and write the output, as the
+// nbody executable does. Rank 0 of comm prints and reports. Returns the wall
+// clock seconds since start_time.
+double run_simulation(MPI_Comm comm, Options* opts, ThreadPool* pool, double start_time);
+
+// Run every member of the ensemble manifest opts->ensemble_file, see ensemble.h
+void run_ensemble(int argc, char** argv, const Options* opts, ThreadPool* pool, double start_time);
+
+#endif // SIMULATION_H
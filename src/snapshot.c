@@ -0,0 +1,271 @@
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "snapshot.h"
+
+static uint64_t align_up(uint64_t bytes) {
+    return (bytes + SNAPSHOT_ALIGNMENT - 1) / SNAPSHOT_ALIGNMENT * SNAPSHOT_ALIGNMENT;
+}
+
+static uint64_t column_width(int column) {
+    return column == 0 ? sizeof(int32_t) : sizeof(double);
+}
+
+// Byte offset of a column, SNAPSHOT_COLUMNS gives the total file size
+uint64_t snapshot_column_offset(int64_t count, int column) {
+    uint64_t offset = SNAPSHOT_HEADER_SIZE;
+    for (int c = 0; c < column; c++) {
+        offset += align_up((uint64_t)count * column_width(c));
+    }
+    return offset;
+}
+
+// Check the header of a mapped or read snapshot, exits on anything unexpected
+static void check_header(const SnapshotHeader* header, const char* filename, uint64_t file_size) {
+    if (memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) != 0) {
+        fprintf(stderr, "%s is not an n-body snapshot\n", filename);
+        exit(EXIT_FAILURE);
+    }
+    if (header->version != SNAPSHOT_VERSION || header->header_size != SNAPSHOT_HEADER_SIZE) {
+        fprintf(stderr, "%s: unsupported snapshot version %u\n", filename, header->version);
+        exit(EXIT_FAILURE);
+    }
+    if (header->count < 0 || header->count > INT_MAX) {
+        fprintf(stderr, "%s: invalid particle count %lld\n", filename, (long long)header->count);
+        exit(EXIT_FAILURE);
+    }
+    if (file_size < snapshot_column_offset(header->count, SNAPSHOT_COLUMNS)) {
+        fprintf(stderr, "%s: snapshot is truncated\n", filename);
+        exit(EXIT_FAILURE);
+    }
+}
+
+int is_snapshot_file(const char* filename) {
+    FILE* file = fopen(filename, "rb");
+    if (!file) return 0;
+
+    char magic[8];
+    int match = fread(magic, 1, sizeof(magic), file) == sizeof(magic) &&
+                memcmp(magic, SNAPSHOT_MAGIC, sizeof(magic)) == 0;
+    fclose(file);
+    return match;
+}
+
+int has_snapshot_suffix(const char* filename) {
+    size_t length = strlen(filename);
+    size_t suffix = strlen(SNAPSHOT_SUFFIX);
+    return length >= suffix && strcmp(filename + length - suffix, SNAPSHOT_SUFFIX) == 0;
+}
+
+// Map a snapshot read-only. The caller unmaps *size bytes.
+static const unsigned char* map_snapshot(const char* filename, size_t* size) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        perror("Error opening input file");
+        exit(EXIT_FAILURE);
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(SnapshotHeader)) {
+        fprintf(stderr, "%s: snapshot is truncated\n", filename);
+        exit(EXIT_FAILURE);
+    }
+
+    void* data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        perror("Error mapping input file");
+        exit(EXIT_FAILURE);
+    }
+
+    check_header((const SnapshotHeader*)data, filename, info.st_size);
+    *size = info.st_size;
+    return (const unsigned char*)data;
+}
+
+// Copy the columns straight into a structure of arrays store
+ParticleSoA* read_snapshot_soa(const char* filename) {
+    size_t size;
+    const unsigned char* data = map_snapshot(filename, &size);
+    const SnapshotHeader* header = (const SnapshotHeader*)data;
+    int count = (int)header->count;
+
+    ParticleSoA* soa = create_particle_soa(count);
+    const int32_t* index = (const int32_t*)(data + snapshot_column_offset(count, 0));
+    for (int i = 0; i < count; i++) {
+        soa->index[i] = index[i];
+    }
+
+    double* columns[] = {soa->x_pos, soa->y_pos, soa->mass, soa->x_vel, soa->y_vel};
+    for (int c = 1; c < SNAPSHOT_COLUMNS; c++) {
+        memcpy(columns[c - 1], data + snapshot_column_offset(count, c), count * sizeof(double));
+    }
+    memset(soa->x_force, 0, count * sizeof(double));
+    memset(soa->y_force, 0, count * sizeof(double));
+
+    munmap((void*)data, size);
+    return soa;
+}
+
+Particle* read_snapshot(const char* filename, int* num_bodies) {
+    size_t size;
+    const unsigned char* data = map_snapshot(filename, &size);
+    int count = (int)((const SnapshotHeader*)data)->count;
+
+    Particle* particles = (Particle*)malloc((count > 0 ? count : 1) * sizeof(Particle));
+    if (!particles) {
+        perror("Memory allocation error");
+        exit(EXIT_FAILURE);
+    }
+
+    const int32_t* index = (const int32_t*)(data + snapshot_column_offset(count, 0));
+    const double* x_pos = (const double*)(data + snapshot_column_offset(count, 1));
+    const double* y_pos = (const double*)(data + snapshot_column_offset(count, 2));
+    const double* mass = (const double*)(data + snapshot_column_offset(count, 3));
+    const double* x_vel = (const double*)(data + snapshot_column_offset(count, 4));
+    const double* y_vel = (const double*)(data + snapshot_column_offset(count, 5));
+    for (int i = 0; i < count; i++) {
+        particles[i].index = index[i];
+        particles[i].x_pos = x_pos[i];
+        particles[i].y_pos = y_pos[i];
+        particles[i].mass = mass[i];
+        particles[i].x_vel = x_vel[i];
+        particles[i].y_vel = y_vel[i];
+        particles[i].x_force = 0.0;
+        particles[i].y_force = 0.0;
+        particles[i].cost = 1.0f;
+    }
+
+    munmap((void*)data, size);
+    *num_bodies = count;
+    return particles;
+}
+
+Particle* read_snapshot_block(MPI_Comm comm, const char* filename, int* local_count, int* num_bodies) {
+    int rank, size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+
+    MPI_File file;
+    if (MPI_File_open(comm, filename, MPI_MODE_RDONLY, MPI_INFO_NULL, &file) != MPI_SUCCESS) {
+        if (rank == 0) fprintf(stderr, "Error opening input file %s\n", filename);
+        MPI_Abort(comm, EXIT_FAILURE);
+    }
+
+    MPI_Offset file_size;
+    MPI_File_get_size(file, &file_size);
+
+    SnapshotHeader header;
+    MPI_File_read_at_all(file, 0, &header, sizeof(header), MPI_BYTE, MPI_STATUS_IGNORE);
+    check_header(&header, filename, file_size);
+    int count = (int)header.count;
+
+    // Equal contiguous blocks, the first decomposition fixes ownership
+    int first = (int)((long long)count * rank / size);
+    int last = (int)((long long)count * (rank + 1) / size);
+    int block = last - first;
+
+    int32_t* index = (int32_t*)malloc((block > 0 ? block : 1) * sizeof(int32_t));
+    double* column = (double*)malloc((block > 0 ? block : 1) * sizeof(double));
+    Particle* particles = (Particle*)malloc((block > 0 ? block : 1) * sizeof(Particle));
+    if (!index || !column || !particles) {
+        perror("Memory allocation error");
+        MPI_Abort(comm, EXIT_FAILURE);
+    }
+
+    MPI_File_read_at_all(file, snapshot_column_offset(count, 0) + (MPI_Offset)first * sizeof(int32_t),
+                         index, block, MPI_INT32_T, MPI_STATUS_IGNORE);
+    for (int i = 0; i < block; i++) {
+        particles[i].index = index[i];
+        particles[i].x_force = 0.0;
+        particles[i].y_force = 0.0;
+        particles[i].cost = 1.0f;
+    }
+
+    for (int c = 1; c < SNAPSHOT_COLUMNS; c++) {
+        MPI_File_read_at_all(file, snapshot_column_offset(count, c) + (MPI_Offset)first * sizeof(double),
+                             column, block, MPI_DOUBLE, MPI_STATUS_IGNORE);
+        for (int i = 0; i < block; i++) {
+            switch (c) {
+                case 1: particles[i].x_pos = column[i]; break;
+                case 2: particles[i].y_pos = column[i]; break;
+                case 3: particles[i].mass = column[i]; break;
+                case 4: particles[i].x_vel = column[i]; break;
+                case 5: particles[i].y_vel = column[i]; break;
+            }
+        }
+    }
+
+    MPI_File_close(&file);
+    free(index);
+    free(column);
+
+    *local_count = block;
+    *num_bodies = count;
+    return particles;
+}
+
+// Write one column followed by zero padding up to the next column
+static void write_column(FILE* file, const void* data, uint64_t bytes) {
+    static const unsigned char padding[SNAPSHOT_ALIGNMENT] = {0};
+    if (bytes > 0 && fwrite(data, 1, bytes, file) != bytes) {
+        perror("Error writing snapshot");
+        exit(EXIT_FAILURE);
+    }
+    uint64_t pad = align_up(bytes) - bytes;
+    if (pad > 0 && fwrite(padding, 1, pad, file) != pad) {
+        perror("Error writing snapshot");
+        exit(EXIT_FAILURE);
+    }
+}
+
+void write_snapshot(const char* filename, const Particle* particles, int num_bodies) {
+    FILE* file = fopen(filename, "wb");
+    if (!file) {
+        perror("Error opening output file");
+        exit(EXIT_FAILURE);
+    }
+
+    unsigned char header_block[SNAPSHOT_HEADER_SIZE] = {0};
+    SnapshotHeader header;
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.header_size = SNAPSHOT_HEADER_SIZE;
+    header.count = num_bodies;
+    memcpy(header_block, &header, sizeof(header));
+    write_column(file, header_block, SNAPSHOT_HEADER_SIZE);
+
+    // Transpose one column at a time through a scratch buffer
+    double* column = (double*)malloc((num_bodies > 0 ? num_bodies : 1) * sizeof(double));
+    int32_t* index = (int32_t*)malloc((num_bodies > 0 ? num_bodies : 1) * sizeof(int32_t));
+    if (!column || !index) {
+        perror("Memory allocation error");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int i = 0; i < num_bodies; i++) index[i] = particles[i].index;
+    write_column(file, index, (uint64_t)num_bodies * sizeof(int32_t));
+
+    for (int c = 1; c < SNAPSHOT_COLUMNS; c++) {
+        for (int i = 0; i < num_bodies; i++) {
+            switch (c) {
+                case 1: column[i] = particles[i].x_pos; break;
+                case 2: column[i] = particles[i].y_pos; break;
+                case 3: column[i] = particles[i].mass; break;
+                case 4: column[i] = particles[i].x_vel; break;
+                case 5: column[i] = particles[i].y_vel; break;
+            }
+        }
+        write_column(file, column, (uint64_t)num_bodies * sizeof(double));
+    }
+
+    free(column);
+    free(index);
+    if (fclose(file) != 0) {
+        perror("Error writing snapshot");
+        exit(EXIT_FAILURE);
+    }
+}
@@ -0,0 +1,46 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <mpi.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "particle.h"
+
+// Binary snapshot layout: a fixed header followed by one column per field.
+// Columns start on SNAPSHOT_ALIGNMENT byte boundaries so a mapped file can be
+// copied straight into the aligned particle columns.
+#define SNAPSHOT_MAGIC "NBODYSNP"
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_ALIGNMENT 64
+#define SNAPSHOT_HEADER_SIZE 64
+
+// Output files with this suffix are written as snapshots instead of text
+#define SNAPSHOT_SUFFIX ".snap"
+
+// Columns in file order: index (int32), then x_pos, y_pos, mass, x_vel, y_vel (double)
+#define SNAPSHOT_COLUMNS 6
+
+typedef struct {
+    char magic[8];        // SNAPSHOT_MAGIC, not NUL terminated
+    uint32_t version;     // SNAPSHOT_VERSION
+    uint32_t header_size; // Offset of the first column
+    int64_t count;        // Number of particles
+} SnapshotHeader;
+
+int is_snapshot_file(const char* filename);
+int has_snapshot_suffix(const char* filename);
+uint64_t snapshot_column_offset(int64_t count, int column);
+
+// Whole snapshot through mmap, for ranks that need every particle
+Particle* read_snapshot(const char* filename, int* num_bodies);
+ParticleSoA* read_snapshot_soa(const char* filename);
+
+// Collective MPI-IO read where each rank only reads its own block of particles
+Particle* read_snapshot_block(MPI_Comm comm, const char* filename, int* local_count, int* num_bodies);
+
+void write_snapshot(const char* filename, const Particle* particles, int num_bodies);
+
+#endif // SNAPSHOT_H
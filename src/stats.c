@@ -0,0 +1,239 @@
+#include "stats.h"
+#include "timing.h"
+
+#ifdef NBODY_STATS
+
+Stats stats = {.current = -1};
+
+// Counters of one rank over the whole run, or across ranks in the summary
+typedef struct {
+    const char* name;
+    int is_time;
+} StatsField;
+
+#define STATS_FIELDS 13
+
+static const StatsField fields[STATS_FIELDS] = {
+    {"build", 1}, {"force", 1}, {"update", 1}, {"exchange", 1}, {"checkpoint", 1},
+    {"nodes", 0}, {"depth", 0}, {"cells", 0}, {"particles", 0}, {"remote", 0}, {"lost", 0},
+    {"hidden", 1}, {"exposed", 1},
+};
+
+static double field_value(const StepStats* step, int field) {
+    switch (field) {
+        case 0: return step->build;
+        case 1: return step->force;
+        case 2: return step->update;
+        case 3: return step->exchange;
+        case 4: return step->checkpoint;
+        case 5: return (double)step->nodes;
+        case 6: return (double)step->depth;
+        case 7: return (double)step->cells;
+        case 8: return (double)step->particles;
+        case 9: return (double)step->remote;
+        case 10: return (double)step->lost;
+        case 11: return step->hidden;
+        default: return step->exposed;
+    }
+}
+
+// Tree shape and lost particles describe the state, the rest adds up over steps
+static double rank_total(const StepStats* steps, int step_count, int field) {
+    if (step_count == 0) return 0.0;
+    if (field == 10) return field_value(&steps[step_count - 1], field);
+
+    double total = 0.0;
+    for (int s = 0; s < step_count; s++) {
+        double value = field_value(&steps[s], field);
+        if (field == 6) total = value > total ? value : total;
+        else total += value;
+    }
+    return total;
+}
+
+void init_stats(int step_count, int thread_count) {
+    stats.enabled = 1;
+    stats.step_count = step_count;
+    stats.current = -1;
+    stats.thread_count = thread_count;
+    stats.steps = (StepStats*)calloc(step_count > 0 ? step_count : 1, sizeof(StepStats));
+    stats.threads = (ThreadStats*)calloc(thread_count, sizeof(ThreadStats));
+    if (!stats.steps || !stats.threads) {
+        perror("Memory allocation error");
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Steps are numbered from the start of this run, so a resumed run records
+// only the steps it actually takes
+void begin_step_stats(int step) {
+    if (!stats.enabled || step < 0 || step >= stats.step_count) return;
+    stats.current = step;
+    memset(&stats.steps[step], 0, sizeof(StepStats));
+    memset(stats.threads, 0, stats.thread_count * sizeof(ThreadStats));
+}
+
+void record_phase_stats(int phase, double seconds) {
+    if (stats.current < 0) return;
+    StepStats* step = &stats.steps[stats.current];
+    if (phase == PHASE_BUILD) step->build += seconds;
+    else if (phase == PHASE_FORCE) step->force += seconds;
+    else if (phase == PHASE_EXCHANGE) step->exchange += seconds;
+    else if (phase == PHASE_CHECKPOINT) step->checkpoint += seconds;
+}
+
+// Node count and depth of the flat tree. The open ancestors of a node are
+// the ones whose subtree has not ended yet, kept on a stack of their ends.
+void record_tree_stats(const FlatTree* tree) {
+    if (stats.current < 0) return;
+
+    if (tree->count > stats.tree_capacity) {
+        stats.tree_capacity = tree->count;
+        stats.tree_ends = (int*)realloc(stats.tree_ends, stats.tree_capacity * sizeof(int));
+        if (!stats.tree_ends) {
+            perror("Memory allocation error");
+            exit(EXIT_FAILURE);
+        }
+    }
+    int* ends = stats.tree_ends;
+    int open = 0;
+    int depth = 0;
+    for (int i = 0; i < tree->count; i++) {
+        while (open > 0 && ends[open - 1] <= i) open -= 1;
+        if (open + 1 > depth) depth = open + 1;
+        if (tree->nodes[i].next != i + 1) ends[open++] = tree->nodes[i].next;
+    }
+
+    StepStats* step = &stats.steps[stats.current];
+    step->nodes += tree->count;
+    step->depth = depth > step->depth ? depth : step->depth;
+}
+
+// Fold the thread counters into the step and count the lost particles of
+// this rank's share, plus the lost ones it removed from the active set. The
+// update ran inside the force phase, its thread average is moved out of the
+// force time.
+void end_step_stats(const ParticleSoA* particles, int first, int last, int removed) {
+    if (stats.current < 0) return;
+    StepStats* step = &stats.steps[stats.current];
+
+    double update = 0.0;
+    for (int t = 0; t < stats.thread_count; t++) {
+        step->cells += stats.threads[t].cells;
+        step->particles += stats.threads[t].particles;
+        step->remote += stats.threads[t].remote;
+        update += stats.threads[t].update;
+    }
+    step->update = update / stats.thread_count;
+    step->force = step->force > step->update ? step->force - step->update : 0.0;
+
+    step->lost = removed;
+    for (int p = first; p < last; p++) {
+        if (particles->mass[p] < 0) step->lost += 1;
+    }
+    stats.current = -1;
+}
+
+static double* create_stats_array(size_t count) {
+    double* array = (double*)malloc((count > 0 ? count : 1) * sizeof(double));
+    if (!array) {
+        perror("Memory allocation error");
+        exit(EXIT_FAILURE);
+    }
+    return array;
+}
+
+// Collective: gather every rank's run totals on rank 0 and reduce the steps
+// across ranks, so rank 0 holds O(ranks + steps) values, then print the summary
+void finish_stats(MPI_Comm comm) {
+    if (!stats.enabled) return;
+
+    int rank;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &stats.ranks);
+
+    double totals[STATS_FIELDS];
+    for (int f = 0; f < STATS_FIELDS; f++) totals[f] = rank_total(stats.steps, stats.step_count, f);
+    if (rank == 0) stats.totals = create_stats_array((size_t)stats.ranks * STATS_FIELDS);
+    MPI_Gather(totals, STATS_FIELDS, MPI_DOUBLE, stats.totals, STATS_FIELDS, MPI_DOUBLE, 0, comm);
+
+    size_t values = (size_t)stats.step_count * STATS_FIELDS;
+    double* local = create_stats_array(values);
+    for (int s = 0; s < stats.step_count; s++) {
+        for (int f = 0; f < STATS_FIELDS; f++) local[(size_t)s * STATS_FIELDS + f] = field_value(&stats.steps[s], f);
+    }
+    if (rank == 0) {
+        stats.step_sum = create_stats_array(values);
+        stats.step_max = create_stats_array(values);
+    }
+    MPI_Reduce(local, stats.step_sum, (int)values, MPI_DOUBLE, MPI_SUM, 0, comm);
+    MPI_Reduce(local, stats.step_max, (int)values, MPI_DOUBLE, MPI_MAX, 0, comm);
+    free(local);
+    if (rank != 0) return;
+
+    printf("\nPer-rank totals over %d steps (imbalance = max / mean across %d ranks):\n", stats.step_count, stats.ranks);
+    printf("%-11s %14s %14s %14s %10s\n", "", "min", "mean", "max", "imbalance");
+    for (int f = 0; f < STATS_FIELDS; f++) {
+        double low = 0.0, high = 0.0, sum = 0.0;
+        for (int r = 0; r < stats.ranks; r++) {
+            double value = stats.totals[(size_t)r * STATS_FIELDS + f];
+            low = (r == 0 || value < low) ? value : low;
+            high = (r == 0 || value > high) ? value : high;
+            sum += value;
+        }
+        double mean = sum / stats.ranks;
+        if (fields[f].is_time) {
+            printf("%-11s %14.6f %14.6f %14.6f %10.3f\n", fields[f].name, low, mean, high, mean > 0 ? high / mean : 1.0);
+        } else {
+            printf("%-11s %14.0f %14.1f %14.0f %10.3f\n", fields[f].name, low, mean, high, mean > 0 ? high / mean : 1.0);
+        }
+    }
+}
+
+static void write_stats_values(FILE* file, const char* name, const double* values, size_t count, size_t stride,
+                               double scale, int is_time, int last) {
+    fprintf(file, "\"%s\": [", name);
+    for (size_t i = 0; i < count; i++) {
+        if (is_time) fprintf(file, "%s%.6f", i > 0 ? ", " : "", values[i * stride] * scale);
+        else fprintf(file, "%s%.0f", i > 0 ? ", " : "", values[i * stride] * scale);
+    }
+    fprintf(file, "]%s", last ? "" : ", ");
+}
+
+// Per field: each rank's run total, and each step's mean and max across ranks
+void write_stats_json(FILE* file) {
+    if (!stats.enabled || !stats.totals) return;
+
+    fprintf(file, ",\n  \"stats\": {\n");
+    for (int f = 0; f < STATS_FIELDS; f++) {
+        int is_time = fields[f].is_time;
+        fprintf(file, "    \"%s\": {", fields[f].name);
+        write_stats_values(file, "ranks", &stats.totals[f], stats.ranks, STATS_FIELDS, 1.0, is_time, 0);
+        write_stats_values(file, "step_mean", &stats.step_sum[f], stats.step_count, STATS_FIELDS,
+                           1.0 / stats.ranks, is_time, 0);
+        write_stats_values(file, "step_max", &stats.step_max[f], stats.step_count, STATS_FIELDS, 1.0, is_time, 1);
+        fprintf(file, "}%s\n", f + 1 < STATS_FIELDS ? "," : "");
+    }
+    fprintf(file, "  }");
+}
+
+// An overlapped exchange finished in this step
+void record_overlap_stats(double hidden, double exposed) {
+    if (stats.current < 0) return;
+    stats.steps[stats.current].hidden += hidden;
+    stats.steps[stats.current].exposed += exposed;
+}
+
+// Drop the recorded run, so the next one starts disabled and empty
+void reset_stats(void) {
+    free(stats.steps);
+    free(stats.threads);
+    free(stats.tree_ends);
+    free(stats.totals);
+    free(stats.step_sum);
+    free(stats.step_max);
+    memset(&stats, 0, sizeof(Stats));
+    stats.current = -1;
+}
+
+#endif // NBODY_STATS
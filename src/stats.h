@@ -0,0 +1,129 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <mpi.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "flat_tree.h"
+#include "particle.h"
+
+// Per-step, per-rank instrumentation: phase times, tree shape, interaction
+// counts and lost particles, summarized across ranks at the end of the run.
+// Only built with make STATS=1 (NBODY_STATS), and then only recorded with -P.
+// Without NBODY_STATS every STATS_* hook below compiles to nothing.
+
+// Interaction counts and update time of one thread for the current step,
+// padded so threads never share a cache line
+typedef struct {
+    long long cells;      // Accepted cells
+    long long particles;  // Particle-particle interactions
+    long long remote;     // Imported remote bodies
+    double update;        // Seconds spent advancing particles
+    char padding[32];
+} ThreadStats;
+
+// What one rank did in one step
+typedef struct {
+    double build;
+    double force;         // Force walk, without the update
+    double update;        // Thread average of the update time
+    double exchange;
+    double checkpoint;
+    long long nodes;      // Tree nodes
+    long long depth;      // Deepest tree level
+    long long cells;
+    long long particles;
+    long long remote;
+    long long lost;       // Lost particles in this rank's share after the step
+    double hidden;        // Exchange time hidden behind computation
+    double exposed;       // Time spent waiting for an overlapped exchange
+} StepStats;
+
+#ifdef NBODY_STATS
+
+typedef struct {
+    int enabled;
+    int step_count;
+    int current;          // Index of the step being recorded, -1 outside the step loop
+    StepStats* steps;
+    ThreadStats* threads;
+    int thread_count;
+    int* tree_ends;       // Stack of record_tree_stats, kept between steps
+    int tree_capacity;
+
+    // Summaries on rank 0 after finish_stats
+    int ranks;
+    double* totals;       // Run total of every field, [rank][field]
+    double* step_sum;     // Sum and max of every field across ranks, [step][field]
+    double* step_max;
+} Stats;
+
+extern Stats stats;
+
+void init_stats(int step_count, int thread_count);
+void begin_step_stats(int step);
+void record_phase_stats(int phase, double seconds);
+void record_tree_stats(const FlatTree* tree);
+void end_step_stats(const ParticleSoA* particles, int first, int last, int removed);
+void finish_stats(MPI_Comm comm);
+void write_stats_json(FILE* file);
+void reset_stats(void);
+void record_overlap_stats(double hidden, double exposed);
+
+static inline double stats_clock(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+// Counters of the calling thread, thread is its pool index
+static inline ThreadStats* thread_stats(int thread) {
+    return stats.current >= 0 ? &stats.threads[thread] : NULL;
+}
+
+#define STATS_INIT(steps, threads) init_stats(steps, threads)
+#define STATS_BEGIN_STEP(step) begin_step_stats(step)
+#define STATS_PHASE(phase, seconds) record_phase_stats(phase, seconds)
+#define STATS_TREE(tree) record_tree_stats(tree)
+#define STATS_END_STEP(particles, first, last, removed) end_step_stats(particles, first, last, removed)
+#define STATS_FINISH(comm) finish_stats(comm)
+#define STATS_JSON(file) write_stats_json(file)
+#define STATS_RESET() reset_stats()
+#define STATS_OVERLAP(hidden, exposed) record_overlap_stats(hidden, exposed)
+
+#define STATS_INTERACTIONS(thread, cell_count, particle_count) do { \
+        ThreadStats* counters = thread_stats(thread); \
+        if (counters) { counters->cells += (cell_count); counters->particles += (particle_count); } \
+    } while (0)
+#define STATS_REMOTE(thread, count) do { \
+        ThreadStats* counters = thread_stats(thread); \
+        if (counters) counters->remote += (count); \
+    } while (0)
+#define STATS_UPDATE_BEGIN() double update_begin = stats.current >= 0 ? stats_clock() : 0.0
+#define STATS_UPDATE_END(thread) do { \
+        ThreadStats* counters = thread_stats(thread); \
+        if (counters) counters->update += stats_clock() - update_begin; \
+    } while (0)
+
+#else
+
+#define STATS_INIT(steps, threads) ((void)0)
+#define STATS_BEGIN_STEP(step) ((void)0)
+#define STATS_PHASE(phase, seconds) ((void)0)
+#define STATS_TREE(tree) ((void)0)
+#define STATS_END_STEP(particles, first, last, removed) ((void)0)
+#define STATS_FINISH(comm) ((void)0)
+#define STATS_JSON(file) ((void)0)
+#define STATS_RESET() ((void)0)
+#define STATS_OVERLAP(hidden, exposed) ((void)0)
+#define STATS_INTERACTIONS(thread, cell_count, particle_count) ((void)0)
+#define STATS_REMOTE(thread, count) ((void)0)
+#define STATS_UPDATE_BEGIN() ((void)0)
+#define STATS_UPDATE_END(thread) ((void)0)
+
+#endif // NBODY_STATS
+
+#endif // STATS_H
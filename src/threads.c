@@ -0,0 +1,149 @@
+#include "threads.h"
+
+static _Thread_local int current_index = 0;
+
+int thread_pool_index(void) {
+    return current_index;
+}
+
+// Claim chunks of the current range until none are left
+static void run_chunks(ThreadPool* pool) {
+    for (;;) {
+        int first = atomic_fetch_add(&pool->next, pool->chunk);
+        if (first >= pool->last) {
+            return;
+        }
+        int last = first + pool->chunk;
+        if (last > pool->last) {
+            last = pool->last;
+        }
+        pool->task(pool->context, first, last);
+    }
+}
+
+static void* worker_main(void* arg) {
+    ThreadPool* pool = (ThreadPool*)arg;
+    unsigned long seen = 0;
+    current_index = atomic_fetch_add(&pool->joined, 1) + 1;
+
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        // Sleep until a new job is posted or the pool shuts down
+        while (pool->job == seen && !pool->shutdown) {
+            pthread_cond_wait(&pool->start, &pool->lock);
+        }
+        if (pool->shutdown) {
+            break;
+        }
+        seen = pool->job;
+        pthread_mutex_unlock(&pool->lock);
+
+        run_chunks(pool);
+
+        pthread_mutex_lock(&pool->lock);
+        pool->running -= 1;
+        if (pool->running == 0) {
+            pthread_cond_signal(&pool->done);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return NULL;
+}
+
+ThreadPool* create_thread_pool(int thread_count) {
+    ThreadPool* pool = (ThreadPool*)malloc(sizeof(ThreadPool));
+    if (!pool) {
+        perror("Memory allocation error");
+        exit(EXIT_FAILURE);
+    }
+
+    pool->thread_count = thread_count < 1 ? 1 : thread_count;
+    pool->job = 0;
+    pool->running = 0;
+    pool->shutdown = 0;
+    pool->task = NULL;
+    pool->context = NULL;
+    pool->last = 0;
+    pool->chunk = 1;
+    atomic_init(&pool->next, 0);
+    atomic_init(&pool->joined, 0);
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+
+    pool->workers = (pthread_t*)malloc(pool->thread_count * sizeof(pthread_t));
+    if (!pool->workers) {
+        perror("Memory allocation error");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int t = 0; t < pool->thread_count - 1; t++) {
+        if (pthread_create(&pool->workers[t], NULL, worker_main, pool) != 0) {
+            perror("Error creating worker thread");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    return pool;
+}
+
+// Run task over [first, last) in chunks claimed dynamically by every thread of
+// the pool, and return once the whole range is done. Chunks are claimed from a
+// shared counter, so threads that hit cheap regions simply take more of them.
+void parallel_for(ThreadPool* pool, int first, int last, int chunk, RangeTask task, void* context) {
+    if (first >= last) {
+        return;
+    }
+    if (chunk < 1) {
+        chunk = 1;
+    }
+
+    // Nothing to share out, run it on the calling thread
+    if (pool->thread_count == 1 || last - first <= chunk) {
+        task(context, first, last);
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->task = task;
+    pool->context = context;
+    pool->last = last;
+    pool->chunk = chunk;
+    atomic_store(&pool->next, first);
+    pool->running = pool->thread_count - 1;
+    pool->job += 1;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    run_chunks(pool);
+
+    // Wait for the workers to finish their last chunks
+    pthread_mutex_lock(&pool->lock);
+    while (pool->running > 0) {
+        pthread_cond_wait(&pool->done, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void destroy_thread_pool(ThreadPool* pool) {
+    if (!pool) {
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->shutdown = 1;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int t = 0; t < pool->thread_count - 1; t++) {
+        pthread_join(pool->workers[t], NULL);
+    }
+
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->start);
+    pthread_cond_destroy(&pool->done);
+    free(pool->workers);
+    free(pool);
+}
@@ -0,0 +1,45 @@
+#ifndef THREADS_H
+#define THREADS_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Default number of particles handed out per scheduler request
+#define THREAD_CHUNK_SIZE 64
+
+// Work on the half-open range [first, last)
+typedef void (*RangeTask)(void* context, int first, int last);
+
+// Persistent worker threads sharing a dynamically scheduled range. The calling
+// thread takes part in every job, so a pool of n threads starts n - 1 workers.
+// Only the calling thread may make MPI calls (MPI_THREAD_FUNNELED).
+typedef struct {
+    pthread_t* workers;     // Worker threads, thread_count - 1 of them
+    int thread_count;       // Threads taking part in a job, caller included
+
+    pthread_mutex_t lock;   // Guards the job description and counters below
+    pthread_cond_t start;   // Signalled when a new job is posted
+    pthread_cond_t done;    // Signalled when the last worker finishes a job
+    unsigned long job;      // Incremented for every posted job
+    int running;            // Workers still inside the current job
+    int shutdown;           // Set to stop the workers
+
+    RangeTask task;         // Current job
+    void* context;          // Argument for the current job
+    int last;               // End of the current range
+    int chunk;              // Particles per scheduler request
+    atomic_int next;        // Start of the next unclaimed chunk
+    atomic_int joined;      // Workers that have taken a thread index
+} ThreadPool;
+
+ThreadPool* create_thread_pool(int thread_count);
+void parallel_for(ThreadPool* pool, int first, int last, int chunk, RangeTask task, void* context);
+void destroy_thread_pool(ThreadPool* pool);
+
+// Index of the calling thread within its pool: 0 for the thread that created
+// it, 1 to thread_count - 1 for the workers. Lets tasks pick per thread scratch.
+int thread_pool_index(void);
+
+#endif // THREADS_H
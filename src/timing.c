@@ -0,0 +1,144 @@
+#include "timing.h"
+
+double phase_seconds[PHASE_COUNT];
+BalanceReport balance_report;
+BlockReport block_report;
+OverlapReport overlap_report;
+
+static const char* phase_names[PHASE_COUNT] = {"read", "build", "force", "exchange", "checkpoint", "write"};
+
+void record_balance(double imbalance, int repartitioned) {
+    balance_report.steps += 1;
+    balance_report.repartitions += repartitioned ? 1 : 0;
+    balance_report.imbalance_sum += imbalance;
+    if (imbalance > balance_report.imbalance_max) balance_report.imbalance_max = imbalance;
+}
+
+void start_overlap(Overlap* overlap, int count) {
+    overlap->count = count;
+    overlap->posted = MPI_Wtime();
+    overlap->completed = 0.0;
+}
+
+int test_overlap(Overlap* overlap) {
+    if (overlap->count == 0 || overlap->completed > 0) return 1;
+    int done = 0;
+    MPI_Testall(overlap->count, overlap->requests, &done, MPI_STATUSES_IGNORE);
+    if (done) overlap->completed = MPI_Wtime();
+    return done;
+}
+
+void finish_overlap(Overlap* overlap) {
+    if (overlap->count == 0) return;
+    double wait_begin = MPI_Wtime();
+    if (overlap->completed == 0.0) MPI_Waitall(overlap->count, overlap->requests, MPI_STATUSES_IGNORE);
+    double wait_end = MPI_Wtime();
+
+    overlap->hidden = (overlap->completed > 0 ? overlap->completed : wait_begin) - overlap->posted;
+    overlap->exposed = wait_end - wait_begin;
+    overlap->count = 0;
+    overlap_report.exchanges += 1;
+    overlap_report.hidden += overlap->hidden;
+    overlap_report.exposed += overlap->exposed;
+    STATS_OVERLAP(overlap->hidden, overlap->exposed);
+}
+
+void reset_phase_report(void) {
+    memset(phase_seconds, 0, sizeof(phase_seconds));
+    memset(&balance_report, 0, sizeof(balance_report));
+    memset(&block_report, 0, sizeof(block_report));
+    memset(&overlap_report, 0, sizeof(overlap_report));
+}
+
+void write_phase_report(MPI_Comm comm, const char* filename, const Options* opts, int particle_count,
+                        double total_seconds, const AccuracyReport* accuracy) {
+    int rank, size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+
+    double slowest[PHASE_COUNT];
+    double summed[PHASE_COUNT];
+    MPI_Reduce(phase_seconds, slowest, PHASE_COUNT, MPI_DOUBLE, MPI_MAX, 0, comm);
+    MPI_Reduce(phase_seconds, summed, PHASE_COUNT, MPI_DOUBLE, MPI_SUM, 0, comm);
+
+    double overlap[2] = {overlap_report.hidden, overlap_report.exposed};
+    double overlap_slowest[2];
+    double overlap_summed[2];
+    int exchanges = 0;
+    MPI_Reduce(overlap, overlap_slowest, 2, MPI_DOUBLE, MPI_MAX, 0, comm);
+    MPI_Reduce(overlap, overlap_summed, 2, MPI_DOUBLE, MPI_SUM, 0, comm);
+    MPI_Reduce(&overlap_report.exchanges, &exchanges, 1, MPI_INT, MPI_MAX, 0, comm);
+    if (rank != 0) return;
+
+    FILE* file = fopen(filename, "w");
+    if (!file) {
+        perror("Error opening report file");
+        exit(EXIT_FAILURE);
+    }
+
+    fprintf(file, "{\n");
+    fprintf(file, "  \"particles\": %d,\n", particle_count);
+    fprintf(file, "  \"steps\": %d,\n", opts->steps - opts->start_step);
+    fprintf(file, "  \"theta\": %g,\n", opts->theta);
+    fprintf(file, "  \"time_step\": %g,\n", opts->time_step);
+    fprintf(file, "  \"ranks\": %d,\n", size);
+    fprintf(file, "  \"threads\": %d,\n", opts->threads);
+    fprintf(file, "  \"mode\": \"%s\",\n", opts->mode == MODE_DISTRIBUTED ? "distributed" : "replicated");
+    fprintf(file, "  \"builder\": \"%s\",\n", opts->builder == BUILDER_MORTON ? "morton" : "insert");
+    fprintf(file, "  \"leaf_size\": %d,\n", opts->leaf_size);
+    fprintf(file, "  \"group_size\": %d,\n", opts->group_size);
+    fprintf(file, "  \"quadrupoles\": %s,\n", opts->quadrupoles ? "true" : "false");
+    fprintf(file, "  \"single_precision\": %s,\n", opts->single_precision ? "true" : "false");
+    fprintf(file, "  \"node_ranks\": %d,\n", opts->node_ranks);
+    fprintf(file, "  \"direct\": %s,\n", particle_count < opts->direct_below ? "true" : "false");
+    fprintf(file, "  \"kernel\": \"%s\",\n", kernel_isa());
+    fprintf(file, "  \"total_seconds\": %.6f,\n", total_seconds);
+
+    // The slowest rank sets the pace, the mean shows how much time is lost waiting
+    fprintf(file, "  \"phases\": {\n");
+    for (int p = 0; p < PHASE_COUNT; p++) {
+        fprintf(file, "    \"%s\": {\"max\": %.6f, \"mean\": %.6f}%s\n", phase_names[p],
+                slowest[p], summed[p] / size, p + 1 < PHASE_COUNT ? "," : "");
+    }
+    fprintf(file, "  }");
+
+    if (accuracy) {
+        fprintf(file, ",\n  \"accuracy\": {\n");
+        fprintf(file, "    \"samples\": %d,\n", accuracy->samples);
+        fprintf(file, "    \"all_pairs\": %s,\n", accuracy->all_pairs ? "true" : "false");
+        fprintf(file, "    \"monopole\": {\"interactions\": %.3f, \"rms_error\": %.6e},\n",
+                accuracy->monopole.interactions, accuracy->monopole.error);
+        fprintf(file, "    \"quadrupole\": {\"interactions\": %.3f, \"rms_error\": %.6e}%s\n",
+                accuracy->quadrupole.interactions, accuracy->quadrupole.error,
+                accuracy->single_precision ? "," : "");
+        if (accuracy->single_precision) {
+            fprintf(file, "    \"monopole_single\": {\"interactions\": %.3f, \"rms_error\": %.6e},\n",
+                    accuracy->monopole_single.interactions, accuracy->monopole_single.error);
+            fprintf(file, "    \"quadrupole_single\": {\"interactions\": %.3f, \"rms_error\": %.6e},\n",
+                    accuracy->quadrupole_single.interactions, accuracy->quadrupole_single.error);
+            fprintf(file, "    \"single_difference\": %.6e\n", accuracy->single_difference);
+        }
+        fprintf(file, "  }");
+    }
+    if (balance_report.steps > 0) {
+        fprintf(file, ",\n  \"balance\": {\"threshold\": %g, \"repartitions\": %d, \"mean_imbalance\": %.4f, \"max_imbalance\": %.4f}",
+                opts->balance_threshold, balance_report.repartitions,
+                balance_report.imbalance_sum / balance_report.steps, balance_report.imbalance_max);
+    }
+    if (block_report.max_level > 0) {
+        fprintf(file, ",\n  \"block\": {\"max_level\": %d, \"eta\": %g, \"finest_level\": %d, \"force_evaluations\": %lld, \"uniform_evaluations\": %lld}",
+                block_report.max_level, opts->block_eta, block_report.deepest,
+                block_report.evaluations, block_report.uniform_evaluations);
+    }
+    if (exchanges > 0) {
+        fprintf(file, ",\n  \"overlap\": {\"exchanges\": %d, \"hidden\": {\"max\": %.6f, \"mean\": %.6f}, \"exposed\": {\"max\": %.6f, \"mean\": %.6f}}",
+                exchanges, overlap_slowest[0], overlap_summed[0] / size, overlap_slowest[1], overlap_summed[1] / size);
+    }
+    STATS_JSON(file);
+    fprintf(file, "\n}\n");
+
+    if (fclose(file) != 0) {
+        perror("Error writing report file");
+        exit(EXIT_FAILURE);
+    }
+}
@@ -0,0 +1,99 @@
+#ifndef TIMING_H
+#define TIMING_H
+
+#include <mpi.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "accuracy.h"
+#include "io.h"
+#include "kernel.h"
+#include "stats.h"
+
+// Phases of a run, each rank adds up its own wall clock time per phase
+#define PHASE_READ       0 // Input parsing or loading and the initial distribution
+#define PHASE_BUILD      1 // Tree build, plus finding groups for the grouped walk
+#define PHASE_FORCE      2 // Force walk and the particle update fused into it
+#define PHASE_EXCHANGE   3 // Sharing the updated state, decomposition, migration and essential trees
+#define PHASE_CHECKPOINT 4 // Starting and completing checkpoints
+#define PHASE_WRITE      5 // Final output
+#define PHASE_COUNT      6
+
+extern double phase_seconds[PHASE_COUNT];
+
+// Balance of the measured force work across ranks with cost zones (-B), the
+// slowest rank's share over the mean share, one sample per step. The same on
+// every rank.
+typedef struct {
+    int steps;
+    int repartitions;    // Steps that cut new cost zones
+    double imbalance_sum;
+    double imbalance_max;
+} BalanceReport;
+
+extern BalanceReport balance_report;
+
+void record_balance(double imbalance, int repartitioned);
+
+// Force evaluations with block timesteps (-L), and how many it would take to
+// give every live particle the finest step used in each step of dt
+typedef struct {
+    int max_level;
+    int deepest;                    // Finest level used
+    long long evaluations;
+    long long uniform_evaluations;
+} BlockReport;
+
+extern BlockReport block_report;
+
+// Non-blocking exchange running behind computation. The calling thread tests
+// it while the computation runs, so the library can progress it, and the time
+// from posting to completion splits into the part hidden behind the
+// computation and the wait after it (exposed).
+#define OVERLAP_MAX_REQUESTS 2
+
+typedef struct {
+    MPI_Request requests[OVERLAP_MAX_REQUESTS];
+    int count;          // Pending requests, 0 when idle
+    double posted;      // When the requests were posted
+    double completed;   // When a test first saw them complete, 0 before
+    double hidden;      // Split of the last finished exchange
+    double exposed;
+} Overlap;
+
+// Hidden and exposed time over every exchange of the run, per rank
+typedef struct {
+    int exchanges;
+    double hidden;
+    double exposed;
+} OverlapReport;
+
+extern OverlapReport overlap_report;
+
+// Mark the count requests just posted in overlap->requests as pending
+void start_overlap(Overlap* overlap, int count);
+// Calling thread only. Returns whether the exchange has completed.
+int test_overlap(Overlap* overlap);
+// Wait for the exchange and account for it, nothing when none is pending
+void finish_overlap(Overlap* overlap);
+
+static inline double phase_begin(void) {
+    return MPI_Wtime();
+}
+
+static inline void phase_end(int phase, double begin) {
+    double seconds = MPI_Wtime() - begin;
+    phase_seconds[phase] += seconds;
+    STATS_PHASE(phase, seconds);
+}
+
+// Zero the phase times and the balance and block reports before a run
+void reset_phase_report(void);
+
+// Collective: write the run settings, the slowest and mean rank time of every
+// phase and the accuracy check (when accuracy is not NULL) as one JSON object
+void write_phase_report(MPI_Comm comm, const char* filename, const Options* opts, int particle_count,
+                        double total_seconds, const AccuracyReport* accuracy);
+
+#endif // TIMING_H
@@ -2,117 +2,125 @@
 #include "tree.h"
 
 Boundary create_bounds(double size, double x_pos, double y_pos) {
-    Boundary* bounds = (Boundary*)malloc(sizeof(Boundary));
-    Point* point = (Point*)malloc(sizeof(Point));
+    Boundary bounds;
 
-    point->x_pos = x_pos;
-    point->y_pos = y_pos;
+    bounds.center.x_pos = x_pos;
+    bounds.center.y_pos = y_pos;
+    bounds.size = size;
+    bounds.half_size = size * 0.5;
 
-    bounds->center = point;
-    bounds->size = size;
-    bounds->half_size = size * 0.5;
-
-    return *bounds;
+    return bounds;
 }
 
-BHTreeNode* create_tree_node (Boundary bounds) {
-    BHTreeNode* node = (BHTreeNode*)malloc(sizeof(BHTreeNode));
-    Point* center_mass = (Point*)malloc(sizeof(Point));
-
-    center_mass->x_pos = 0.0;
-    center_mass->y_pos = 0.0;
+BHTreeNode* create_tree_node (Arena* arena, Boundary bounds, int capacity) {
+    BHTreeNode* node = (BHTreeNode*)arena_alloc(arena, sizeof(BHTreeNode));
 
     // Assign default values to the new node
     node->boundary = bounds;
-    node->particle = NULL;
-    node->center_mass = center_mass;
+    node->particles = NULL;
+    node->center_mass.x_pos = 0.0;
+    node->center_mass.y_pos = 0.0;
     node->total_mass = 0.0;
     node->is_sub_divided = 0;
-    node->capacity = 4;
+    node->capacity = capacity;
     node->count = 0;
+    node->NW = NULL;
+    node->NE = NULL;
+    node->SW = NULL;
+    node->SE = NULL;
+    node->parent = NULL;
 
     return node;
 }
 
-// Insert nodes into the Quad tree
-int insert_node(BHTreeNode* node, Particle* particle) {
-    
+// Insert the particle into whichever child contains it
+static int insert_into_child(Arena* arena, BHTreeNode* node, const ParticleSoA* particles, int index) {
+    if (insert_node(arena, node->NW, particles, index)) return 1;
+    if (insert_node(arena, node->NE, particles, index)) return 1;
+    if (insert_node(arena, node->SW, particles, index)) return 1;
+    if (insert_node(arena, node->SE, particles, index)) return 1;
+    return 0;
+}
+
+// Insert nodes into the Quad tree. Leaves keep up to capacity particle
+// indices into the store, which must outlive the tree.
+int insert_node(Arena* arena, BHTreeNode* node, const ParticleSoA* particles, int index) {
+    double x_pos = particles->x_pos[index];
+    double y_pos = particles->y_pos[index];
+    double mass = particles->mass[index];
+
     // This particle is lost
-    if (particle->mass < 0){
+    if (mass < 0){
         return 0;
     }
 
     // Check that the particle is contained within the bounds of the node
-    if (!contains(node, particle)) {
+    if (!contains(node, x_pos, y_pos)) {
         return 0; // Particle is outside this node's boundary
     }
 
-    // Check if the node has no particle and isn't divided
-    if (node->particle == NULL && !node->is_sub_divided) {
-        node->particle = (Particle*)malloc(sizeof(Particle));
-        *(node->particle) = *particle; // Copy particle data
-        node->total_mass = particle->mass;
-        node->center_mass->x_pos = particle->x_pos;
-        node->center_mass->y_pos = particle->y_pos;
+    // Check if the node is a leaf with room left in its bucket
+    if (!node->is_sub_divided && node->count < node->capacity) {
+        if (node->particles == NULL) {
+            node->particles = (int*)arena_alloc(arena, node->capacity * sizeof(int));
+        }
+        node->particles[node->count] = index;
+        if (node->count == 0) {
+            node->total_mass = mass;
+            node->center_mass.x_pos = x_pos;
+            node->center_mass.y_pos = y_pos;
+        } else {
+            update_node_data(node, x_pos, y_pos, mass);
+        }
         node->count += 1;
         return 1;
     }
 
     // Subdivide and redistribute if necessary
     if (!node->is_sub_divided) {
-        subdivide(node);
-
-        // Redistribute the existing particle
-        Particle* existing_particle = node->particle;
-        node->particle = NULL; // Clear parent node's particle reference
-
-        if (!insert_node(node->NW, existing_particle) &&
-            !insert_node(node->NE, existing_particle) &&
-            !insert_node(node->SW, existing_particle) &&
-            !insert_node(node->SE, existing_particle)) {
-            printf("Error redistributing particle #%d during subdivision.\n", existing_particle->index);
-            return 0;
+        subdivide(arena, node);
+
+        // Redistribute the existing particles
+        for (int b = 0; b < node->count; b++) {
+            int existing_particle = node->particles[b];
+            if (!insert_into_child(arena, node, particles, existing_particle)) {
+                printf("Error redistributing particle #%d during subdivision.\n", particles->index[existing_particle]);
+                return 0;
+            }
         }
-        free(existing_particle); // Free the copy
+        node->particles = NULL; // Clear parent node's particle references
     }
 
     // Update the total mass and center of mass before inserting
-    double old_mass = node->total_mass;
-    node->total_mass += particle->mass;
-
-    // Update center of mass using the old total mass
-    node->center_mass->x_pos = (node->center_mass->x_pos * old_mass + particle->x_pos * particle->mass) / node->total_mass;
-    node->center_mass->y_pos = (node->center_mass->y_pos * old_mass + particle->y_pos * particle->mass) / node->total_mass;
+    update_node_data(node, x_pos, y_pos, mass);
+    node->count += 1;
 
     // Attempt to insert into one of the child nodes
-    if (insert_node(node->NW, particle)) return 1;
-    if (insert_node(node->NE, particle)) return 1;
-    if (insert_node(node->SW, particle)) return 1;
-    if (insert_node(node->SE, particle)) return 1;
+    if (insert_into_child(arena, node, particles, index)) return 1;
 
     // Should not reach here
     return 0;
 }
 
 
-// Check that a particle is contained within the bounds of a node
-int contains(BHTreeNode* node, Particle* particle) {
+// Check that a position is contained within the bounds of a node
+int contains(BHTreeNode* node, double x_pos, double y_pos) {
     return (
-        particle->x_pos >= node->boundary.center->x_pos - node->boundary.half_size &&
-        particle->x_pos < node->boundary.center->x_pos + node->boundary.half_size &&
-        particle->y_pos >= node->boundary.center->y_pos - node->boundary.half_size &&
-        particle->y_pos < node->boundary.center->y_pos + node->boundary.half_size);
+        x_pos >= node->boundary.center.x_pos - node->boundary.half_size &&
+        x_pos < node->boundary.center.x_pos + node->boundary.half_size &&
+        y_pos >= node->boundary.center.y_pos - node->boundary.half_size &&
+        y_pos < node->boundary.center.y_pos + node->boundary.half_size);
 
 }
 
 // Update the mass and centor of mass
-void update_node_data(BHTreeNode* node, Particle* particle) {
+void update_node_data(BHTreeNode* node, double x_pos, double y_pos, double mass) {
     // Get the new mass of the subtree rooted at this node
-    double new_total_mass = node->total_mass + particle->mass;
+    double new_total_mass = node->total_mass + mass;
 
     // Find the new center of mass
-    node->center_mass->x_pos = (node->center_mass->x_pos * node->total_mass + particle->x_pos * particle->mass) / new_total_mass;
-    node->center_mass->y_pos = (node->center_mass->y_pos * node->total_mass + particle->y_pos * particle->mass) / new_total_mass;
+    node->center_mass.x_pos = (node->center_mass.x_pos * node->total_mass + x_pos * mass) / new_total_mass;
+    node->center_mass.y_pos = (node->center_mass.y_pos * node->total_mass + y_pos * mass) / new_total_mass;
 
     // Set the new total mass for the node
     node->total_mass = new_total_mass;
@@ -120,19 +128,29 @@ void update_node_data(BHTreeNode* node, Particle* particle) {
     return;
 }
 
-void aggregate_data(BHTreeNode* node) {
-    // If the node is a leaf, its CoM is the particle's position
+void aggregate_data(BHTreeNode* node, const ParticleSoA* particles) {
+    // If the node is a leaf, its CoM is the mass weighted position of its particles
     if (!node->is_sub_divided) {
-        if (node->particle != NULL) {
-            node->center_mass->x_pos = node->particle->x_pos;
-            node->center_mass->y_pos = node->particle->y_pos;
-            node->total_mass = node->particle->mass;
+        double total_mass = 0.0;
+        double weighted_x = 0.0;
+        double weighted_y = 0.0;
+
+        for (int b = 0; b < node->count; b++) {
+            int p = node->particles[b];
+            total_mass += particles->mass[p];
+            weighted_x += particles->x_pos[p] * particles->mass[p];
+            weighted_y += particles->y_pos[p] * particles->mass[p];
+        }
+
+        if (total_mass > 0) {
+            node->center_mass.x_pos = weighted_x / total_mass;
+            node->center_mass.y_pos = weighted_y / total_mass;
         } else {
             // No particle in this node
-            node->total_mass = 0;
-            node->center_mass->x_pos = 0;
-            node->center_mass->y_pos = 0;
+            node->center_mass.x_pos = 0;
+            node->center_mass.y_pos = 0;
         }
+        node->total_mass = total_mass;
         return;
     }
 
@@ -142,83 +160,139 @@ void aggregate_data(BHTreeNode* node) {
     double weighted_y = 0.0;
 
     if (node->NW) {
-        aggregate_data(node->NW); // Ensure child properties are up-to-date
+        aggregate_data(node->NW, particles); // Ensure child properties are up-to-date
         total_mass += node->NW->total_mass;
-        weighted_x += node->NW->center_mass->x_pos * node->NW->total_mass;
-        weighted_y += node->NW->center_mass->y_pos * node->NW->total_mass;
+        weighted_x += node->NW->center_mass.x_pos * node->NW->total_mass;
+        weighted_y += node->NW->center_mass.y_pos * node->NW->total_mass;
     }
     if (node->NE) {
-        aggregate_data(node->NE);
+        aggregate_data(node->NE, particles);
         total_mass += node->NE->total_mass;
-        weighted_x += node->NE->center_mass->x_pos * node->NE->total_mass;
-        weighted_y += node->NE->center_mass->y_pos * node->NE->total_mass;
+        weighted_x += node->NE->center_mass.x_pos * node->NE->total_mass;
+        weighted_y += node->NE->center_mass.y_pos * node->NE->total_mass;
     }
     if (node->SW) {
-        aggregate_data(node->SW);
+        aggregate_data(node->SW, particles);
         total_mass += node->SW->total_mass;
-        weighted_x += node->SW->center_mass->x_pos * node->SW->total_mass;
-        weighted_y += node->SW->center_mass->y_pos * node->SW->total_mass;
+        weighted_x += node->SW->center_mass.x_pos * node->SW->total_mass;
+        weighted_y += node->SW->center_mass.y_pos * node->SW->total_mass;
     }
     if (node->SE) {
-        aggregate_data(node->SE);
+        aggregate_data(node->SE, particles);
         total_mass += node->SE->total_mass;
-        weighted_x += node->SE->center_mass->x_pos * node->SE->total_mass;
-        weighted_y += node->SE->center_mass->y_pos * node->SE->total_mass;
+        weighted_x += node->SE->center_mass.x_pos * node->SE->total_mass;
+        weighted_y += node->SE->center_mass.y_pos * node->SE->total_mass;
     }
 
     // Update the node's total mass and center of mass
     if (total_mass > 0) {
-        node->center_mass->x_pos = weighted_x / total_mass;
-        node->center_mass->y_pos = weighted_y / total_mass;
+        node->center_mass.x_pos = weighted_x / total_mass;
+        node->center_mass.y_pos = weighted_y / total_mass;
     } else {
-        node->center_mass->x_pos = 0.0;
-        node->center_mass->y_pos = 0.0;
+        node->center_mass.x_pos = 0.0;
+        node->center_mass.y_pos = 0.0;
     }
     node->total_mass = total_mass;
 }
 
 // Subdivide the node
-void subdivide(BHTreeNode* node) {
+void subdivide(Arena* arena, BHTreeNode* node) {
     double sub_divided_size = node->boundary.size / 2;
     double sub_divided_center_size = sub_divided_size / 2;
 
-    // Allocate memory for subdivided nodes
-    node->NW = (BHTreeNode*)malloc(sizeof(BHTreeNode));
-    node->NE = (BHTreeNode*)malloc(sizeof(BHTreeNode));
-    node->SW = (BHTreeNode*)malloc(sizeof(BHTreeNode));
-    node->SE = (BHTreeNode*)malloc(sizeof(BHTreeNode));
-
     // Create subdivided nodes and assign them to the parent
-    node->NW = create_tree_node(create_bounds(sub_divided_size, node->boundary.center->x_pos - sub_divided_center_size, node->boundary.center->y_pos - sub_divided_center_size));
-    node->NE = create_tree_node(create_bounds(sub_divided_size, node->boundary.center->x_pos + sub_divided_center_size, node->boundary.center->y_pos - sub_divided_center_size));
-    node->SW = create_tree_node(create_bounds(sub_divided_size, node->boundary.center->x_pos - sub_divided_center_size, node->boundary.center->y_pos + sub_divided_center_size));
-    node->SE = create_tree_node(create_bounds(sub_divided_size, node->boundary.center->x_pos + sub_divided_center_size, node->boundary.center->y_pos + sub_divided_center_size));
+    node->NW = create_tree_node(arena, create_bounds(sub_divided_size, node->boundary.center.x_pos - sub_divided_center_size, node->boundary.center.y_pos - sub_divided_center_size), node->capacity);
+    node->NE = create_tree_node(arena, create_bounds(sub_divided_size, node->boundary.center.x_pos + sub_divided_center_size, node->boundary.center.y_pos - sub_divided_center_size), node->capacity);
+    node->SW = create_tree_node(arena, create_bounds(sub_divided_size, node->boundary.center.x_pos - sub_divided_center_size, node->boundary.center.y_pos + sub_divided_center_size), node->capacity);
+    node->SE = create_tree_node(arena, create_bounds(sub_divided_size, node->boundary.center.x_pos + sub_divided_center_size, node->boundary.center.y_pos + sub_divided_center_size), node->capacity);
+
+    node->NW->parent = node;
+    node->NE->parent = node;
+    node->SW->parent = node;
+    node->SE->parent = node;
 
     node->is_sub_divided = 1;
 }
 
+// Take a particle out of the bucket of the leaf holding it and drop it from
+// the counts of every enclosing node. Masses are left for the next refit.
+void remove_particle(BHTreeNode* leaf, int index) {
+    for (int b = 0; b < leaf->count; b++) {
+        if (leaf->particles[b] == index) {
+            leaf->particles[b] = leaf->particles[leaf->count - 1];
+            break;
+        }
+    }
+
+    for (BHTreeNode* node = leaf; node != NULL; node = node->parent) {
+        node->count -= 1;
+    }
+}
+
+// Append the particles of a subtree to bucket
+static void collect_particles(BHTreeNode* node, int* bucket, int* count) {
+    if (node == NULL || node->count == 0) return;
+
+    if (!node->is_sub_divided) {
+        for (int b = 0; b < node->count; b++) {
+            bucket[(*count)++] = node->particles[b];
+        }
+        return;
+    }
+
+    collect_particles(node->NW, bucket, count);
+    collect_particles(node->NE, bucket, count);
+    collect_particles(node->SW, bucket, count);
+    collect_particles(node->SE, bucket, count);
+}
+
+// Collapse every subdivided node left with no more particles than fit in a
+// leaf, so the tree has the shape a fresh insertion would give it. The
+// dropped children stay in the arena until it is next reset.
+void prune_tree(Arena* arena, BHTreeNode* node) {
+    if (node == NULL || !node->is_sub_divided) return;
+
+    if (node->count <= node->capacity) {
+        int* bucket = (int*)arena_alloc(arena, node->capacity * sizeof(int));
+        int count = 0;
+        collect_particles(node, bucket, &count);
+
+        node->particles = bucket;
+        node->is_sub_divided = 0;
+        node->NW = NULL;
+        node->NE = NULL;
+        node->SW = NULL;
+        node->SE = NULL;
+        return;
+    }
+
+    prune_tree(arena, node->NW);
+    prune_tree(arena, node->NE);
+    prune_tree(arena, node->SW);
+    prune_tree(arena, node->SE);
+}
+
 // Compute for the forces on a particle
-void compute_force(BHTreeNode* node, Particle* particle, double theta) {
+void compute_force(BHTreeNode* node, ParticleSoA* particles, int index, double theta) {
+    double x_pos = particles->x_pos[index];
+    double y_pos = particles->y_pos[index];
+    double mass = particles->mass[index];
 
     // Do not account for this lost particle
-    if (particle->mass < 0){
+    if (mass < 0){
         return;
     }
 
-    // printf("Computing force for Particle #%d\n", particle->index);
-
     if (node == NULL) {
-        // printf("Node is NULL\n");
         return;
     }
     if (node->count == 0){
-        // printf("count is 0: Node->count == %d\n", node->count);
         return; // Node is empty or none existent
     }
 
     // calculate the vector components distances
-    double dx = node->center_mass->x_pos - particle->x_pos;
-    double dy = node->center_mass->y_pos - particle->y_pos;
+    double dx = node->center_mass.x_pos - x_pos;
+    double dy = node->center_mass.y_pos - y_pos;
 
     double distance = sqrt((dx * dx) + (dy * dy));
 
@@ -227,69 +301,53 @@ void compute_force(BHTreeNode* node, Particle* particle, double theta) {
         distance = RLIMIT;
     }
 
-    // If this is a leaf (I.e only one particle)
-    if (!node->is_sub_divided && node->particle != NULL){
-        // Skip the particle if the particle is itself
-        if (node->particle == particle) {
-            // printf("Particle is Particle\n");
-            return; 
+    // Check MAC criteria
+    double size = node->boundary.size;
+    int accepted = (size / distance) < theta;
+
+    // If this is a leaf, sum its bucket directly unless the whole bucket passes the MAC
+    if (!node->is_sub_divided && !(node->count > 1 && accepted)) {
+        for (int b = 0; b < node->count; b++) {
+            int other = node->particles[b];
+
+            // Skip the particle if the particle is itself
+            if (other == index) continue;
+
+            double px = particles->x_pos[other] - x_pos;
+            double py = particles->y_pos[other] - y_pos;
+            double pd = sqrt((px * px) + (py * py));
+            if (pd < RLIMIT) {
+                pd = RLIMIT;
+            }
+
+            // Compute the forces on the body vector components
+            particles->x_force[index] += (G * particles->mass[other] * mass * px) / (pd * pd * pd);
+            particles->y_force[index] += (G * particles->mass[other] * mass * py) / (pd * pd * pd);
         }
-
-        // Compute the forces on the body vector components
-        particle->x_force += (G * node->particle->mass * particle->mass * dx) / (distance * distance * distance);
-        particle->y_force += (G * node->particle->mass * particle->mass * dy) / (distance * distance * distance);
-
-        // printf("Force Components Calculated for Particle #%d: Force: %lf, %lf\n", particle->index, particle->x_force, particle->y_force);
-
         return;
     }
 
-    // Check MAC criteria
-    double size = node->boundary.size;
-    if ((size / distance) < theta) {
+    if (accepted) {
         // Compute the forces on the body vector components with the node
-        particle->x_force += (G * node->total_mass * particle->mass * dx) / (distance * distance * distance);
-        particle->y_force += (G * node->total_mass * particle->mass * dy) / (distance * distance * distance);
-
-        // printf("Force Components Calculated (USING MAC) for Particle #%d: Force: %lf, %lf\n", particle->index, particle->x_force, particle->y_force);
-
+        particles->x_force[index] += (G * node->total_mass * mass * dx) / (distance * distance * distance);
+        particles->y_force[index] += (G * node->total_mass * mass * dy) / (distance * distance * distance);
         return;
     }
 
     // Recursively Compute node forces
-    compute_force(node->NW, particle, theta);
-    compute_force(node->NE, particle, theta);
-    compute_force(node->SW, particle, theta);
-    compute_force(node->SE, particle, theta);
+    compute_force(node->NW, particles, index, theta);
+    compute_force(node->NE, particles, index, theta);
+    compute_force(node->SW, particles, index, theta);
+    compute_force(node->SE, particles, index, theta);
 
 }
 
 // Debug print for BHTreeTypes
 void print_node_data(BHTreeNode* node) {
-    printf("Bounds: Size: %lf Pos: %lf, %lf\n", node->boundary.size, node->boundary.center->x_pos, node->boundary.center->y_pos);
+    printf("Bounds: Size: %lf Pos: %lf, %lf\n", node->boundary.size, node->boundary.center.x_pos, node->boundary.center.y_pos);
     printf("Particle Count: %d\n", node->count);
     printf("Capacity: %d\n", node->capacity);
-    printf("Center of Mass: %lf, %lf\n", node->center_mass->x_pos, node->center_mass->y_pos);
+    printf("Center of Mass: %lf, %lf\n", node->center_mass.x_pos, node->center_mass.y_pos);
     printf("Total Mass: %lf\n", node->total_mass);
     printf("Is Subdivided: %s\n\n", node->is_sub_divided ? "True" : "False");
 }
-
-// Recursive function to free memory for the Quadtree
-void destroy_tree_node (BHTreeNode* node) {
-    if (!node) return;
-
-    // Free the children nodes
-    if (node->is_sub_divided) {
-        destroy_tree_node(node->NW);
-        destroy_tree_node(node->NE);
-        destroy_tree_node(node->SW);
-        destroy_tree_node(node->SE);
-    }
-
-    // Free the memory for the particle
-    if (node->particle) free(node->particle);
-
-    // Free the memory held by the node
-    free(node);
-
-}
\ No newline at end of file
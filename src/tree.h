@@ -5,10 +5,13 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#include "arena.h"
 #include "particle.h"
 
 #define G 0.0001
 #define RLIMIT 0.03
+#define DEFAULT_BOUNDARY_SIZE 4.0
+#define DEFAULT_LEAF_SIZE 1
 
 // Forward declaration of BHTreeNode
 typedef struct BHTreeNode BHTreeNode;
@@ -23,7 +26,7 @@ typedef struct {
 typedef struct {
     double size;      // Full length of one side
     double half_size; // Half the length of one size
-    Point* center;     // Center point position of the boundary 
+    Point center;     // Center point position of the boundary
 } Boundary;
 
 Boundary create_bounds(double size, double x_pos, double y_pos);
@@ -34,28 +37,31 @@ Boundary create_bounds(double size, double x_pos, double y_pos);
 struct BHTreeNode
 {
     Boundary boundary;   // The bounding box of a given node
-    Particle* particle;  // Particles contained within the bounds of the node
-    Point* center_mass;  // Center of mass of a given node
+    int* particles;      // Indices of the particles held by a leaf
+    Point center_mass;   // Center of mass of a given node
     double total_mass;   // The total mass of all contained particles
     int is_sub_divided;  // Flag to determine if its divided
-    int capacity;        // Node capacity for particles
-    int count;           // Current count of particles per node
+    int capacity;        // Leaf capacity for particles
+    int count;           // Current count of particles in the subtree
 
     BHTreeNode* NW; // Top Left Quadrant
     BHTreeNode* NE; // Top Right Quadrant
     BHTreeNode* SW; // Bottom Left Quadrant
     BHTreeNode* SE; // Bottom Right Quadrant
 
+    BHTreeNode* parent; // Enclosing node, NULL for the root
 };
 
-BHTreeNode* create_tree_node(Boundary bounds);
-int insert_node(BHTreeNode* node, Particle* particle);
-int contains(BHTreeNode* node, Particle* particle);
-void update_node_data(BHTreeNode* node, Particle* particle);
-void aggregate_data(BHTreeNode* node);
-void subdivide(BHTreeNode* node);
-void compute_force(BHTreeNode* node, Particle* particle, double theta);
+// Tree nodes are carved out of an arena and released together by resetting it
+BHTreeNode* create_tree_node(Arena* arena, Boundary bounds, int capacity);
+int insert_node(Arena* arena, BHTreeNode* node, const ParticleSoA* particles, int index);
+int contains(BHTreeNode* node, double x_pos, double y_pos);
+void update_node_data(BHTreeNode* node, double x_pos, double y_pos, double mass);
+void aggregate_data(BHTreeNode* node, const ParticleSoA* particles);
+void subdivide(Arena* arena, BHTreeNode* node);
+void remove_particle(BHTreeNode* leaf, int index);
+void prune_tree(Arena* arena, BHTreeNode* node);
+void compute_force(BHTreeNode* node, ParticleSoA* particles, int index, double theta);
 void print_node_data(BHTreeNode* node);
-void destroy_tree_node(BHTreeNode* node);
 
 #endif // TREE_H
\ No newline at end of file
@@ -0,0 +1,70 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "frames.h"
+
+// Minimal viewer: follows the frame ring of one rank and prints a summary of
+// every frame it picks up, counting the frames it missed. Waits for the ring
+// to appear, moves to its replacement when the rank outgrows it and stops once
+// the run is over and the last frame was read.
+int main(int argc, char** argv) {
+    if (argc > 3) {
+        fprintf(stderr, "Usage: %s [rank] [poll interval in microseconds]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    int rank = argc > 1 ? atoi(argv[1]) : 0;
+    int interval = argc > 2 ? atoi(argv[2]) : 1000;
+
+    char name[64];
+    snprintf(name, sizeof(name), "%s.%d", FRAME_RING_PREFIX, rank);
+
+    size_t size;
+    const FrameRingHeader* header;
+    while (!(header = open_frame_ring(name, &size))) {
+        usleep(interval);
+    }
+
+    Frame* frame = create_frame(header);
+    uint64_t read = 0;
+    uint64_t dropped = 0;
+    for (;;) {
+        int finished = atomic_load(&header->finished);
+        int replaced = atomic_load(&header->replaced);
+        uint64_t previous = frame->frame;
+        if (read_latest_frame(header, frame)) {
+            dropped += frame->frame - previous - 1;
+            read += 1;
+
+            double x_sum = 0.0;
+            double y_sum = 0.0;
+            for (int p = 0; p < frame->particle_count; p++) {
+                x_sum += frame->x_pos[p];
+                y_sum += frame->y_pos[p];
+            }
+            int count = frame->particle_count > 0 ? frame->particle_count : 1;
+            printf("frame %llu step %lld t %lf: %d particles around (%lf, %lf), %d nodes\n",
+                   (unsigned long long)frame->frame, (long long)frame->step, frame->time,
+                   frame->particle_count, x_sum / count, y_sum / count, frame->node_count);
+        } else if (finished) {
+            break;
+        } else if (replaced) {
+            // Keep counting from the last frame read, the new ring carries on
+            uint64_t last = frame->frame;
+            destroy_frame(frame);
+            close_frame_ring(header, size);
+            while (!(header = open_frame_ring(name, &size))) {
+                usleep(interval);
+            }
+            frame = create_frame(header);
+            frame->frame = last;
+        } else {
+            usleep(interval);
+        }
+    }
+
+    printf("%llu frames read, %llu dropped\n", (unsigned long long)read, (unsigned long long)dropped);
+    destroy_frame(frame);
+    close_frame_ring(header, size);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,207 @@
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "io.h"
+#include "snapshot.h"
+#include "tree.h"
+
+// Deterministic initial conditions for benchmarks. The same distribution,
+// count and seed always give the same particles: the random numbers come from
+// a splitmix64 stream, not from the C library.
+//
+// uniform   Uniform positions and masses over the domain, at rest, like the
+//           inputs that ship with the code
+// plummer   Plummer sphere (projected onto the plane) in virial equilibrium
+// clustered Plummer clusters of varying size scattered over the domain
+// disk      Exponential disk on circular orbits around the center
+
+#define CENTER (DEFAULT_BOUNDARY_SIZE / 2)
+#define MAX_RADIUS (0.95 * CENTER)      // Structured distributions stay inside this
+#define PLUMMER_RADIUS 0.25             // Plummer scale length
+#define DISK_RADIUS 0.4                 // Disk scale length
+#define CLUSTERS 32
+#define UNIFORM_MAX_MASS 4.0            // Masses in (0, 4] like the shipped inputs
+
+// Total mass of the structured distributions, chosen so their dynamical time
+// G M / a^3 is of order one in the units of the time step
+#define STRUCTURED_MASS (PLUMMER_RADIUS * PLUMMER_RADIUS * PLUMMER_RADIUS / G)
+
+typedef struct {
+    uint64_t state;
+} Random;
+
+static uint64_t next_random(Random* random) {
+    uint64_t z = (random->state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+// Uniform in [0, 1)
+static double uniform(Random* random) {
+    return (next_random(random) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// Uniform in (0, 1], safe for logarithms and negative powers
+static double uniform_open(Random* random) {
+    return 1.0 - uniform(random);
+}
+
+// Random direction in three dimensions, projected onto the plane
+static void isotropic(Random* random, double length, double* x, double* y) {
+    double cos_theta = 2.0 * uniform(random) - 1.0;
+    double sin_theta = sqrt(1.0 - cos_theta * cos_theta);
+    double phi = 2.0 * M_PI * uniform(random);
+    *x = length * sin_theta * cos(phi);
+    *y = length * sin_theta * sin(phi);
+}
+
+// One Plummer particle of a cluster with the given scale and mass, centered
+// at the origin. Speeds are drawn from the distribution function (Aarseth,
+// Henon and Wielen 1974) so the cluster starts in equilibrium.
+static void plummer_particle(Random* random, double scale, double mass, double max_radius, Particle* particle) {
+    double radius;
+    do {
+        radius = 1.0 / sqrt(pow(uniform_open(random), -2.0 / 3.0) - 1.0);
+    } while (radius * scale > max_radius);
+    isotropic(random, radius * scale, &particle->x_pos, &particle->y_pos);
+
+    double q;
+    do {
+        q = uniform(random);
+    } while (0.1 * uniform(random) > q * q * pow(1.0 - q * q, 3.5));
+    double speed = q * sqrt(2.0) * pow(1.0 + radius * radius, -0.25) * sqrt(G * mass / scale);
+    isotropic(random, speed, &particle->x_vel, &particle->y_vel);
+}
+
+static void generate_uniform(Random* random, Particle* particles, int count) {
+    for (int i = 0; i < count; i++) {
+        particles[i].x_pos = DEFAULT_BOUNDARY_SIZE * uniform(random);
+        particles[i].y_pos = DEFAULT_BOUNDARY_SIZE * uniform(random);
+        particles[i].mass = UNIFORM_MAX_MASS * uniform_open(random);
+        particles[i].x_vel = 0.0;
+        particles[i].y_vel = 0.0;
+    }
+}
+
+static void generate_plummer(Random* random, Particle* particles, int count) {
+    for (int i = 0; i < count; i++) {
+        plummer_particle(random, PLUMMER_RADIUS, STRUCTURED_MASS, MAX_RADIUS, &particles[i]);
+        particles[i].x_pos += CENTER;
+        particles[i].y_pos += CENTER;
+        particles[i].mass = STRUCTURED_MASS / count;
+    }
+}
+
+// Clusters get a share of the particles proportional to a random weight and
+// a scale that grows with their mass, so small clusters are also compact
+static void generate_clustered(Random* random, Particle* particles, int count) {
+    double center_x[CLUSTERS], center_y[CLUSTERS], weight[CLUSTERS];
+    double total = 0.0;
+    for (int c = 0; c < CLUSTERS; c++) {
+        center_x[c] = CENTER + (2.0 * uniform(random) - 1.0) * 0.8 * MAX_RADIUS;
+        center_y[c] = CENTER + (2.0 * uniform(random) - 1.0) * 0.8 * MAX_RADIUS;
+        weight[c] = 0.2 + uniform(random);
+        total += weight[c];
+    }
+
+    int first = 0;
+    double cumulative = 0.0;
+    for (int c = 0; c < CLUSTERS; c++) {
+        cumulative += weight[c];
+        int last = c + 1 == CLUSTERS ? count : (int)(count * (cumulative / total));
+        double mass = STRUCTURED_MASS * weight[c] / total;
+        double scale = 0.05 * sqrt(weight[c] * CLUSTERS / total);
+
+        // Clusters stay clear of the domain edge
+        double edge = fmin(fmin(center_x[c], DEFAULT_BOUNDARY_SIZE - center_x[c]),
+                           fmin(center_y[c], DEFAULT_BOUNDARY_SIZE - center_y[c]));
+        for (int i = first; i < last; i++) {
+            plummer_particle(random, scale, mass, 0.95 * edge, &particles[i]);
+            particles[i].x_pos += center_x[c];
+            particles[i].y_pos += center_y[c];
+            particles[i].mass = STRUCTURED_MASS / count;
+        }
+        first = last;
+    }
+}
+
+// Radii follow the exponential surface density (a gamma distribution of
+// order two), speeds the circular speed of the enclosed disk mass plus a
+// small random part
+static void generate_disk(Random* random, Particle* particles, int count) {
+    double outer = 1.0 - (1.0 + MAX_RADIUS / DISK_RADIUS) * exp(-MAX_RADIUS / DISK_RADIUS);
+    for (int i = 0; i < count; i++) {
+        double radius;
+        do {
+            radius = -DISK_RADIUS * log(uniform_open(random) * uniform_open(random));
+        } while (radius > MAX_RADIUS);
+
+        double angle = 2.0 * M_PI * uniform(random);
+        double enclosed = STRUCTURED_MASS * (1.0 - (1.0 + radius / DISK_RADIUS) * exp(-radius / DISK_RADIUS)) / outer;
+        double speed = sqrt(G * enclosed / fmax(radius, RLIMIT));
+        double jitter_x, jitter_y;
+        isotropic(random, 0.05 * speed, &jitter_x, &jitter_y);
+
+        particles[i].x_pos = CENTER + radius * cos(angle);
+        particles[i].y_pos = CENTER + radius * sin(angle);
+        particles[i].mass = STRUCTURED_MASS / count;
+        particles[i].x_vel = -speed * sin(angle) + jitter_x;
+        particles[i].y_vel = speed * cos(angle) + jitter_y;
+    }
+}
+
+int main(int argc, char** argv) {
+    if (argc < 4 || argc > 5) {
+        fprintf(stderr, "Usage: %s <uniform|plummer|clustered|disk> <count> <output> [seed]\n", argv[0]);
+        fprintf(stderr, "Outputs ending in %s are written as snapshots, anything else as text\n", SNAPSHOT_SUFFIX);
+        return EXIT_FAILURE;
+    }
+
+    const char* distribution = argv[1];
+    double requested = strtod(argv[2], NULL); // Also takes counts like 1e6
+    if (!(requested >= 1 && requested <= INT32_MAX)) {
+        fprintf(stderr, "Particle count must be between 1 and %d\n", INT32_MAX);
+        return EXIT_FAILURE;
+    }
+    int count = (int)requested;
+    Random random = {argc == 5 ? strtoull(argv[4], NULL, 10) : 1};
+
+    Particle* particles = (Particle*)malloc(count * sizeof(Particle));
+    if (!particles) {
+        perror("Memory allocation error");
+        return EXIT_FAILURE;
+    }
+
+    if (strcmp(distribution, "uniform") == 0) {
+        generate_uniform(&random, particles, count);
+    } else if (strcmp(distribution, "plummer") == 0) {
+        generate_plummer(&random, particles, count);
+    } else if (strcmp(distribution, "clustered") == 0) {
+        generate_clustered(&random, particles, count);
+    } else if (strcmp(distribution, "disk") == 0) {
+        generate_disk(&random, particles, count);
+    } else {
+        fprintf(stderr, "Unknown distribution: %s\n", distribution);
+        return EXIT_FAILURE;
+    }
+
+    for (int i = 0; i < count; i++) {
+        particles[i].index = i;
+        particles[i].x_force = 0.0;
+        particles[i].y_force = 0.0;
+        particles[i].cost = 1.0f;
+    }
+
+    if (has_snapshot_suffix(argv[3])) {
+        write_snapshot(argv[3], particles, count);
+    } else {
+        write_output_file(argv[3], particles, count);
+    }
+
+    free(particles);
+    return EXIT_SUCCESS;
+}
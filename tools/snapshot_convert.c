@@ -0,0 +1,30 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "io.h"
+#include "snapshot.h"
+#include "threads.h"
+
+// Convert between the text input format and binary snapshots. The direction
+// follows the input: a snapshot becomes text, anything else is parsed as text.
+int main(int argc, char** argv) {
+    if (argc < 3 || argc > 4) {
+        fprintf(stderr, "Usage: %s <input> <output> [threads]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    int particle_count = 0;
+    Particle* particles;
+    if (is_snapshot_file(argv[1])) {
+        particles = read_snapshot(argv[1], &particle_count);
+        write_output_file(argv[2], particles, particle_count);
+    } else {
+        ThreadPool* pool = create_thread_pool(argc == 4 ? atoi(argv[3]) : 1);
+        particles = read_input_file(argv[1], &particle_count, pool);
+        destroy_thread_pool(pool);
+        write_snapshot(argv[2], particles, particle_count);
+    }
+
+    free(particles);
+    return EXIT_SUCCESS;
+}